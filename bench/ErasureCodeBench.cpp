@@ -0,0 +1,64 @@
+// Single-thread Reed-Solomon throughput for each GF(2^8) kernel the CPU supports:
+// encoding a stripe, and rebuilding it with as many data shards lost as there are
+// parity shards (the worst degraded read). Rates are data bytes per second.
+//
+//     cmake -S . -B build -DDFS_BUILD_BENCHMARKS=ON && cmake --build build --target ErasureCodeBench
+//     ./build/ErasureCodeBench [k] [m] [stripe MiB]
+
+#include "ErasureCode.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+namespace {
+
+double gigabytesPerSecond(size_t bytesPerCall, const std::function<void()>& body) {
+    body();
+
+    // Enough calls for about half a second
+    long iterations = 0;
+    auto started = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed(0);
+    do {
+        body();
+        ++iterations;
+        elapsed = std::chrono::steady_clock::now() - started;
+    } while (elapsed.count() < 0.5);
+
+    return static_cast<double>(bytesPerCall) * iterations / elapsed.count() / 1e9;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int k = argc > 1 ? std::atoi(argv[1]) : 6;
+    int m = argc > 2 ? std::atoi(argv[2]) : 3;
+    long stripeMiB = argc > 3 ? std::atol(argv[3]) : 8;
+    if (k < 1 || m < 1 || k + m > 256 || stripeMiB < 1) {
+        std::fprintf(stderr, "usage: %s [k] [m] [stripe MiB]\n", argv[0]);
+        return 1;
+    }
+
+    ErasureCode code(k, m);
+    size_t shardBytes = code.shardSize(static_cast<size_t>(stripeMiB) * 1024 * 1024);
+    std::vector<uint8_t> stripe(shardBytes * static_cast<size_t>(k + m));
+    std::vector<uint8_t*> shards;
+    for (int s = 0; s < k + m; ++s) shards.push_back(stripe.data() + shardBytes * static_cast<size_t>(s));
+    for (size_t i = 0; i < shardBytes * static_cast<size_t>(k); ++i) stripe[i] = static_cast<uint8_t>(std::rand());
+
+    std::vector<bool> present(static_cast<size_t>(k + m), true);
+    for (int s = 0; s < m && s < k; ++s) present[s] = false;
+    size_t dataBytes = shardBytes * static_cast<size_t>(k);
+
+    std::printf("k=%d m=%d, %ld MiB stripes\n", k, m, stripeMiB);
+    std::printf("%-8s %14s %14s\n", "kernel", "encode GB/s", "decode GB/s");
+    for (const char* kernel : { "scalar", "ssse3", "avx2" }) {
+        if (!ErasureCode::useKernel(kernel)) continue;
+        double encode = gigabytesPerSecond(dataBytes, [&]() { code.encode(shards, shardBytes); });
+        double decode = gigabytesPerSecond(dataBytes, [&]() { code.reconstruct(shards, present, shardBytes); });
+        std::printf("%-8s %14.2f %14.2f\n", kernel, encode, decode);
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Compares JsonWriter with the Poco::JSON DOM path it replaced (build Object/Array,
+// stringify into a stringstream, copy out with str()) on the shapes the API sends.
+//
+//     cmake -S . -B build -DDFS_BUILD_BENCHMARKS=ON && cmake --build build --target JsonWriterBench
+//     ./build/JsonWriterBench [iterations]
+
+#include "JsonWriter.h"
+#include <Poco/JSON/Array.h>
+#include <Poco/JSON/Object.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Row {
+    int fileId;
+    std::string filename;
+    long size;
+    std::string contentType;
+    std::string uploadDate;
+    bool isPublic;
+};
+
+std::vector<Row> makeRows(size_t count) {
+    std::vector<Row> rows;
+    for (size_t i = 0; i < count; ++i) {
+        // Every fourth name needs escaping, as user-supplied names sometimes do
+        std::string name = "quarterly report " + std::to_string(i) + (i % 4 == 0 ? " \"final\"\\v2.pdf" : ".pdf");
+        rows.push_back(Row{static_cast<int>(i + 1), name, 1048576L + static_cast<long>(i),
+                           "application/pdf", "2024-05-01 12:34:56.123456", i % 2 == 0});
+    }
+    return rows;
+}
+
+std::string domError() {
+    Poco::JSON::Object errorObj;
+    errorObj.set("success", false);
+    errorObj.set("error", "File not found or access denied");
+    std::stringstream ss;
+    errorObj.stringify(ss);
+    return ss.str();
+}
+
+size_t writerError() {
+    JsonWriter json;
+    json.beginObject().field("success", false).field("error", "File not found or access denied").endObject();
+    return json.size();
+}
+
+std::string domListing(const std::vector<Row>& rows) {
+    Poco::JSON::Array filesArray;
+    for (const Row& row : rows) {
+        Poco::JSON::Object fileObj;
+        fileObj.set("file_id", row.fileId);
+        fileObj.set("filename", row.filename);
+        fileObj.set("size", row.size);
+        fileObj.set("content_type", row.contentType);
+        fileObj.set("upload_date", row.uploadDate);
+        fileObj.set("is_public", row.isPublic);
+        filesArray.add(fileObj);
+    }
+    Poco::JSON::Object responseObj;
+    responseObj.set("success", true);
+    responseObj.set("files", filesArray);
+    std::stringstream ss;
+    responseObj.stringify(ss);
+    return ss.str();
+}
+
+size_t writerListing(const std::vector<Row>& rows) {
+    JsonWriter json;
+    json.beginObject().field("success", true).key("files").beginArray();
+    for (const Row& row : rows) {
+        json.beginObject()
+            .field("file_id", row.fileId)
+            .field("filename", row.filename)
+            .field("size", row.size)
+            .field("content_type", row.contentType)
+            .field("upload_date", row.uploadDate)
+            .field("is_public", row.isPublic)
+            .endObject();
+    }
+    json.endArray().endObject();
+    return json.size();
+}
+
+volatile size_t sink;
+
+double nanosPerCall(long iterations, const std::function<size_t()>& body) {
+    for (long i = 0; i < iterations / 10 + 1; ++i) sink = body();
+
+    auto started = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) sink = body();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - started;
+    return elapsed.count() / static_cast<double>(iterations);
+}
+
+void compare(const char* name, long iterations, const std::function<size_t()>& dom,
+             const std::function<size_t()>& writer) {
+    double domNanos = nanosPerCall(iterations, dom);
+    double writerNanos = nanosPerCall(iterations, writer);
+    std::printf("%-16s %12.0f %12.0f %8.1fx\n", name, domNanos, writerNanos, domNanos / writerNanos);
+}
+
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? std::atol(argv[1]) : 20000;
+    if (iterations <= 0) iterations = 20000;
+
+    std::vector<Row> page = makeRows(100);
+    std::vector<Row> largePage = makeRows(1000);
+
+    std::printf("%-16s %12s %12s %9s\n", "response", "dom ns/op", "writer ns/op", "speedup");
+    compare("error", iterations, []() { return domError().size(); }, []() { return writerError(); });
+    compare("list 100 rows", std::max(1L, iterations / 10), [&]() { return domListing(page).size(); },
+            [&]() { return writerListing(page); });
+    compare("list 1000 rows", std::max(1L, iterations / 100), [&]() { return domListing(largePage).size(); },
+            [&]() { return writerListing(largePage); });
+    return 0;
+}
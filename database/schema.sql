@@ -24,6 +24,34 @@ CREATE TABLE IF NOT EXISTS files (
     is_public BOOLEAN DEFAULT FALSE
 );
 
+-- Content-addressed blobs; files.filename holds the blob hash
+CREATE TABLE IF NOT EXISTS blobs (
+    blob_hash CHAR(64) PRIMARY KEY,
+    file_size BIGINT NOT NULL,
+    ref_count INTEGER NOT NULL DEFAULT 0,
+    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+);
+
+-- Resumable upload sessions
+CREATE TABLE IF NOT EXISTS upload_sessions (
+    upload_id VARCHAR(64) PRIMARY KEY,
+    owner_id INTEGER REFERENCES users(user_id),
+    original_filename VARCHAR(255) NOT NULL,
+    content_type VARCHAR(100),
+    total_size BIGINT NOT NULL,
+    temp_filename VARCHAR(255) NOT NULL,
+    created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    expires_at TIMESTAMP
+);
+
+-- Chunks received for an upload session
+CREATE TABLE IF NOT EXISTS upload_chunks (
+    upload_id VARCHAR(64) REFERENCES upload_sessions(upload_id) ON DELETE CASCADE,
+    chunk_offset BIGINT NOT NULL,
+    chunk_length BIGINT NOT NULL,
+    PRIMARY KEY (upload_id, chunk_offset)
+);
+
 -- File shares table
 CREATE TABLE IF NOT EXISTS file_shares (
     share_id SERIAL PRIMARY KEY,
@@ -43,8 +71,30 @@ CREATE TABLE IF NOT EXISTS user_sessions (
     expires_at TIMESTAMP
 );
 
+-- Cluster mode: each node refreshes its row on every heartbeat; the ring is built from recent rows
+CREATE TABLE IF NOT EXISTS cluster_nodes (
+    node_id VARCHAR(64) PRIMARY KEY,
+    base_url VARCHAR(255) NOT NULL,
+    joined_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    last_seen TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+);
+
+-- The node holding each stored file; rebalancing moves files towards their ring owner
+CREATE TABLE IF NOT EXISTS file_locations (
+    filename VARCHAR(255) PRIMARY KEY,
+    node_id VARCHAR(64) NOT NULL
+);
+
 -- Indexes for performance
-CREATE INDEX IF NOT EXISTS idx_files_owner ON files(owner_id);
+-- Serves GET /files pages by keyset (upload_date, file_id), newest first; also covers lookups by owner
+CREATE INDEX IF NOT EXISTS idx_files_owner_listing ON files(owner_id, upload_date DESC, file_id DESC);
+DROP INDEX IF EXISTS idx_files_owner;
+CREATE INDEX IF NOT EXISTS idx_files_filename ON files(filename);
 CREATE INDEX IF NOT EXISTS idx_shares_file ON file_shares(file_id);
 CREATE INDEX IF NOT EXISTS idx_shares_token ON file_shares(share_token);
-CREATE INDEX IF NOT EXISTS idx_sessions_user ON user_sessions(user_id);
\ No newline at end of file
+CREATE INDEX IF NOT EXISTS idx_sessions_user ON user_sessions(user_id);
+CREATE INDEX IF NOT EXISTS idx_upload_sessions_owner ON upload_sessions(owner_id);
+CREATE INDEX IF NOT EXISTS idx_file_locations_node ON file_locations(node_id, filename);
+CREATE INDEX IF NOT EXISTS idx_sessions_expires ON user_sessions(expires_at);
+CREATE INDEX IF NOT EXISTS idx_shares_expires ON file_shares(expires_at);
+CREATE INDEX IF NOT EXISTS idx_upload_sessions_expires ON upload_sessions(expires_at);
\ No newline at end of file
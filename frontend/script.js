@@ -180,6 +180,16 @@ document.addEventListener('DOMContentLoaded', function() {
 
 
 function logout() {
+    // End the session server-side too; the local state is cleared regardless
+    if (sessionToken) {
+        fetch(`${API_BASE}/logout`, {
+            method: 'POST',
+            headers: {
+                'Authorization': `Bearer ${sessionToken}`
+            }
+        }).catch(() => {});
+    }
+    
     sessionToken = null;
     currentUser = null;
     localStorage.removeItem('sessionToken');
@@ -272,19 +282,31 @@ async function loadFiles() {
     showLoading(true);
     
     try {
-        const response = await fetch(`${API_BASE}/files`, {
-            headers: {
-                'Authorization': `Bearer ${sessionToken}`
-            }
-        });
+        // The listing is paginated; follow next_cursor until the last page
+        let files = [];
+        let cursor = null;
         
-        const data = await response.json();
+        do {
+            const query = cursor ? `?cursor=${encodeURIComponent(cursor)}` : '';
+            const response = await fetch(`${API_BASE}/files${query}`, {
+                headers: {
+                    'Authorization': `Bearer ${sessionToken}`
+                }
+            });
+            
+            const data = await response.json();
+            
+            if (!data.success) {
+                showMessage('Failed to load files: ' + data.error, 'error');
+                showLoading(false);
+                return;
+            }
+            
+            files = files.concat(data.files);
+            cursor = data.next_cursor;
+        } while (cursor);
         
-        if (data.success) {
-            displayFiles(data.files);
-        } else {
-            showMessage('Failed to load files: ' + data.error, 'error');
-        }
+        displayFiles(files);
     } catch (error) {
         showMessage('Network error: ' + error.message, 'error');
     }
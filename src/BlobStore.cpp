@@ -0,0 +1,159 @@
+#include "BlobStore.h"
+#include "Database.h"
+#include "FileManager.h"
+#include "Logger.h"
+#include "Utils.h"
+#include <Poco/Crypto/DigestEngine.h>
+#include <Poco/Data/Statement.h>
+#include <Poco/Exception.h>
+#include <fstream>
+#include <vector>
+
+using namespace Poco::Data::Keywords;
+
+std::string BlobStore::getBlobFilename(const std::string& contentHash) {
+    return FileManager::getFanoutFilename(contentHash);
+}
+
+std::string BlobStore::getHashFromFilename(const std::string& filename) {
+    std::string name = filename.substr(filename.find_last_of('/') + 1);
+    if (name.size() != 64) return "";
+    
+    for (char c : name) {
+        bool hexDigit = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+        if (!hexDigit) return "";
+    }
+    return name;
+}
+
+bool BlobStore::exists(const std::string& contentHash) {
+    try {
+        auto session = Database::getInstance().getSession();
+        
+        int count = 0;
+        std::string hash = contentHash;
+        Poco::Data::Statement check(session);
+        check << "SELECT COUNT(*) FROM blobs WHERE blob_hash = $1 AND ref_count > 0",
+            use(hash), into(count);
+        check.execute();
+        
+        return count > 0;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Blob lookup failed: " << ex.displayText();
+        return false;
+    }
+}
+
+std::string BlobStore::hashFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return "";
+    
+    long size = 0;
+    std::string hash = hashStream(file, size);
+    return file.bad() ? "" : hash;
+}
+
+std::string BlobStore::hashStream(std::istream& content, long& size) {
+    Poco::Crypto::DigestEngine digest("SHA256");
+    std::vector<char> buffer(FileManager::getUploadBufferSize());
+    size = 0;
+    
+    while (content) {
+        content.read(buffer.data(), buffer.size());
+        std::streamsize count = content.gcount();
+        if (count <= 0) break;
+        
+        digest.update(buffer.data(), static_cast<unsigned>(count));
+        size += count;
+    }
+    
+    if (content.bad()) return "";
+    return Poco::DigestEngine::digestToHex(digest.digest());
+}
+
+bool BlobStore::addReference(Poco::Data::Session& session, const std::string& contentHash, 
+                             long fileSize, bool allowCreate, bool& created) {
+    std::string hash = contentHash;
+    created = false;
+    
+    if (!allowCreate) {
+        // Caller has no bytes to offer, so only an existing blob will do
+        Poco::Data::Statement update(session);
+        update << "UPDATE blobs SET ref_count = ref_count + 1 WHERE blob_hash = $1 AND ref_count > 0",
+            use(hash);
+        return update.execute() > 0;
+    }
+    
+    int refCount = 0;
+    Poco::Data::Statement upsert(session);
+    upsert << "INSERT INTO blobs (blob_hash, file_size, ref_count) VALUES ($1, $2, 1) "
+              "ON CONFLICT (blob_hash) DO UPDATE SET ref_count = blobs.ref_count + 1 "
+              "RETURNING ref_count",
+        use(hash), use(fileSize), into(refCount);
+    upsert.execute();
+    
+    created = (refCount == 1);
+    return refCount > 0;
+}
+
+bool BlobStore::releaseReference(Poco::Data::Session& session, const std::string& contentHash, 
+                                 bool& lastReference) {
+    std::string hash = contentHash;
+    int refCount = -1;
+    lastReference = false;
+    
+    Poco::Data::Statement update(session);
+    update << "UPDATE blobs SET ref_count = ref_count - 1 WHERE blob_hash = $1 RETURNING ref_count",
+        use(hash), into(refCount);
+    update.execute();
+    
+    if (refCount < 0) return false;
+    
+    // The bytes stay until the delete has committed: if it rolls back, nothing is lost
+    lastReference = (refCount == 0);
+    return true;
+}
+
+std::vector<std::string> BlobStore::purgeUnreferenced(const std::vector<std::string>& contentHashes,
+                                                      const std::function<void(const std::string&)>& removeBytes) {
+    std::vector<std::string> purged;
+    if (contentHashes.empty()) return purged;
+    
+    try {
+        auto session = Database::getInstance().getSession();
+        session.begin();
+        
+        try {
+            // A concurrent upload of the same content waits on these row locks and then
+            // recreates the blob; one that got in first has raised the count above zero
+            std::string hashArray = Utils::toPostgresArray(contentHashes);
+            Poco::Data::Statement select(session);
+            select << "SELECT blob_hash FROM blobs WHERE blob_hash = ANY($1::text[]) AND ref_count <= 0 "
+                      "FOR UPDATE",
+                use(hashArray), into(purged);
+            select.execute();
+            
+            for (const auto& hash : purged) removeBytes(hash);
+            
+            if (!purged.empty()) {
+                std::string purgedArray = Utils::toPostgresArray(purged);
+                Poco::Data::Statement remove(session);
+                remove << "DELETE FROM blobs WHERE blob_hash = ANY($1::text[])", use(purgedArray);
+                remove.execute();
+            }
+            session.commit();
+            return purged;
+        }
+        catch (...) {
+            if (session.isTransaction()) session.rollback();
+            throw;
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        // Rows left at zero are harmless: uploads recreate them, and storage
+        // reconciliation collects bytes no file references
+        DFS_LOG_ERROR << "Blob cleanup failed: " << ex.displayText();
+        return purged;
+    }
+}
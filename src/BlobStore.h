@@ -0,0 +1,37 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <Poco/Data/Session.h>
+#include <string>
+#include <istream>
+#include <functional>
+#include <vector>
+
+// Content-addressed storage under the uploads directory. Each distinct file body
+// is stored once, named by its SHA-256, and reference counted in the blobs table.
+class BlobStore {
+public:
+    static std::string getBlobFilename(const std::string& contentHash);
+    // Returns the hash for a blob filename, or "" for files stored before deduplication
+    static std::string getHashFromFilename(const std::string& filename);
+    
+    static bool exists(const std::string& contentHash);
+    static std::string hashFile(const std::string& path);
+    // Consumes the stream without storing it, for verifying bodies of known blobs
+    static std::string hashStream(std::istream& content, long& size);
+    
+    // Must run inside the caller's transaction. created reports whether this is the
+    // first reference, in which case the caller must move the blob's bytes into place.
+    static bool addReference(Poco::Data::Session& session, const std::string& contentHash, 
+                            long fileSize, bool allowCreate, bool& created);
+    // The last release leaves the row at zero; purgeUnreferenced removes it once the
+    // transaction has committed
+    static bool releaseReference(Poco::Data::Session& session, const std::string& contentHash, 
+                                bool& lastReference);
+    // After the releasing transaction commits: for each blob still unreferenced, calls
+    // removeBytes and drops its row while the row is locked. Returns the blobs removed.
+    static std::vector<std::string> purgeUnreferenced(const std::vector<std::string>& contentHashes,
+                                                      const std::function<void(const std::string&)>& removeBytes);
+};
+
+#endif
@@ -0,0 +1,686 @@
+#include "ChunkStore.h"
+#include "StorageBackend.h"
+#include "Config.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Utils.h"
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/StringTokenizer.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+namespace {
+
+const char MANIFEST_MAGIC[] = "dfs-chunks";
+const int MANIFEST_VERSION = 1;
+const size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+void removeQuietly(const std::string& path) {
+    try {
+        Poco::File file(path);
+        if (file.exists()) file.remove();
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Removing " << path << " failed: " << ex.displayText();
+    }
+}
+
+bool readFully(int fd, void* buffer, size_t length, Poco::UInt64 offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t bytesRead = ::pread(fd, static_cast<char*>(buffer) + done, length - done, static_cast<off_t>(offset + done));
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0) return false;
+        done += static_cast<size_t>(bytesRead);
+    }
+    return true;
+}
+
+bool readFile(const std::string& path, void* buffer, size_t length, Poco::UInt64 offset) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = readFully(fd, buffer, length, offset);
+    ::close(fd);
+    return ok;
+}
+
+// Written aside and renamed, so a shard is either whole or absent
+bool writeFile(const std::string& path, const void* data, size_t length) {
+    try {
+        Poco::Path parent(path);
+        parent.makeParent();
+        Poco::File(parent).createDirectories();
+    }
+    catch (const Poco::Exception&) {
+        return false;
+    }
+
+    std::string partPath = path + ".part";
+    int fd = ::open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) return false;
+
+    size_t done = 0;
+    while (done < length) {
+        ssize_t written = ::write(fd, static_cast<const char*>(data) + done, length - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) break;
+        done += static_cast<size_t>(written);
+    }
+    bool ok = ::close(fd) == 0 && done == length && ::rename(partPath.c_str(), path.c_str()) == 0;
+    if (!ok) ::unlink(partPath.c_str());
+    return ok;
+}
+
+std::string asDirectory(const std::string& path) {
+    return (path.empty() || path.back() == '/') ? path : path + "/";
+}
+
+// A task that threw counts as failed
+bool succeeded(std::future<bool>& result) {
+    try {
+        return result.get();
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+// In the kernel where the filesystem allows it (a reflink on XFS and btrfs), through a buffer otherwise
+bool copyRange(int from, int to, Poco::UInt64 offset, Poco::UInt64 length) {
+    off_t in = static_cast<off_t>(offset);
+    off_t out = 0;
+#ifdef __linux__
+    while (length > 0) {
+        ssize_t copied = ::copy_file_range(from, &in, to, &out, static_cast<size_t>(length), 0);
+        if (copied < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL) break;
+            return false;
+        }
+        if (copied == 0) return false;  // The staged file is shorter than it was
+        length -= static_cast<Poco::UInt64>(copied);
+    }
+#endif
+
+    std::vector<char> buffer(length > 0 ? COPY_BUFFER_SIZE : 0);
+    while (length > 0) {
+        size_t count = length > buffer.size() ? buffer.size() : static_cast<size_t>(length);
+        ssize_t bytesRead = ::pread(from, buffer.data(), count, in);
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0) return false;
+
+        ssize_t written = 0;
+        while (written < bytesRead) {
+            ssize_t n = ::pwrite(to, buffer.data() + written, static_cast<size_t>(bytesRead - written), out + written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            written += n;
+        }
+        in += bytesRead;
+        out += bytesRead;
+        length -= static_cast<Poco::UInt64>(bytesRead);
+    }
+    return true;
+}
+
+}
+
+ChunkStore& ChunkStore::getInstance() {
+    static ChunkStore instance;
+    return instance;
+}
+
+std::string ChunkStore::getManifestFilename(const std::string& filename) {
+    return filename + ".manifest";
+}
+
+std::string ChunkStore::getChunkFilename(const std::string& filename, size_t index) {
+    return filename + ".c" + std::to_string(index);
+}
+
+std::string ChunkStore::getShardPath(const ChunkManifest& manifest, size_t index, int shard) {
+    // Rotated by chunk, so no directory holds every chunk's first data shard
+    const std::vector<std::string>& directories = manifest.shardDirectories;
+    const std::string& directory = directories[(index + static_cast<size_t>(shard)) % directories.size()];
+    return directory + getChunkFilename(manifest.filename, index) + ".s" + std::to_string(shard);
+}
+
+ChunkStore::ChunkStore() : stopping(false) {
+    enabled = Config::getBool("DFS_CHUNKED_STORAGE", false);
+    chunkSize = static_cast<Poco::UInt64>(std::max(64L * 1024, Config::getInt("DFS_CHUNK_SIZE_BYTES", 8L * 1024 * 1024)));
+    threadCount = static_cast<size_t>(std::max(1L, Config::getInt("DFS_CHUNK_THREADS", 8)));
+    readAhead = static_cast<size_t>(std::max(0L, std::min(Config::getInt("DFS_CHUNK_READ_AHEAD", 2), 64L)));
+
+    if (Config::getBool("DFS_ERASURE_CODING", false)) {
+        long dataShards = Config::getInt("DFS_ERASURE_DATA_SHARDS", 6);
+        long parityShards = Config::getInt("DFS_ERASURE_PARITY_SHARDS", 3);
+        Poco::StringTokenizer directories(Config::getString("DFS_ERASURE_DIRS", ""), ",",
+                                          Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        for (const auto& directory : directories) shardDirectories.push_back(asDirectory(directory));
+
+        // Two shards of a chunk in one directory would both go with it
+        if (shardDirectories.size() < static_cast<size_t>(std::max(0L, dataShards + parityShards))) {
+            DFS_LOG_ERROR << "Erasure coding needs at least " << dataShards + parityShards
+                          << " DFS_ERASURE_DIRS, got " << shardDirectories.size() << "; it stays off";
+            shardDirectories.clear();
+        }
+        else {
+            try {
+                erasureCode.reset(new ErasureCode(static_cast<int>(dataShards), static_cast<int>(parityShards)));
+                for (const auto& directory : shardDirectories) Utils::createDirectory(directory);
+                enabled = true;
+            }
+            catch (const Poco::Exception& ex) {
+                DFS_LOG_ERROR << "Erasure coding stays off: " << ex.displayText();
+                shardDirectories.clear();
+            }
+        }
+    }
+}
+
+ChunkStore::~ChunkStore() {
+    stop();
+}
+
+void ChunkStore::start() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    // Without the pool, files chunked earlier are still readable, one chunk at a time
+    if (!enabled || !workers.empty()) return;
+
+    stopping = false;
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back([this]() { run(); });
+    }
+    DFS_LOG_INFO << "Chunked storage: " << chunkSize << " byte chunks, " << threadCount << " threads";
+    if (erasureCode) {
+        DFS_LOG_INFO << "Erasure coding: " << erasureCode->dataShards() << "+" << erasureCode->parityShards()
+                     << " shards over " << shardDirectories.size() << " directories, "
+                     << ErasureCode::kernelName() << " kernels";
+    }
+}
+
+void ChunkStore::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (workers.empty()) return;
+        stopping = true;
+    }
+    queueReady.notify_all();
+    for (auto& worker : workers) worker.join();
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    workers.clear();
+}
+
+std::future<bool> ChunkStore::submit(std::function<bool()> task) {
+    std::packaged_task<bool()> packaged(std::move(task));
+    std::future<bool> result = packaged.get_future();
+
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!workers.empty() && !stopping) {
+            queue.push_back(std::move(packaged));
+            queued = true;
+        }
+    }
+
+    if (queued) queueReady.notify_one();
+    else packaged();
+    return result;
+}
+
+void ChunkStore::run() {
+    for (;;) {
+        std::packaged_task<bool()> task;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueReady.wait(lock, [this]() { return stopping || !queue.empty(); });
+            // Every queued task has a caller waiting on it, so the queue is drained even when stopping
+            if (queue.empty()) return;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
+
+void ChunkStore::store(const std::string& stagedPath, const std::string& filename) {
+    int stagedFd = ::open(stagedPath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (stagedFd < 0 || ::fstat(stagedFd, &st) != 0) {
+        if (stagedFd >= 0) ::close(stagedFd);
+        removeQuietly(stagedPath);
+        throw Poco::OpenFileException(stagedPath);
+    }
+
+    ChunkManifest manifest;
+    manifest.filename = filename;
+    manifest.size = static_cast<Poco::UInt64>(st.st_size);
+    manifest.chunkSize = chunkSize;
+    if (erasureCode) {
+        manifest.dataShards = erasureCode->dataShards();
+        manifest.parityShards = erasureCode->parityShards();
+        manifest.shardDirectories = shardDirectories;
+    }
+    size_t count = manifest.chunkCount();
+
+    // At most one chunk per worker in flight, so a huge upload cannot queue ahead of every read
+    std::deque<std::future<bool>> inFlight;
+    size_t submitted = 0;
+    bool ok = true;
+    while (ok && submitted < count) {
+        if (inFlight.size() >= threadCount) {
+            ok = succeeded(inFlight.front());
+            inFlight.pop_front();
+            continue;
+        }
+
+        size_t index = submitted++;
+        if (manifest.isErasureCoded()) {
+            // Every task finishes before this function returns, so the manifest outlives them
+            const ChunkManifest* stripe = &manifest;
+            inFlight.push_back(submit([this, stagedFd, stripe, index]() {
+                return storeShards(stagedFd, *stripe, index);
+            }));
+            continue;
+        }
+
+        Poco::UInt64 chunkOffset = static_cast<Poco::UInt64>(index) * chunkSize;
+        Poco::UInt64 chunkLength = manifest.chunkLength(index);
+        std::string chunkPath = stagedPath + ".c" + std::to_string(index);
+        std::string chunkFilename = getChunkFilename(filename, index);
+        inFlight.push_back(submit([this, stagedFd, chunkPath, chunkFilename, chunkOffset, chunkLength]() {
+            return storeChunk(stagedFd, chunkPath, chunkFilename, chunkOffset, chunkLength);
+        }));
+    }
+    for (auto& result : inFlight) ok = succeeded(result) && ok;
+
+    ::close(stagedFd);
+    removeQuietly(stagedPath);
+
+    StorageBackend& storage = StorageBackend::getInstance();
+    if (ok) {
+        std::string manifestPath = stagedPath + ".manifest";
+        try {
+            {
+                std::ofstream file(manifestPath, std::ios::trunc);
+                file << MANIFEST_MAGIC << " " << MANIFEST_VERSION << "\n"
+                     << "size " << manifest.size << "\n"
+                     << "chunk_size " << manifest.chunkSize << "\n";
+                if (manifest.isErasureCoded()) {
+                    file << "erasure " << manifest.dataShards << " " << manifest.parityShards << "\n"
+                         << "directories " << manifest.shardDirectories.size() << "\n";
+                    for (const auto& directory : manifest.shardDirectories) file << directory << "\n";
+                }
+                file.close();
+                if (!file) throw Poco::WriteFileException(manifestPath);
+            }
+            storage.store(manifestPath, getManifestFilename(filename));
+            return;
+        }
+        catch (const Poco::Exception& ex) {
+            DFS_LOG_ERROR << "Writing chunk manifest of " << filename << " failed: " << ex.displayText();
+            removeQuietly(manifestPath);
+        }
+    }
+
+    // Without a manifest none of the chunks is reachable
+    removeChunks(manifest, submitted);
+    throw Poco::IOException("Storing " + filename + " in chunks failed");
+}
+
+bool ChunkStore::storeChunk(int stagedFd, const std::string& chunkPath, const std::string& chunkFilename,
+                            Poco::UInt64 offset, Poco::UInt64 length) {
+    bool ok = false;
+    {
+        ScopedTimer timer(Metrics::getInstance().diskWrite());
+        int chunkFd = ::open(chunkPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (chunkFd >= 0) {
+            ok = copyRange(stagedFd, chunkFd, offset, length);
+            if (::close(chunkFd) != 0) ok = false;
+        }
+    }
+
+    if (!ok) {
+        DFS_LOG_ERROR << "Writing chunk " << chunkFilename << " failed: " << std::strerror(errno);
+        removeQuietly(chunkPath);
+        writeFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    try {
+        StorageBackend::getInstance().store(chunkPath, chunkFilename);
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Storing chunk " << chunkFilename << " failed: " << ex.displayText();
+        writeFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    chunksWritten.fetch_add(1, std::memory_order_relaxed);
+    bytesWritten.fetch_add(length, std::memory_order_relaxed);
+    return true;
+}
+
+bool ChunkStore::storeShards(int stagedFd, const ChunkManifest& manifest, size_t index) {
+    const ErasureCode& code = *erasureCode;
+    int shardCount = code.dataShards() + code.parityShards();
+    size_t length = static_cast<size_t>(manifest.chunkLength(index));
+    size_t shardBytes = code.shardSize(length);
+
+    // The data shards are consecutive slices of the chunk, zero padded at the end.
+    // Each worker keeps its stripe buffer from one chunk to the next.
+    thread_local std::vector<uint8_t> stripe;
+    stripe.resize(shardBytes * static_cast<size_t>(shardCount));
+    std::vector<uint8_t*> shards;
+    for (int s = 0; s < shardCount; ++s) shards.push_back(stripe.data() + shardBytes * static_cast<size_t>(s));
+
+    bool ok;
+    {
+        ScopedTimer timer(Metrics::getInstance().diskRead());
+        ok = readFully(stagedFd, stripe.data(), length, static_cast<Poco::UInt64>(index) * manifest.chunkSize);
+    }
+    if (ok) {
+        std::memset(stripe.data() + length, 0, shardBytes * static_cast<size_t>(code.dataShards()) - length);
+        code.encode(shards, shardBytes);
+
+        ScopedTimer timer(Metrics::getInstance().diskWrite());
+        for (int s = 0; s < shardCount && ok; ++s) {
+            ok = writeFile(getShardPath(manifest, index, s), shards[s], shardBytes);
+        }
+    }
+
+    if (!ok) {
+        DFS_LOG_ERROR << "Writing shards of chunk " << index << " of " << manifest.filename << " failed";
+        for (int s = 0; s < shardCount; ++s) removeQuietly(getShardPath(manifest, index, s));
+        writeFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    chunksWritten.fetch_add(1, std::memory_order_relaxed);
+    bytesWritten.fetch_add(length, std::memory_order_relaxed);
+    return true;
+}
+
+bool ChunkStore::loadManifest(const std::string& filename, ChunkManifest& manifest) {
+    std::string path = StorageBackend::getInstance().locate(getManifestFilename(filename));
+    if (path.empty()) return false;
+
+    std::ifstream file(path);
+    std::string magic, sizeKey, chunkSizeKey;
+    int version = 0;
+    Poco::UInt64 size = 0;
+    Poco::UInt64 fileChunkSize = 0;
+    file >> magic >> version >> sizeKey >> size >> chunkSizeKey >> fileChunkSize;
+    bool valid = file && magic == MANIFEST_MAGIC && version == MANIFEST_VERSION && sizeKey == "size" &&
+                 chunkSizeKey == "chunk_size" && fileChunkSize > 0;
+
+    // Erasure-coded files go on to name their code and shard directories, one per line
+    int dataShards = 0;
+    int parityShards = 0;
+    std::vector<std::string> directories;
+    std::string erasureKey;
+    if (valid && file >> erasureKey) {
+        std::string directoriesKey, line;
+        size_t directoryCount = 0;
+        file >> dataShards >> parityShards >> directoriesKey >> directoryCount;
+        std::getline(file, line);
+        while (directories.size() < directoryCount && std::getline(file, line)) directories.push_back(line);
+        valid = erasureKey == "erasure" && directoriesKey == "directories" && dataShards >= 1 &&
+                parityShards >= 1 && dataShards + parityShards <= 256 && directoryCount > 0 &&
+                directories.size() == directoryCount;
+    }
+
+    struct stat st;
+    if (!valid || ::stat(path.c_str(), &st) != 0) {
+        DFS_LOG_ERROR << "Chunk manifest " << path << " is unreadable";
+        return false;
+    }
+
+    // The chunk size and code are the ones the file was written with, whatever is configured now
+    manifest.filename = filename;
+    manifest.size = size;
+    manifest.chunkSize = fileChunkSize;
+    manifest.modifiedAt = Poco::Timestamp::fromEpochTime(st.st_mtime);
+    manifest.dataShards = dataShards;
+    manifest.parityShards = parityShards;
+    manifest.shardDirectories.swap(directories);
+    return true;
+}
+
+std::vector<std::string> ChunkStore::getPartFilenames(const std::string& filename) {
+    std::vector<std::string> parts;
+    ChunkManifest manifest;
+    if (!loadManifest(filename, manifest)) return parts;
+
+    parts.push_back(getManifestFilename(filename));
+    if (manifest.isErasureCoded()) return parts;
+    for (size_t i = 0; i < manifest.chunkCount(); ++i) parts.push_back(getChunkFilename(filename, i));
+    return parts;
+}
+
+void ChunkStore::remove(const std::string& filename) {
+    ChunkManifest manifest;
+    if (!loadManifest(filename, manifest)) return;
+
+    StorageBackend::getInstance().remove(getManifestFilename(filename));
+    removeChunks(manifest, manifest.chunkCount());
+}
+
+void ChunkStore::removeChunks(const ChunkManifest& manifest, size_t count) {
+    StorageBackend& storage = StorageBackend::getInstance();
+    for (size_t i = 0; i < count; ++i) {
+        if (!manifest.isErasureCoded()) {
+            storage.remove(getChunkFilename(manifest.filename, i));
+            continue;
+        }
+        for (int s = 0; s < manifest.dataShards + manifest.parityShards; ++s) {
+            removeQuietly(getShardPath(manifest, i, s));
+        }
+    }
+}
+
+bool ChunkStore::readChunk(const ChunkManifest& manifest, size_t index, Poco::UInt64 from, size_t length,
+                           std::vector<char>& buffer) {
+    if (manifest.isErasureCoded()) return readShards(manifest, index, from, length, buffer);
+
+    std::string chunkFilename = getChunkFilename(manifest.filename, index);
+    std::string path = StorageBackend::getInstance().locate(chunkFilename);
+    int fd = path.empty() ? -1 : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        DFS_LOG_ERROR << "Chunk " << chunkFilename << " is missing";
+        readFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    buffer.resize(length);
+    bool ok;
+    {
+        ScopedTimer timer(Metrics::getInstance().diskRead());
+        ok = readFully(fd, buffer.data(), length, from);
+    }
+    ::close(fd);
+
+    if (!ok) {
+        DFS_LOG_ERROR << "Reading chunk " << chunkFilename << " failed";
+        readFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    chunksRead.fetch_add(1, std::memory_order_relaxed);
+    bytesRead.fetch_add(length, std::memory_order_relaxed);
+    return true;
+}
+
+bool ChunkStore::readShards(const ChunkManifest& manifest, size_t index, Poco::UInt64 from, size_t length,
+                            std::vector<char>& buffer) {
+    ErasureCode code(manifest.dataShards, manifest.parityShards);
+    int shardCount = manifest.dataShards + manifest.parityShards;
+    size_t shardBytes = code.shardSize(static_cast<size_t>(manifest.chunkLength(index)));
+    buffer.resize(length);
+
+    // Normally the range comes straight from the data shards it covers
+    bool complete = true;
+    {
+        ScopedTimer timer(Metrics::getInstance().diskRead());
+        size_t first = static_cast<size_t>(from / shardBytes);
+        size_t last = static_cast<size_t>((from + length - 1) / shardBytes);
+        for (size_t s = first; s <= last && complete; ++s) {
+            Poco::UInt64 shardStart = static_cast<Poco::UInt64>(s) * shardBytes;
+            Poco::UInt64 begin = std::max(from, shardStart);
+            Poco::UInt64 end = std::min(from + length, shardStart + shardBytes);
+            complete = readFile(getShardPath(manifest, index, static_cast<int>(s)), buffer.data() + (begin - from),
+                                static_cast<size_t>(end - begin), begin - shardStart);
+        }
+    }
+    if (complete) {
+        chunksRead.fetch_add(1, std::memory_order_relaxed);
+        bytesRead.fetch_add(length, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Degraded: the first k shards that can be read rebuild the whole chunk
+    degradedReads.fetch_add(1, std::memory_order_relaxed);
+    thread_local std::vector<uint8_t> stripe;
+    stripe.resize(shardBytes * static_cast<size_t>(shardCount));
+    std::vector<uint8_t*> shards;
+    for (int s = 0; s < shardCount; ++s) shards.push_back(stripe.data() + shardBytes * static_cast<size_t>(s));
+
+    std::vector<bool> present(static_cast<size_t>(shardCount), false);
+    std::vector<int> lost;
+    int found = 0;
+    int next = 0;
+    {
+        ScopedTimer timer(Metrics::getInstance().diskRead());
+        for (; next < shardCount && found < manifest.dataShards; ++next) {
+            if (readFile(getShardPath(manifest, index, next), shards[next], shardBytes, 0)) {
+                present[next] = true;
+                ++found;
+            }
+            else {
+                lost.push_back(next);
+            }
+        }
+    }
+    // Shards after the last one read were never tried; calling them present keeps them out of
+    // the rebuild, and reconstruct only decodes from the first k present ones
+    for (int s = next; s < shardCount; ++s) present[s] = true;
+
+    if (found < manifest.dataShards || !code.reconstruct(shards, present, shardBytes)) {
+        DFS_LOG_ERROR << "Chunk " << index << " of " << manifest.filename << " is lost: only " << found
+                      << " of " << manifest.dataShards << " shards could be read";
+        readFailures.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    shardsRebuilt.fetch_add(lost.size(), std::memory_order_relaxed);
+    std::memcpy(buffer.data(), stripe.data() + from, length);
+
+    // Put back what was lost, so the next read of this chunk is not degraded
+    std::vector<std::string> repaired;
+    for (int s : lost) {
+        std::string path = getShardPath(manifest, index, s);
+        if (writeFile(path, shards[s], shardBytes)) repaired.push_back(path);
+    }
+    if (!repaired.empty() && StorageBackend::getInstance().locate(getManifestFilename(manifest.filename)).empty()) {
+        // Deleted while we read; the repaired shards would be orphans
+        for (const auto& path : repaired) removeQuietly(path);
+        repaired.clear();
+    }
+    shardsRepaired.fetch_add(repaired.size(), std::memory_order_relaxed);
+
+    chunksRead.fetch_add(1, std::memory_order_relaxed);
+    bytesRead.fetch_add(length, std::memory_order_relaxed);
+    return true;
+}
+
+bool ChunkStore::read(const ChunkManifest& manifest, Poco::UInt64 offset, Poco::UInt64 length, std::ostream& out) {
+    if (manifest.chunkSize == 0 || offset > manifest.size || length > manifest.size - offset) return false;
+    if (length == 0) return true;
+
+    struct PendingRead {
+        std::future<bool> done;
+        std::unique_ptr<std::vector<char>> buffer;
+    };
+    std::deque<PendingRead> window;
+    std::vector<std::unique_ptr<std::vector<char>>> spare;
+
+    Poco::UInt64 end = offset + length;
+    size_t next = static_cast<size_t>(offset / manifest.chunkSize);
+    size_t last = static_cast<size_t>((end - 1) / manifest.chunkSize);
+
+    bool ok = true;
+    while (ok && (next <= last || !window.empty())) {
+        // The chunk being written out plus up to readAhead more are read at any time
+        while (next <= last && window.size() <= readAhead) {
+            Poco::UInt64 chunkStart = static_cast<Poco::UInt64>(next) * manifest.chunkSize;
+            Poco::UInt64 from = std::max(offset, chunkStart);
+            Poco::UInt64 to = std::min(end, chunkStart + manifest.chunkSize);
+
+            PendingRead pending;
+            if (spare.empty()) {
+                pending.buffer.reset(new std::vector<char>());
+            }
+            else {
+                pending.buffer = std::move(spare.back());
+                spare.pop_back();
+            }
+
+            // Reads in flight are waited for before returning, so the manifest and buffer outlive them
+            std::vector<char>* buffer = pending.buffer.get();
+            const ChunkManifest* file = &manifest;
+            size_t index = next;
+            Poco::UInt64 chunkOffset = from - chunkStart;
+            size_t chunkLength = static_cast<size_t>(to - from);
+            pending.done = submit([this, file, index, chunkOffset, chunkLength, buffer]() {
+                return readChunk(*file, index, chunkOffset, chunkLength, *buffer);
+            });
+            window.push_back(std::move(pending));
+            ++next;
+        }
+
+        PendingRead& head = window.front();
+        if (head.done.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            readStalls.fetch_add(1, std::memory_order_relaxed);
+        }
+        ok = succeeded(head.done);
+        if (ok) {
+            out.write(head.buffer->data(), static_cast<std::streamsize>(head.buffer->size()));
+            ok = static_cast<bool>(out);
+        }
+        spare.push_back(std::move(head.buffer));
+        window.pop_front();
+    }
+
+    // Reads still in flight write into buffers owned here
+    for (auto& pending : window) pending.done.wait();
+    return ok;
+}
+
+void ChunkStore::render(std::ostream& out) const {
+    out << "# TYPE dfs_chunk_store_chunks_total counter\n";
+    out << "dfs_chunk_store_chunks_total{op=\"write\"} " << chunksWritten.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_chunk_store_chunks_total{op=\"read\"} " << chunksRead.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_chunk_store_bytes_total counter\n";
+    out << "dfs_chunk_store_bytes_total{op=\"write\"} " << bytesWritten.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_chunk_store_bytes_total{op=\"read\"} " << bytesRead.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_chunk_store_failures_total counter\n";
+    out << "dfs_chunk_store_failures_total{op=\"write\"} " << writeFailures.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_chunk_store_failures_total{op=\"read\"} " << readFailures.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_chunk_store_read_stalls_total counter\n";
+    out << "dfs_chunk_store_read_stalls_total " << readStalls.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_erasure_degraded_reads_total counter\n";
+    out << "dfs_erasure_degraded_reads_total " << degradedReads.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_erasure_shards_total counter\n";
+    out << "dfs_erasure_shards_total{result=\"rebuilt\"} " << shardsRebuilt.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_erasure_shards_total{result=\"repaired\"} " << shardsRepaired.load(std::memory_order_relaxed) << "\n";
+}
@@ -0,0 +1,123 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include "ErasureCode.h"
+#include <Poco/Timestamp.h>
+#include <Poco/Types.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ChunkManifest {
+    std::string filename;
+    Poco::UInt64 size = 0;
+    Poco::UInt64 chunkSize = 0;
+    Poco::Timestamp modifiedAt;
+    // Erasure-coded files only: the code and the directories shards rotate over
+    int dataShards = 0;
+    int parityShards = 0;
+    std::vector<std::string> shardDirectories;
+
+    size_t chunkCount() const {
+        return chunkSize == 0 ? 0 : static_cast<size_t>((size + chunkSize - 1) / chunkSize);
+    }
+    Poco::UInt64 chunkLength(size_t index) const {
+        Poco::UInt64 start = static_cast<Poco::UInt64>(index) * chunkSize;
+        return size - start < chunkSize ? size - start : chunkSize;
+    }
+    bool isErasureCoded() const { return dataShards > 0; }
+};
+
+// Optional layout for large files (DFS_CHUNKED_STORAGE). The body is split into
+// fixed-size chunks, each an ordinary stored file ("<blob>.c<index>"), and a
+// manifest ("<blob>.manifest") is stored last, so a file exists once its manifest
+// does. Chunks are copied and read on a worker pool: one large file keeps several
+// threads busy and, with the replicated backend, several disks. Reads touch only
+// the chunks their range covers and keep the next few in flight.
+//
+// With DFS_ERASURE_CODING each chunk is instead cut into k data shards plus m
+// parity shards ("<blob>.c<index>.s<shard>"), written straight to k + m or more
+// directories standing in for storage nodes; the manifest stays in the storage
+// backend. Any k shards of a chunk rebuild it, so reads carry on, rebuilding on
+// the fly, with up to m directories lost, and write back the shards they rebuilt.
+class ChunkStore {
+public:
+    static ChunkStore& getInstance();
+    static std::string getManifestFilename(const std::string& filename);
+    static std::string getChunkFilename(const std::string& filename, size_t index);
+    static std::string getShardPath(const ChunkManifest& manifest, size_t index, int shard);
+
+    void start();
+    void stop();
+
+    // Bodies larger than one chunk are chunked when the layout is enabled
+    bool shouldChunk(Poco::UInt64 size) const { return enabled && size > chunkSize; }
+
+    // Same contract as StorageBackend::store: the staged file belongs to the chunk
+    // store from then on. Throws Poco::Exception if the file could not be stored.
+    void store(const std::string& stagedPath, const std::string& filename);
+    // False when the file is not stored chunked
+    bool loadManifest(const std::string& filename, ChunkManifest& manifest);
+    // The manifest and chunk names of a chunked file, or nothing. Shards of erasure-coded
+    // files live outside the storage backend and are not included.
+    std::vector<std::string> getPartFilenames(const std::string& filename);
+    // Removes the manifest, then every chunk; does nothing for unchunked files
+    void remove(const std::string& filename);
+
+    // Writes bytes [offset, offset + length) of a chunked file to out
+    bool read(const ChunkManifest& manifest, Poco::UInt64 offset, Poco::UInt64 length, std::ostream& out);
+
+    void render(std::ostream& out) const;
+
+private:
+    ChunkStore();
+    ~ChunkStore();
+
+    // Runs the task on the pool, or right away when the pool is not running
+    std::future<bool> submit(std::function<bool()> task);
+    void run();
+
+    bool storeChunk(int stagedFd, const std::string& chunkPath, const std::string& chunkFilename,
+                    Poco::UInt64 offset, Poco::UInt64 length);
+    bool storeShards(int stagedFd, const ChunkManifest& manifest, size_t index);
+    bool readChunk(const ChunkManifest& manifest, size_t index, Poco::UInt64 from, size_t length,
+                   std::vector<char>& buffer);
+    bool readShards(const ChunkManifest& manifest, size_t index, Poco::UInt64 from, size_t length,
+                    std::vector<char>& buffer);
+    void removeChunks(const ChunkManifest& manifest, size_t count);
+
+    bool enabled;
+    Poco::UInt64 chunkSize;
+    size_t threadCount;
+    size_t readAhead;
+    std::unique_ptr<ErasureCode> erasureCode;
+    std::vector<std::string> shardDirectories;
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<std::packaged_task<bool()>> queue;
+    bool stopping;
+    std::vector<std::thread> workers;
+
+    std::atomic<uint64_t> chunksWritten{0};
+    std::atomic<uint64_t> chunksRead{0};
+    std::atomic<uint64_t> bytesWritten{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> writeFailures{0};
+    std::atomic<uint64_t> readFailures{0};
+    std::atomic<uint64_t> readStalls{0};
+    std::atomic<uint64_t> degradedReads{0};
+    std::atomic<uint64_t> shardsRebuilt{0};
+    std::atomic<uint64_t> shardsRepaired{0};
+};
+
+#endif
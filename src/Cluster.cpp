@@ -0,0 +1,686 @@
+#include "Cluster.h"
+#include "ChunkStore.h"
+#include "Config.h"
+#include "Database.h"
+#include "FileManager.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Utils.h"
+#include <Poco/Data/Statement.h>
+#include <Poco/Environment.h>
+#include <Poco/Exception.h>
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+#include <Poco/NullStream.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/String.h>
+#include <Poco/Timespan.h>
+#include <Poco/URI.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+
+using namespace Poco::Data::Keywords;
+using namespace Poco::Net;
+
+namespace {
+
+const size_t PUSH_BLOCK_SIZE = 1024 * 1024;
+
+// Request headers a proxied download passes on; the holder authenticates the
+// client itself and answers ranges and revalidation as it would directly
+const char* const FORWARDED_REQUEST_HEADERS[] = {
+    "Authorization", "Range", "If-Range", "If-None-Match", "Accept-Encoding"
+};
+
+const char* const FORWARDED_RESPONSE_HEADERS[] = {
+    "Content-Type", "Content-Range", "Content-Encoding", "Content-Disposition", "Accept-Ranges",
+    "ETag", "Last-Modified", "Cache-Control", "Vary", "Retry-After"
+};
+
+// splitmix64's finalizer: FNV-1a alone leaves similar names on nearby points
+uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+bool secretsEqual(const std::string& a, const std::string& b) {
+    if (a.size() != b.size()) return false;
+    unsigned char difference = 0;
+    for (size_t i = 0; i < a.size(); ++i) difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+    return difference == 0;
+}
+
+HTTPClientSession* openSession(const std::string& baseUrl, long timeoutSeconds) {
+    Poco::URI uri(baseUrl);
+    HTTPClientSession* session = new HTTPClientSession(uri.getHost(), uri.getPort());
+    session->setTimeout(Poco::Timespan(timeoutSeconds, 0));
+    return session;
+}
+
+std::string peerUri(const std::string& filename) {
+    Poco::URI uri("/cluster/files");
+    uri.addQueryParameter("name", filename);
+    return uri.getPathAndQuery();
+}
+
+// A stored file as the rebalancer reads it: one descriptor, or chunks
+struct StoredFile {
+    int fd = -1;
+    bool chunked = false;
+    ChunkManifest manifest;
+    Poco::UInt64 size = 0;
+
+    ~StoredFile() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool open(const std::string& filename) {
+        fd = ::open(FileManager::resolveStoredPath(filename).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd >= 0 && ::fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            size = static_cast<Poco::UInt64>(info.st_size);
+            return true;
+        }
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+
+        chunked = ChunkStore::getInstance().loadManifest(filename, manifest);
+        size = manifest.size;
+        return chunked;
+    }
+
+    // Whole chunks for chunked files, so none is read twice
+    Poco::UInt64 blockSize() const {
+        return chunked ? manifest.chunkSize : static_cast<Poco::UInt64>(PUSH_BLOCK_SIZE);
+    }
+
+    bool write(Poco::UInt64 offset, Poco::UInt64 length, std::vector<char>& buffer, std::ostream& out) {
+        if (chunked) return ChunkStore::getInstance().read(manifest, offset, length, out);
+
+        buffer.resize(static_cast<size_t>(length));
+        size_t done = 0;
+        while (done < buffer.size()) {
+            ssize_t bytesRead = ::pread(fd, buffer.data() + done, buffer.size() - done, static_cast<off_t>(offset + done));
+            if (bytesRead < 0 && errno == EINTR) continue;
+            if (bytesRead <= 0) return false;
+            done += static_cast<size_t>(bytesRead);
+        }
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        return static_cast<bool>(out);
+    }
+};
+
+}
+
+const char* const Cluster::FORWARDED_HEADER = "X-DFS-Forwarded-By";
+const char* const Cluster::SECRET_HEADER = "X-DFS-Cluster-Secret";
+
+ClusterRing::ClusterRing(const std::vector<ClusterNode>& nodes, size_t pointsPerNode) : nodes(nodes) {
+    std::sort(this->nodes.begin(), this->nodes.end(),
+              [](const ClusterNode& a, const ClusterNode& b) { return a.nodeId < b.nodeId; });
+
+    for (size_t n = 0; n < this->nodes.size(); ++n) {
+        for (size_t p = 0; p < pointsPerNode; ++p) {
+            points.emplace_back(hash(this->nodes[n].nodeId + "#" + std::to_string(p)), n);
+        }
+    }
+    std::sort(points.begin(), points.end());
+}
+
+const ClusterNode& ClusterRing::owner(const std::string& filename) const {
+    auto point = std::lower_bound(points.begin(), points.end(), std::make_pair(hash(filename), size_t(0)));
+    if (point == points.end()) point = points.begin();
+    return nodes[point->second];
+}
+
+const ClusterNode* ClusterRing::find(const std::string& nodeId) const {
+    for (const auto& node : nodes) {
+        if (node.nodeId == nodeId) return &node;
+    }
+    return nullptr;
+}
+
+uint64_t ClusterRing::hash(const std::string& text) {
+    uint64_t value = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+        value ^= c;
+        value *= 1099511628211ULL;
+    }
+    return mix(value);
+}
+
+Cluster& Cluster::getInstance() {
+    static Cluster instance;
+    return instance;
+}
+
+Cluster::Cluster() : stopping(true), rebalanceRequested(false), passBytes(0) {
+    enabled = Config::getBool("DFS_CLUSTER", false);
+    redirect = Poco::toLower(Config::getString("DFS_CLUSTER_FORWARD", "proxy")) == "redirect";
+    std::string port = std::to_string(Config::getInt("DFS_HTTP_PORT", 8080));
+    nodeId = Config::getString("DFS_NODE_ID", Poco::Environment::nodeName() + ":" + port);
+    baseUrl = Config::getString("DFS_NODE_URL", "http://localhost:" + port);
+    while (!baseUrl.empty() && baseUrl.back() == '/') baseUrl.pop_back();
+    secret = Config::getString("DFS_CLUSTER_SECRET", "");
+    pointsPerNode = static_cast<size_t>(std::max(1L, std::min(Config::getInt("DFS_CLUSTER_VNODES", 256), 4096L)));
+    heartbeatSeconds = std::max(1L, Config::getInt("DFS_CLUSTER_HEARTBEAT_SECONDS", 5));
+    nodeTimeoutSeconds = std::max(heartbeatSeconds * 2, Config::getInt("DFS_CLUSTER_NODE_TIMEOUT_SECONDS", 30));
+    requestTimeoutSeconds = std::max(1L, Config::getInt("DFS_CLUSTER_TIMEOUT_SECONDS", 30));
+    rebalanceIntervalSeconds = std::max(1L, Config::getInt("DFS_CLUSTER_REBALANCE_INTERVAL_SECONDS", 600));
+    rebalanceBatchSize = static_cast<int>(std::max(1L, Config::getInt("DFS_CLUSTER_REBALANCE_BATCH", 100)));
+    rebalanceBytesPerSecond = static_cast<double>(std::max(0L, Config::getInt("DFS_CLUSTER_REBALANCE_BYTES_PER_SECOND",
+                                                                              32L * 1024 * 1024)));
+    removalQueueLimit = static_cast<size_t>(std::max(1L, Config::getInt("DFS_CLUSTER_REMOVAL_QUEUE", 10000)));
+
+    // Peers may store and remove files, so an open cluster is never started
+    if (enabled && secret.empty()) {
+        DFS_LOG_ERROR << "Cluster mode needs DFS_CLUSTER_SECRET; running as a single node";
+        enabled = false;
+    }
+}
+
+Cluster::~Cluster() {
+    stop();
+}
+
+void Cluster::start() {
+    if (!enabled) return;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (heartbeater.joinable()) return;
+        stopping = false;
+    }
+
+    // Register before serving anyone, so the first ring already has this node
+    heartbeat();
+    heartbeater = std::thread([this]() { runHeartbeat(); });
+    remover = std::thread([this]() { runRemover(); });
+    rebalancer = std::thread([this]() { runRebalancer(); });
+    DFS_LOG_INFO << "Cluster: node " << nodeId << " at " << baseUrl;
+}
+
+void Cluster::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!heartbeater.joinable()) return;
+        stopping = true;
+    }
+    stateChanged.notify_all();
+    heartbeater.join();
+    remover.join();
+    rebalancer.join();
+}
+
+std::shared_ptr<const ClusterRing> Cluster::getRing() const {
+    std::lock_guard<std::mutex> lock(ringMutex);
+    return ring;
+}
+
+bool Cluster::isStopping() {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return stopping;
+}
+
+bool Cluster::isPeerRequest(const HTTPServerRequest& request) const {
+    return enabled && secretsEqual(request.get(SECRET_HEADER, ""), secret);
+}
+
+bool Cluster::findRemoteHolder(const std::string& filename, ClusterNode& holder) {
+    if (!enabled || FileManager::hasStoredCopy(filename)) return false;
+    std::shared_ptr<const ClusterRing> current = getRing();
+    if (!current || current->empty()) return false;
+
+    std::vector<std::string> holders;
+    try {
+        auto session = Database::getInstance().getSession();
+        std::string name = filename;
+        Poco::Data::Statement select(session);
+        select << "SELECT node_id FROM file_locations WHERE filename = $1",
+            use(name), into(holders), limit(1);
+        static Histogram& latency = Metrics::getInstance().dbStatement("find_file_location");
+        ScopedTimer timer(latency);
+        select.execute();
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Looking up the holder of " << filename << " failed: " << ex.displayText();
+        return false;
+    }
+
+    // Not yet recorded anywhere: the ring owner is the best guess
+    const ClusterNode* node = holders.empty() ? &current->owner(filename) : current->find(holders.front());
+    if (!node) {
+        DFS_LOG_WARN << "Node " << holders.front() << " holding " << filename << " is not live";
+        return false;
+    }
+    if (node->nodeId == nodeId) return false;
+
+    holder = *node;
+    return true;
+}
+
+bool Cluster::forward(HTTPServerRequest& request, HTTPServerResponse& response, const ClusterNode& holder) {
+    if (redirect) {
+        redirected.fetch_add(1, std::memory_order_relaxed);
+        response.redirect(holder.baseUrl + request.getURI(), HTTPResponse::HTTP_TEMPORARY_REDIRECT);
+        return true;
+    }
+
+    std::unique_ptr<HTTPClientSession> session;
+    HTTPResponse reply;
+    std::istream* body = nullptr;
+    try {
+        session.reset(openSession(holder.baseUrl, requestTimeoutSeconds));
+        HTTPRequest upstream(request.getMethod(), request.getURI(), HTTPMessage::HTTP_1_1);
+        for (const char* name : FORWARDED_REQUEST_HEADERS) {
+            if (request.has(name)) upstream.set(name, request.get(name));
+        }
+        upstream.set(FORWARDED_HEADER, nodeId);
+        session->sendRequest(upstream);
+        body = &session->receiveResponse(reply);
+    }
+    catch (const Poco::Exception& ex) {
+        forwardFailures.fetch_add(1, std::memory_order_relaxed);
+        DFS_LOG_ERROR << "Forwarding " << request.getURI() << " to " << holder.nodeId << " failed: " << ex.displayText();
+        return false;
+    }
+
+    response.setStatusAndReason(reply.getStatus(), reply.getReason());
+    for (const char* name : FORWARDED_RESPONSE_HEADERS) {
+        if (reply.has(name)) response.set(name, reply.get(name));
+    }
+    if (reply.hasContentLength()) response.setContentLength64(reply.getContentLength64());
+    else response.setChunkedTransferEncoding(true);
+
+    // Streamed through one buffer: the file never sits in this node's memory
+    proxied.fetch_add(1, std::memory_order_relaxed);
+    try {
+        std::ostream& out = response.send();
+        Poco::UInt64 copied = Poco::StreamCopier::copyStream64(*body, out, FileManager::getUploadBufferSize());
+        bytesProxied.fetch_add(copied, std::memory_order_relaxed);
+        Metrics::getInstance().addBytesOut(copied);
+    }
+    catch (const Poco::Exception& ex) {
+        // The status line is out; all that is left is to drop the connection
+        forwardFailures.fetch_add(1, std::memory_order_relaxed);
+        DFS_LOG_WARN << "Proxying " << request.getURI() << " from " << holder.nodeId << " stopped: " << ex.displayText();
+    }
+    return true;
+}
+
+void Cluster::recordLocations(Poco::Data::Session& session, const std::vector<std::string>& filenames) {
+    if (!enabled || filenames.empty()) return;
+
+    std::string filenameArray = Utils::toPostgresArray(filenames);
+    std::string node = nodeId;
+    Poco::Data::Statement upsert(session);
+    upsert << "INSERT INTO file_locations (filename, node_id) SELECT f, $2 FROM unnest($1::text[]) AS u(f) "
+              "ON CONFLICT (filename) DO UPDATE SET node_id = EXCLUDED.node_id",
+        use(filenameArray), use(node);
+    static Histogram& latency = Metrics::getInstance().dbStatement("record_file_locations");
+    ScopedTimer timer(latency);
+    upsert.execute();
+}
+
+void Cluster::scheduleRemoval(const std::string& filename) {
+    if (!enabled) return;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (stopping) return;
+        if (removals.size() >= removalQueueLimit) {
+            removalFailures.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        removals.push_back(filename);
+    }
+    stateChanged.notify_all();
+}
+
+void Cluster::runHeartbeat() {
+    auto nextHeartbeat = std::chrono::steady_clock::now() + std::chrono::seconds(heartbeatSeconds);
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (!stopping) {
+        stateChanged.wait_until(lock, nextHeartbeat, [this]() { return stopping; });
+        if (stopping) break;
+        if (std::chrono::steady_clock::now() < nextHeartbeat) continue;
+        lock.unlock();
+
+        heartbeat();
+        nextHeartbeat = std::chrono::steady_clock::now() + std::chrono::seconds(heartbeatSeconds);
+
+        lock.lock();
+    }
+}
+
+void Cluster::runRemover() {
+    // Apart from the heartbeat: a slow peer must never delay it past the node timeout
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (!stopping) {
+        stateChanged.wait(lock, [this]() { return stopping || !removals.empty(); });
+        if (stopping) break;
+
+        std::deque<std::string> batch;
+        batch.swap(removals);
+        lock.unlock();
+
+        for (const auto& filename : batch) {
+            if (isStopping()) break;
+            removeCopy(filename);
+        }
+
+        lock.lock();
+    }
+}
+
+void Cluster::heartbeat() {
+    std::vector<std::string> ids, urls;
+    try {
+        auto session = Database::getInstance().getSession();
+        std::string id = nodeId;
+        std::string url = baseUrl;
+        Poco::Data::Statement upsert(session);
+        upsert << "INSERT INTO cluster_nodes (node_id, base_url) VALUES ($1, $2) "
+                  "ON CONFLICT (node_id) DO UPDATE SET base_url = EXCLUDED.base_url, last_seen = CURRENT_TIMESTAMP",
+            use(id), use(url);
+        upsert.execute();
+
+        int timeout = static_cast<int>(nodeTimeoutSeconds);
+        Poco::Data::Statement select(session);
+        select << "SELECT node_id, base_url FROM cluster_nodes "
+                  "WHERE last_seen > CURRENT_TIMESTAMP - $1 * INTERVAL '1 second' ORDER BY node_id",
+            use(timeout), into(ids), into(urls);
+        select.execute();
+    }
+    catch (const Poco::Exception& ex) {
+        // The last ring stays in use until the database answers again
+        heartbeatFailures.fetch_add(1, std::memory_order_relaxed);
+        DFS_LOG_ERROR << "Cluster heartbeat failed: " << ex.displayText();
+        return;
+    }
+
+    std::vector<ClusterNode> nodes;
+    for (size_t i = 0; i < ids.size() && i < urls.size(); ++i) nodes.push_back(ClusterNode{ids[i], urls[i]});
+    std::shared_ptr<const ClusterRing> next = std::make_shared<ClusterRing>(nodes, pointsPerNode);
+
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        if (ring) {
+            const std::vector<ClusterNode>& previous = ring->getNodes();
+            changed = previous.size() != nodes.size() ||
+                      !std::equal(previous.begin(), previous.end(), next->getNodes().begin(),
+                                  [](const ClusterNode& a, const ClusterNode& b) { return a.nodeId == b.nodeId; });
+        }
+        ring = next;
+    }
+
+    if (changed) {
+        membershipChanges.fetch_add(1, std::memory_order_relaxed);
+        DFS_LOG_INFO << "Cluster membership changed: " << nodes.size() << " live nodes; rebalancing";
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            rebalanceRequested = true;
+        }
+        stateChanged.notify_all();
+    }
+}
+
+void Cluster::removeCopy(const std::string& filename) {
+    std::vector<std::string> holders;
+    try {
+        // A file uploaded again since the delete keeps its location
+        auto session = Database::getInstance().getSession();
+        std::string name = filename;
+        Poco::Data::Statement remove(session);
+        remove << "DELETE FROM file_locations WHERE filename = $1 "
+                  "AND NOT EXISTS (SELECT 1 FROM files WHERE filename = $1) RETURNING node_id",
+            use(name), into(holders);
+        remove.execute();
+    }
+    catch (const Poco::Exception& ex) {
+        removalFailures.fetch_add(1, std::memory_order_relaxed);
+        DFS_LOG_ERROR << "Dropping the location of " << filename << " failed: " << ex.displayText();
+        return;
+    }
+    // This node's copy went with the delete
+    if (holders.empty() || holders.front() == nodeId) return;
+
+    std::shared_ptr<const ClusterRing> current = getRing();
+    const ClusterNode* holder = current ? current->find(holders.front()) : nullptr;
+    if (holder && sendRemove(filename, *holder)) {
+        copiesRemoved.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    removalFailures.fetch_add(1, std::memory_order_relaxed);
+    DFS_LOG_WARN << "Copy of " << filename << " left behind on node " << holders.front();
+}
+
+void Cluster::runRebalancer() {
+    // The first pass soon after startup records files stored before cluster mode
+    auto nextPass = std::chrono::steady_clock::now() + std::chrono::seconds(heartbeatSeconds);
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (!stopping) {
+        stateChanged.wait_until(lock, nextPass, [this]() { return stopping || rebalanceRequested; });
+        if (stopping) break;
+        rebalanceRequested = false;
+        lock.unlock();
+
+        passStarted = std::chrono::steady_clock::now();
+        passBytes = 0;
+        std::string after;
+        while (!isStopping() && seedBatch(after)) {}
+        after.clear();
+        while (!isStopping() && rebalanceBatch(after)) {}
+        passesCompleted.fetch_add(1, std::memory_order_relaxed);
+        nextPass = std::chrono::steady_clock::now() + std::chrono::seconds(rebalanceIntervalSeconds);
+
+        lock.lock();
+    }
+}
+
+bool Cluster::seedBatch(std::string& after) {
+    std::vector<std::string> filenames;
+    try {
+        auto session = Database::getInstance().getSession();
+        std::string from = after;
+        int batchSize = rebalanceBatchSize;
+        Poco::Data::Statement select(session);
+        select << "SELECT DISTINCT f.filename FROM files f LEFT JOIN file_locations l ON l.filename = f.filename "
+                  "WHERE l.filename IS NULL AND f.filename > $1 ORDER BY f.filename LIMIT $2",
+            use(from), use(batchSize), into(filenames);
+        select.execute();
+
+        std::vector<std::string> held;
+        for (const auto& filename : filenames) {
+            if (FileManager::hasStoredCopy(filename)) held.push_back(filename);
+        }
+        if (!held.empty()) {
+            std::string heldArray = Utils::toPostgresArray(held);
+            std::string node = nodeId;
+            Poco::Data::Statement insert(session);
+            insert << "INSERT INTO file_locations (filename, node_id) SELECT f, $2 FROM unnest($1::text[]) AS u(f) "
+                      "ON CONFLICT (filename) DO NOTHING",
+                use(heldArray), use(node);
+            insert.execute();
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Recording file locations failed: " << ex.displayText();
+        return false;
+    }
+
+    if (filenames.empty()) return false;
+    after = filenames.back();
+    return filenames.size() == static_cast<size_t>(rebalanceBatchSize);
+}
+
+bool Cluster::rebalanceBatch(std::string& after) {
+    std::vector<std::string> filenames;
+    try {
+        auto session = Database::getInstance().getSession();
+        std::string node = nodeId;
+        std::string from = after;
+        int batchSize = rebalanceBatchSize;
+        Poco::Data::Statement select(session);
+        select << "SELECT filename FROM file_locations WHERE node_id = $1 AND filename > $2 "
+                  "ORDER BY filename LIMIT $3",
+            use(node), use(from), use(batchSize), into(filenames);
+        select.execute();
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Rebalance scan failed: " << ex.displayText();
+        return false;
+    }
+
+    for (const auto& filename : filenames) {
+        if (isStopping()) return false;
+
+        // Membership may change mid-pass; each file goes by the current ring
+        std::shared_ptr<const ClusterRing> current = getRing();
+        if (!current || current->empty()) return false;
+        const ClusterNode& owner = current->owner(filename);
+        if (owner.nodeId != nodeId) moveFile(filename, owner);
+    }
+    if (filenames.empty()) return false;
+
+    after = filenames.back();
+    return filenames.size() == static_cast<size_t>(rebalanceBatchSize);
+}
+
+void Cluster::moveFile(const std::string& filename, const ClusterNode& owner) {
+    if (!FileManager::hasStoredCopy(filename) || !pushFile(filename, owner)) {
+        moveFailures.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    std::vector<std::string> moved;
+    try {
+        auto session = Database::getInstance().getSession();
+        std::string name = filename;
+        std::string from = nodeId;
+        std::string to = owner.nodeId;
+        Poco::Data::Statement update(session);
+        update << "UPDATE file_locations SET node_id = $1 WHERE filename = $2 AND node_id = $3 RETURNING filename",
+            use(to), use(name), use(from), into(moved);
+        update.execute();
+    }
+    catch (const Poco::Exception& ex) {
+        // The owner's copy is unreferenced until a later pass moves the file again
+        moveFailures.fetch_add(1, std::memory_order_relaxed);
+        DFS_LOG_ERROR << "Recording the move of " << filename << " failed: " << ex.displayText();
+        return;
+    }
+
+    if (moved.empty()) {
+        // Deleted while it was being copied: the owner's copy is the only one left
+        if (!FileManager::isReferenced(filename)) sendRemove(filename, owner);
+        return;
+    }
+
+    // Downloads already sending the file hold it open and finish undisturbed
+    FileManager::removeFromDisk(filename);
+    filesMoved.fetch_add(1, std::memory_order_relaxed);
+    DFS_LOG_INFO << "Moved " << filename << " to node " << owner.nodeId;
+}
+
+bool Cluster::pushFile(const std::string& filename, const ClusterNode& target) {
+    StoredFile file;
+    if (!file.open(filename)) return false;
+
+    try {
+        std::unique_ptr<HTTPClientSession> session(openSession(target.baseUrl, requestTimeoutSeconds));
+        HTTPRequest request(HTTPRequest::HTTP_PUT, peerUri(filename), HTTPMessage::HTTP_1_1);
+        request.set(SECRET_HEADER, secret);
+        request.setContentType("application/octet-stream");
+        request.setContentLength64(static_cast<Poco::Int64>(file.size));
+
+        std::ostream& out = session->sendRequest(request);
+        std::vector<char> buffer;
+        for (Poco::UInt64 offset = 0; offset < file.size;) {
+            Poco::UInt64 length = std::min(file.blockSize(), file.size - offset);
+            // Dropping the session cuts the body short, and the target discards it
+            if (!file.write(offset, length, buffer, out) || !throttle(length)) return false;
+            offset += length;
+            bytesMoved.fetch_add(length, std::memory_order_relaxed);
+        }
+        out.flush();
+
+        HTTPResponse response;
+        std::istream& in = session->receiveResponse(response);
+        Poco::NullOutputStream discard;
+        Poco::StreamCopier::copyStream(in, discard);
+        if (response.getStatus() == HTTPResponse::HTTP_CREATED) return true;
+
+        DFS_LOG_ERROR << "Node " << target.nodeId << " refused " << filename << ": HTTP " << static_cast<int>(response.getStatus());
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Copying " << filename << " to node " << target.nodeId << " failed: " << ex.displayText();
+    }
+    return false;
+}
+
+bool Cluster::sendRemove(const std::string& filename, const ClusterNode& target) {
+    try {
+        std::unique_ptr<HTTPClientSession> session(openSession(target.baseUrl, requestTimeoutSeconds));
+        HTTPRequest request(HTTPRequest::HTTP_DELETE, peerUri(filename), HTTPMessage::HTTP_1_1);
+        request.set(SECRET_HEADER, secret);
+        session->sendRequest(request);
+
+        HTTPResponse response;
+        std::istream& in = session->receiveResponse(response);
+        Poco::NullOutputStream discard;
+        Poco::StreamCopier::copyStream(in, discard);
+        return response.getStatus() == HTTPResponse::HTTP_OK;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Removing " << filename << " from node " << target.nodeId << " failed: " << ex.displayText();
+        return false;
+    }
+}
+
+bool Cluster::throttle(Poco::UInt64 bytes) {
+    passBytes += static_cast<double>(bytes);
+    if (rebalanceBytesPerSecond <= 0) return !isStopping();
+
+    auto due = passStarted + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                 std::chrono::duration<double>(passBytes / rebalanceBytesPerSecond));
+    std::unique_lock<std::mutex> lock(stateMutex);
+    stateChanged.wait_until(lock, due, [this]() { return stopping; });
+    return !stopping;
+}
+
+void Cluster::render(std::ostream& out) const {
+    if (!enabled) return;
+
+    std::shared_ptr<const ClusterRing> current = getRing();
+    out << "# TYPE dfs_cluster_nodes gauge\n";
+    out << "dfs_cluster_nodes " << (current ? current->getNodes().size() : 0) << "\n";
+    out << "# TYPE dfs_cluster_membership_changes_total counter\n";
+    out << "dfs_cluster_membership_changes_total " << membershipChanges.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_cluster_heartbeat_failures_total counter\n";
+    out << "dfs_cluster_heartbeat_failures_total " << heartbeatFailures.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_cluster_forwarded_downloads_total counter\n";
+    out << "dfs_cluster_forwarded_downloads_total{result=\"proxied\"} " << proxied.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_cluster_forwarded_downloads_total{result=\"redirected\"} " << redirected.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_cluster_forwarded_downloads_total{result=\"failed\"} " << forwardFailures.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_cluster_proxied_bytes_total counter\n";
+    out << "dfs_cluster_proxied_bytes_total " << bytesProxied.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_cluster_rebalance_files_total counter\n";
+    out << "dfs_cluster_rebalance_files_total{result=\"moved\"} " << filesMoved.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_cluster_rebalance_files_total{result=\"failed\"} " << moveFailures.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_cluster_rebalance_bytes_total counter\n";
+    out << "dfs_cluster_rebalance_bytes_total " << bytesMoved.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_cluster_rebalance_passes_total counter\n";
+    out << "dfs_cluster_rebalance_passes_total " << passesCompleted.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_cluster_remote_removals_total counter\n";
+    out << "dfs_cluster_remote_removals_total{result=\"ok\"} " << copiesRemoved.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_cluster_remote_removals_total{result=\"failed\"} " << removalFailures.load(std::memory_order_relaxed) << "\n";
+}
@@ -0,0 +1,151 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <Poco/Data/Session.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Types.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct ClusterNode {
+    std::string nodeId;
+    std::string baseUrl;  // "http://host:port", no trailing slash
+};
+
+// Consistent-hash ring over the live nodes. Each node owns a number of points
+// on the ring and a file belongs to the first point at or after its own hash,
+// so a node joining or leaving moves only about 1/N of the files, spread over
+// all the others.
+class ClusterRing {
+public:
+    ClusterRing(const std::vector<ClusterNode>& nodes, size_t pointsPerNode);
+
+    bool empty() const { return points.empty(); }
+    const std::vector<ClusterNode>& getNodes() const { return nodes; }
+    // The ring must not be empty
+    const ClusterNode& owner(const std::string& filename) const;
+    const ClusterNode* find(const std::string& nodeId) const;
+
+    static uint64_t hash(const std::string& text);
+
+private:
+    std::vector<ClusterNode> nodes;                    // By node id
+    std::vector<std::pair<uint64_t, size_t>> points;  // By hash
+};
+
+// Optional multi-node mode (DFS_CLUSTER). Nodes share the database: each one
+// refreshes its row in cluster_nodes on a heartbeat and builds the ring from the
+// rows seen recently. Uploads are stored on the node that received them and
+// recorded in file_locations; a background rebalancer then pushes each file to
+// its ring owner, throttled, and a node asked for a file it does not hold
+// streams it from the holder or redirects there. Nodes talk to each other over
+// the same HTTP port, authenticated by a shared secret.
+class Cluster {
+public:
+    // Set on requests one node makes to another on a client's behalf; such a
+    // request is always answered locally, so forwarding never loops
+    static const char* const FORWARDED_HEADER;
+    static const char* const SECRET_HEADER;
+
+    static Cluster& getInstance();
+
+    bool isEnabled() const { return enabled; }
+    const std::string& getNodeId() const { return nodeId; }
+
+    void start();
+    void stop();
+
+    // The live node that should serve filename instead of this one; false when
+    // this node serves it, because it holds the file or nobody else does
+    bool findRemoteHolder(const std::string& filename, ClusterNode& holder);
+    // Answers the request from holder, proxied or redirected. False, with nothing
+    // sent, when the holder could not be reached.
+    bool forward(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response,
+                 const ClusterNode& holder);
+    // True when the request carries the cluster secret
+    bool isPeerRequest(const Poco::Net::HTTPServerRequest& request) const;
+
+    // Inside the transaction that stores the files: this node holds them now
+    void recordLocations(Poco::Data::Session& session, const std::vector<std::string>& filenames);
+    // After a delete commits: drops the location of a file no row references any
+    // more and has the node holding it remove its copy, in the background
+    void scheduleRemoval(const std::string& filename);
+
+    void render(std::ostream& out) const;
+
+private:
+    Cluster();
+    ~Cluster();
+
+    std::shared_ptr<const ClusterRing> getRing() const;
+    bool isStopping();
+
+    void runHeartbeat();
+    void heartbeat();
+    void runRemover();
+    void removeCopy(const std::string& filename);
+
+    void runRebalancer();
+    bool seedBatch(std::string& after);
+    bool rebalanceBatch(std::string& after);
+    void moveFile(const std::string& filename, const ClusterNode& owner);
+    bool pushFile(const std::string& filename, const ClusterNode& target);
+    bool sendRemove(const std::string& filename, const ClusterNode& target);
+    // Sleeps until the bytes pushed in this pass fit the configured rate
+    bool throttle(Poco::UInt64 bytes);
+
+    bool enabled;
+    bool redirect;
+    std::string nodeId;
+    std::string baseUrl;
+    std::string secret;
+    size_t pointsPerNode;
+    long heartbeatSeconds;
+    long nodeTimeoutSeconds;
+    long requestTimeoutSeconds;
+    long rebalanceIntervalSeconds;
+    int rebalanceBatchSize;
+    double rebalanceBytesPerSecond;
+    size_t removalQueueLimit;
+
+    mutable std::mutex ringMutex;
+    std::shared_ptr<const ClusterRing> ring;
+
+    std::mutex stateMutex;
+    std::condition_variable stateChanged;
+    bool stopping;
+    bool rebalanceRequested;
+    std::deque<std::string> removals;
+    std::thread heartbeater;
+    std::thread remover;
+    std::thread rebalancer;
+
+    std::chrono::steady_clock::time_point passStarted;
+    double passBytes;
+
+    std::atomic<uint64_t> heartbeatFailures{0};
+    std::atomic<uint64_t> membershipChanges{0};
+    std::atomic<uint64_t> proxied{0};
+    std::atomic<uint64_t> redirected{0};
+    std::atomic<uint64_t> forwardFailures{0};
+    std::atomic<uint64_t> bytesProxied{0};
+    std::atomic<uint64_t> filesMoved{0};
+    std::atomic<uint64_t> moveFailures{0};
+    std::atomic<uint64_t> bytesMoved{0};
+    std::atomic<uint64_t> passesCompleted{0};
+    std::atomic<uint64_t> copiesRemoved{0};
+    std::atomic<uint64_t> removalFailures{0};
+};
+
+#endif
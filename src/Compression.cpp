@@ -0,0 +1,367 @@
+#include "Compression.h"
+#include "Config.h"
+#include "Logger.h"
+#include <Poco/CountingStream.h>
+#include <Poco/DeflatingStream.h>
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/String.h>
+#include <Poco/StringTokenizer.h>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#ifdef DFS_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+const size_t BUFFER_SIZE = 64 * 1024;
+
+uint64_t threadCpuNanos() {
+    struct timespec now;
+    if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) return 0;
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + static_cast<uint64_t>(now.tv_nsec);
+}
+
+bool endsWith(const std::string& value, const std::string& suffix) {
+    return value.size() >= suffix.size() &&
+           value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Preference when the client weights several encodings equally
+#ifdef DFS_HAVE_ZSTD
+const Compression::Encoding SUPPORTED[] = { Compression::ENCODING_ZSTD, Compression::ENCODING_GZIP };
+#else
+const Compression::Encoding SUPPORTED[] = { Compression::ENCODING_GZIP };
+#endif
+
+}
+
+Compression& Compression::getInstance() {
+    static Compression instance;
+    return instance;
+}
+
+const char* Compression::encodingName(Encoding encoding) {
+    return encoding == ENCODING_ZSTD ? "zstd" : "gzip";
+}
+
+std::string Compression::getSidecarPath(const std::string& path, Encoding encoding) {
+    return path + (encoding == ENCODING_ZSTD ? ".zst" : ".gz");
+}
+
+void Compression::removeSidecars(const std::string& path) {
+    for (int e = 0; e < ENCODING_COUNT; ++e) {
+        try {
+            Poco::File sidecar(getSidecarPath(path, static_cast<Encoding>(e)));
+            if (sidecar.exists()) sidecar.remove();
+        }
+        catch (const Poco::Exception& ex) {
+            DFS_LOG_ERROR << "Removing sidecar of " << path << " failed: " << ex.displayText();
+        }
+    }
+}
+
+Compression::Compression() : stopping(false) {
+    enabled = Config::getBool("DFS_COMPRESSION", true);
+    sidecarsEnabled = enabled && Config::getBool("DFS_COMPRESSION_SIDECARS", true);
+    minimumSize = static_cast<Poco::UInt64>(std::max(0L, Config::getInt("DFS_COMPRESSION_MIN_BYTES", 1024)));
+    streamLimit = static_cast<Poco::UInt64>(std::max(0L, Config::getInt("DFS_COMPRESSION_STREAM_MAX_BYTES", 16 * 1024 * 1024)));
+    gzipLevel = static_cast<int>(std::max(1L, std::min(Config::getInt("DFS_COMPRESSION_GZIP_LEVEL", 6), 9L)));
+    zstdLevel = static_cast<int>(std::max(1L, std::min(Config::getInt("DFS_COMPRESSION_ZSTD_LEVEL", 3), 19L)));
+    sidecarMaxRatio = std::max(1L, std::min(Config::getInt("DFS_COMPRESSION_SIDECAR_MAX_PERCENT", 90), 100L)) / 100.0;
+    queueLimit = static_cast<size_t>(std::max(1L, Config::getInt("DFS_COMPRESSION_SIDECAR_QUEUE", 1024)));
+
+    for (auto& perEncoding : responses) {
+        for (auto& count : perEncoding) count.store(0);
+    }
+}
+
+Compression::~Compression() {
+    stop();
+}
+
+void Compression::start() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (!sidecarsEnabled || worker.joinable()) return;
+
+    stopping = false;
+    worker = std::thread([this]() { run(); });
+}
+
+void Compression::stop() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!worker.joinable()) return;
+        stopping = true;
+    }
+    queueReady.notify_one();
+    worker.join();
+
+    // Whatever was still queued is simply never precompressed; downloads stream instead
+    std::lock_guard<std::mutex> lock(queueMutex);
+    queue.clear();
+}
+
+bool Compression::isCompressible(const std::string& contentType, Poco::UInt64 size) const {
+    if (!enabled || size < minimumSize) return false;
+
+    std::string type = Poco::toLower(Poco::trim(contentType.substr(0, contentType.find(';'))));
+    if (type.compare(0, 5, "text/") == 0) return true;
+    if (endsWith(type, "+json") || endsWith(type, "+xml")) return true;
+
+    static const char* const types[] = {
+        "application/json", "application/xml", "application/javascript", "application/x-javascript",
+        "application/ecmascript", "application/x-ndjson", "application/csv", "application/yaml",
+        "application/x-yaml", "application/sql", "application/x-sh", "application/wasm"
+    };
+    for (const char* candidate : types) {
+        if (type == candidate) return true;
+    }
+    return false;
+}
+
+std::vector<Compression::Encoding> Compression::negotiate(const std::string& acceptEncoding) const {
+    std::vector<Encoding> accepted;
+    if (!enabled || acceptEncoding.empty()) return accepted;
+
+    // -1 means "not mentioned"; an explicit q=0 rules an encoding out
+    double quality[ENCODING_COUNT] = { -1, -1 };
+    double wildcard = -1;
+
+    Poco::StringTokenizer codings(acceptEncoding, ",", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+    for (const auto& coding : codings) {
+        std::string name = Poco::toLower(Poco::trim(coding.substr(0, coding.find(';'))));
+        double q = 1.0;
+        std::string::size_type qAt = coding.find("q=");
+        if (qAt != std::string::npos) q = std::atof(coding.c_str() + qAt + 2);
+
+        if (name == "gzip" || name == "x-gzip") quality[ENCODING_GZIP] = q;
+        else if (name == "zstd") quality[ENCODING_ZSTD] = q;
+        else if (name == "*") wildcard = q;
+    }
+
+    for (Encoding encoding : SUPPORTED) {
+        double q = quality[encoding] >= 0 ? quality[encoding] : wildcard;
+        if (q > 0) accepted.push_back(encoding);
+    }
+    std::stable_sort(accepted.begin(), accepted.end(), [&](Encoding a, Encoding b) {
+        double qa = quality[a] >= 0 ? quality[a] : wildcard;
+        double qb = quality[b] >= 0 ? quality[b] : wildcard;
+        return qa > qb;
+    });
+    return accepted;
+}
+
+bool Compression::compress(std::istream& in, std::ostream& out, Encoding encoding, Mode mode) {
+    uint64_t inputBytes = 0;
+    uint64_t outputBytes = 0;
+    uint64_t cpuStart = threadCpuNanos();
+
+    bool ok = encoding == ENCODING_ZSTD ? zstd(in, out, inputBytes, outputBytes)
+                                        : gzip(in, out, inputBytes, outputBytes);
+
+    Counters& counter = counters[encoding][mode];
+    counter.inputBytes.fetch_add(inputBytes, std::memory_order_relaxed);
+    counter.outputBytes.fetch_add(outputBytes, std::memory_order_relaxed);
+    counter.cpuNanos.fetch_add(threadCpuNanos() - cpuStart, std::memory_order_relaxed);
+    counter.operations.fetch_add(1, std::memory_order_relaxed);
+    return ok;
+}
+
+bool Compression::gzip(std::istream& in, std::ostream& out, uint64_t& inputBytes, uint64_t& outputBytes) {
+    try {
+        Poco::CountingOutputStream counted(out);
+        Poco::DeflatingOutputStream deflater(counted, Poco::DeflatingStreamBuf::STREAM_GZIP, gzipLevel);
+
+        std::vector<char> buffer(BUFFER_SIZE);
+        while (in && deflater) {
+            in.read(buffer.data(), buffer.size());
+            std::streamsize count = in.gcount();
+            if (count <= 0) break;
+            deflater.write(buffer.data(), count);
+            inputBytes += static_cast<uint64_t>(count);
+        }
+        deflater.close();
+        counted.flush();
+        outputBytes = static_cast<uint64_t>(counted.chars());
+        return !in.bad() && deflater && out;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_WARN << "gzip compression failed: " << ex.displayText();
+        return false;
+    }
+}
+
+bool Compression::zstd(std::istream& in, std::ostream& out, uint64_t& inputBytes, uint64_t& outputBytes) {
+#ifdef DFS_HAVE_ZSTD
+    ZSTD_CCtx* context = ZSTD_createCCtx();
+    if (!context) return false;
+    ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, zstdLevel);
+
+    std::vector<char> input(BUFFER_SIZE);
+    std::vector<char> output(ZSTD_CStreamOutSize());
+    bool ok = true;
+
+    while (ok) {
+        in.read(input.data(), input.size());
+        size_t count = static_cast<size_t>(in.gcount());
+        bool last = count < input.size();
+        inputBytes += count;
+
+        ZSTD_inBuffer source = { input.data(), count, 0 };
+        bool finished = false;
+        while (ok && !finished) {
+            ZSTD_outBuffer target = { output.data(), output.size(), 0 };
+            size_t remaining = ZSTD_compressStream2(context, &target, &source, last ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                DFS_LOG_WARN << "zstd compression failed: " << ZSTD_getErrorName(remaining);
+                ok = false;
+                break;
+            }
+            out.write(output.data(), static_cast<std::streamsize>(target.pos));
+            outputBytes += target.pos;
+            ok = static_cast<bool>(out);
+            finished = last ? remaining == 0 : source.pos == source.size;
+        }
+        if (last) break;
+    }
+
+    ZSTD_freeCCtx(context);
+    return ok && !in.bad();
+#else
+    (void)in; (void)out; (void)inputBytes; (void)outputBytes;
+    return false;
+#endif
+}
+
+void Compression::scheduleSidecars(const std::string& path, const std::string& contentType, Poco::UInt64 size) {
+    if (!isCompressible(contentType, size)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (!worker.joinable()) return;
+        if (queue.size() >= queueLimit) {
+            sidecarsDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        queue.push_back(SidecarJob{path});
+    }
+    queueReady.notify_one();
+}
+
+void Compression::run() {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+        queueReady.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (stopping) return;
+
+        SidecarJob job = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        writeSidecars(job.path);
+        lock.lock();
+    }
+}
+
+void Compression::writeSidecars(const std::string& path) {
+    try {
+        for (Encoding encoding : SUPPORTED) {
+            std::string target = getSidecarPath(path, encoding);
+            if (Poco::File(target).exists()) continue;  // Re-upload of known content
+
+            std::ifstream in(path, std::ios::binary);
+            if (!in) return;  // Deleted before we got to it
+
+            // Written aside and renamed so a download never sees half a sidecar
+            std::string temp = target + ".part";
+            bool ok;
+            {
+                std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+                ok = out && compress(in, out, encoding, MODE_SIDECAR);
+                out.close();
+                ok = ok && out;
+            }
+
+            Poco::File tempFile(temp);
+            if (!ok || tempFile.getSize() > Poco::File(path).getSize() * sidecarMaxRatio) {
+                // Not worth serving; if gzip barely helps, zstd won't either
+                if (tempFile.exists()) tempFile.remove();
+                sidecarsSkipped.fetch_add(1, std::memory_order_relaxed);
+                if (ok) return;
+                continue;
+            }
+
+            tempFile.renameTo(target);
+            sidecarsWritten.fetch_add(1, std::memory_order_relaxed);
+
+            // A delete that ran meanwhile removed the blob before this sidecar existed
+            if (!Poco::File(path).exists()) {
+                removeSidecars(path);
+                return;
+            }
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_WARN << "Precompressing " << path << " failed: " << ex.displayText();
+    }
+}
+
+void Compression::recordResponse(Encoding encoding, bool fromSidecar) {
+    responses[encoding][fromSidecar ? 1 : 0].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Compression::render(std::ostream& out) const {
+    static const char* const modeNames[] = { "stream", "sidecar" };
+
+    out << "# TYPE dfs_compression_input_bytes_total counter\n";
+    for (Encoding encoding : SUPPORTED) {
+        for (int m = 0; m < MODE_COUNT; ++m) {
+            out << "dfs_compression_input_bytes_total{encoding=\"" << encodingName(encoding) << "\",mode=\""
+                << modeNames[m] << "\"} " << counters[encoding][m].inputBytes.load(std::memory_order_relaxed) << "\n";
+        }
+    }
+    out << "# TYPE dfs_compression_output_bytes_total counter\n";
+    for (Encoding encoding : SUPPORTED) {
+        for (int m = 0; m < MODE_COUNT; ++m) {
+            out << "dfs_compression_output_bytes_total{encoding=\"" << encodingName(encoding) << "\",mode=\""
+                << modeNames[m] << "\"} " << counters[encoding][m].outputBytes.load(std::memory_order_relaxed) << "\n";
+        }
+    }
+    out << "# TYPE dfs_compression_ratio gauge\n";
+    for (Encoding encoding : SUPPORTED) {
+        for (int m = 0; m < MODE_COUNT; ++m) {
+            uint64_t input = counters[encoding][m].inputBytes.load(std::memory_order_relaxed);
+            uint64_t output = counters[encoding][m].outputBytes.load(std::memory_order_relaxed);
+            out << "dfs_compression_ratio{encoding=\"" << encodingName(encoding) << "\",mode=\"" << modeNames[m]
+                << "\"} " << (output > 0 ? static_cast<double>(input) / output : 0.0) << "\n";
+        }
+    }
+    out << "# TYPE dfs_compression_cpu_seconds_total counter\n";
+    for (Encoding encoding : SUPPORTED) {
+        for (int m = 0; m < MODE_COUNT; ++m) {
+            out << "dfs_compression_cpu_seconds_total{encoding=\"" << encodingName(encoding) << "\",mode=\""
+                << modeNames[m] << "\"} " << counters[encoding][m].cpuNanos.load(std::memory_order_relaxed) / 1e9 << "\n";
+        }
+    }
+    out << "# TYPE dfs_compression_operations_total counter\n";
+    for (Encoding encoding : SUPPORTED) {
+        for (int m = 0; m < MODE_COUNT; ++m) {
+            out << "dfs_compression_operations_total{encoding=\"" << encodingName(encoding) << "\",mode=\""
+                << modeNames[m] << "\"} " << counters[encoding][m].operations.load(std::memory_order_relaxed) << "\n";
+        }
+    }
+    out << "# TYPE dfs_compressed_responses_total counter\n";
+    for (Encoding encoding : SUPPORTED) {
+        out << "dfs_compressed_responses_total{encoding=\"" << encodingName(encoding) << "\",source=\"stream\"} "
+            << responses[encoding][0].load(std::memory_order_relaxed) << "\n";
+        out << "dfs_compressed_responses_total{encoding=\"" << encodingName(encoding) << "\",source=\"sidecar\"} "
+            << responses[encoding][1].load(std::memory_order_relaxed) << "\n";
+    }
+    out << "# TYPE dfs_compression_sidecars_total counter\n";
+    out << "dfs_compression_sidecars_total{result=\"written\"} " << sidecarsWritten.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_compression_sidecars_total{result=\"skipped\"} " << sidecarsSkipped.load(std::memory_order_relaxed) << "\n";
+    out << "dfs_compression_sidecars_total{result=\"dropped\"} " << sidecarsDropped.load(std::memory_order_relaxed) << "\n";
+}
@@ -0,0 +1,92 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <Poco/Types.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Content-Encoding for downloads. Compressible bodies are sent from a
+// precompressed sidecar ("<blob>.gz", "<blob>.zst") when one exists, which keeps
+// them on the sendfile/reactor path; otherwise they are compressed while
+// streaming. Sidecars are written by a background thread after upload, so the
+// upload itself never pays for compression.
+class Compression {
+public:
+    enum Encoding { ENCODING_GZIP, ENCODING_ZSTD, ENCODING_COUNT };
+    enum Mode { MODE_STREAM, MODE_SIDECAR, MODE_COUNT };
+
+    static Compression& getInstance();
+    static const char* encodingName(Encoding encoding);
+    static std::string getSidecarPath(const std::string& path, Encoding encoding);
+    // Called whenever a stored file is unlinked
+    static void removeSidecars(const std::string& path);
+
+    void start();
+    void stop();
+
+    bool isEnabled() const { return enabled; }
+    bool isCompressible(const std::string& contentType, Poco::UInt64 size) const;
+    // Encodings the client accepts, most preferred first; empty means identity
+    std::vector<Encoding> negotiate(const std::string& acceptEncoding) const;
+    // Larger files without a sidecar are sent uncompressed rather than tie up a worker
+    Poco::UInt64 getStreamLimit() const { return streamLimit; }
+
+    bool compress(std::istream& in, std::ostream& out, Encoding encoding, Mode mode);
+    // Queues sidecar creation for a newly stored blob; dropped when the queue is full
+    void scheduleSidecars(const std::string& path, const std::string& contentType, Poco::UInt64 size);
+
+    void recordResponse(Encoding encoding, bool fromSidecar);
+    void render(std::ostream& out) const;
+
+private:
+    struct Counters {
+        std::atomic<uint64_t> inputBytes{0};
+        std::atomic<uint64_t> outputBytes{0};
+        std::atomic<uint64_t> cpuNanos{0};
+        std::atomic<uint64_t> operations{0};
+    };
+
+    struct SidecarJob {
+        std::string path;
+    };
+
+    Compression();
+    ~Compression();
+
+    bool gzip(std::istream& in, std::ostream& out, uint64_t& inputBytes, uint64_t& outputBytes);
+    bool zstd(std::istream& in, std::ostream& out, uint64_t& inputBytes, uint64_t& outputBytes);
+    void run();
+    void writeSidecars(const std::string& path);
+
+    bool enabled;
+    bool sidecarsEnabled;
+    Poco::UInt64 minimumSize;
+    Poco::UInt64 streamLimit;
+    int gzipLevel;
+    int zstdLevel;
+    double sidecarMaxRatio;
+    size_t queueLimit;
+
+    std::array<std::array<Counters, MODE_COUNT>, ENCODING_COUNT> counters;
+    std::array<std::array<std::atomic<uint64_t>, 2>, ENCODING_COUNT> responses;  // [stream, sidecar]
+    std::atomic<uint64_t> sidecarsWritten{0};
+    std::atomic<uint64_t> sidecarsSkipped{0};
+    std::atomic<uint64_t> sidecarsDropped{0};
+
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::deque<SidecarJob> queue;
+    bool stopping;
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#include "Config.h"
+#include <Poco/Environment.h>
+#include <Poco/String.h>
+#include <iostream>
+
+std::string Config::getString(const std::string& name, const std::string& defaultValue) {
+    return Poco::Environment::get(name, defaultValue);
+}
+
+long Config::getInt(const std::string& name, long defaultValue) {
+    std::string value = Poco::Environment::get(name, "");
+    if (value.empty()) return defaultValue;
+    
+    try {
+        return std::stol(value);
+    }
+    catch (const std::exception&) {
+        // Not DFS_LOG: the logger reads its own settings through here
+        std::cerr << "Invalid value for " << name << ": '" << value << "', using default " << defaultValue << std::endl;
+        return defaultValue;
+    }
+}
+
+bool Config::getBool(const std::string& name, bool defaultValue) {
+    std::string value = Poco::toLower(Poco::Environment::get(name, ""));
+    if (value.empty()) return defaultValue;
+    return value == "1" || value == "true" || value == "yes" || value == "on";
+}
@@ -0,0 +1,14 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+
+// Runtime settings read from DFS_* environment variables, falling back to defaults
+class Config {
+public:
+    static std::string getString(const std::string& name, const std::string& defaultValue);
+    static long getInt(const std::string& name, long defaultValue);
+    static bool getBool(const std::string& name, bool defaultValue);
+};
+
+#endif
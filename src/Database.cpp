@@ -1,6 +1,11 @@
 #include "Database.h"
+#include "Config.h"
+#include "Logger.h"
 #include <Poco/Data/SessionFactory.h>
-#include <iostream>
+#include <Poco/Exception.h>
+#include <exception>
+
+using namespace Poco::Data::Keywords;
 
 std::unique_ptr<Database> Database::instance = nullptr;
 
@@ -17,18 +22,183 @@ bool Database::initialize() {
         Poco::Data::PostgreSQL::Connector::registerConnector();
         
         // Connection string for YugabyteDB
-        connectionString = "host=127.0.1.1 port=5433 dbname=fileshare user=yugabyte";
+        connectionString = Config::getString("DFS_DB_CONNECTION", 
+                                             "host=127.0.1.1 port=5433 dbname=fileshare user=yugabyte");
+        
+        // Pool sizing
+        long configuredMax = Config::getInt("DFS_DB_POOL_MAX", 32);
+        long configuredMin = Config::getInt("DFS_DB_POOL_MIN", 2);
+        maxConnections = configuredMax > 0 ? static_cast<size_t>(configuredMax) : 1;
+        minConnections = configuredMin > 0 ? static_cast<size_t>(configuredMin) : 0;
+        if (minConnections > maxConnections) minConnections = maxConnections;
+        idleTimeout = std::chrono::seconds(Config::getInt("DFS_DB_POOL_IDLE_SECONDS", 300));
+        healthCheckInterval = std::chrono::seconds(Config::getInt("DFS_DB_HEALTH_CHECK_SECONDS", 30));
+        maxWait = std::chrono::milliseconds(Config::getInt("DFS_DB_POOL_WAIT_MS", 5000));
         
-        // Test connection
-        auto session = getSession();
+        // Test connection and warm the pool
+        std::lock_guard<std::mutex> lock(poolMutex);
+        while (openConnections < minConnections || openConnections == 0) {
+            idleConnections.push_back(openConnection());
+            ++openConnections;
+        }
         return true;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "Database initialization failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "Database initialization failed: " << ex.displayText();
+        return false;
+    }
+}
+
+Database::PooledSession Database::getSession() {
+    return PooledSession(*this, acquire());
+}
+
+PoolStats Database::getPoolStats() {
+    PoolStats stats;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        stats.size = openConnections;
+        stats.idle = idleConnections.size();
+        stats.inUse = openConnections - idleConnections.size();
+    }
+    stats.minSize = minConnections;
+    stats.maxSize = maxConnections;
+    stats.connectionsCreated = connectionsCreated.load(std::memory_order_relaxed);
+    stats.connectionsClosed = connectionsClosed.load(std::memory_order_relaxed);
+    stats.acquisitions = acquisitions.load(std::memory_order_relaxed);
+    stats.waits = waits.load(std::memory_order_relaxed);
+    stats.waitTimeouts = waitTimeouts.load(std::memory_order_relaxed);
+    stats.waitMicros = waitMicros.load(std::memory_order_relaxed);
+    stats.healthCheckFailures = healthCheckFailures.load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::unique_ptr<Database::Connection> Database::openConnection() {
+    auto connection = std::unique_ptr<Connection>(
+        new Connection(Poco::Data::Session("PostgreSQL", connectionString)));
+    connection->lastUsed = connection->lastChecked = std::chrono::steady_clock::now();
+    connectionsCreated.fetch_add(1, std::memory_order_relaxed);
+    return connection;
+}
+
+bool Database::isHealthy(Connection& connection) {
+    try {
+        if (!connection.session.isConnected()) return false;
+        
+        int one = 0;
+        connection.session << "SELECT 1", into(one), now;
+        connection.lastChecked = std::chrono::steady_clock::now();
+        return one == 1;
+    }
+    catch (const Poco::Exception&) {
         return false;
     }
 }
 
-Poco::Data::Session Database::getSession() {
-    return Poco::Data::Session("PostgreSQL", connectionString);
+void Database::evictIdle(std::chrono::steady_clock::time_point now) {
+    // Called with poolMutex held; the least recently used connections sit at the back
+    while (openConnections > minConnections && !idleConnections.empty() &&
+           now - idleConnections.back()->lastUsed > idleTimeout) {
+        idleConnections.pop_back();
+        --openConnections;
+        connectionsClosed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::unique_ptr<Database::Connection> Database::acquire() {
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + maxWait;
+    bool waited = false;
+    
+    while (true) {
+        std::unique_ptr<Connection> connection;
+        bool mayOpen = false;
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            evictIdle(std::chrono::steady_clock::now());
+            
+            while (idleConnections.empty() && openConnections >= maxConnections) {
+                waited = true;
+                if (connectionReleased.wait_until(lock, deadline) == std::cv_status::timeout &&
+                    idleConnections.empty() && openConnections >= maxConnections) {
+                    waits.fetch_add(1, std::memory_order_relaxed);
+                    waitTimeouts.fetch_add(1, std::memory_order_relaxed);
+                    throw Poco::TimeoutException("Database connection pool exhausted");
+                }
+            }
+            
+            if (!idleConnections.empty()) {
+                connection = std::move(idleConnections.front());
+                idleConnections.pop_front();
+            } else {
+                ++openConnections;
+                mayOpen = true;
+            }
+        }
+        
+        // Connecting and health checks happen outside the lock
+        if (mayOpen) {
+            try {
+                connection = openConnection();
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(poolMutex);
+                --openConnections;
+                connectionReleased.notify_one();
+                throw;
+            }
+        }
+        else if (std::chrono::steady_clock::now() - connection->lastChecked > healthCheckInterval &&
+                 !isHealthy(*connection)) {
+            healthCheckFailures.fetch_add(1, std::memory_order_relaxed);
+            release(std::move(connection), true);
+            continue;
+        }
+        
+        if (waited) {
+            auto waitedFor = std::chrono::steady_clock::now() - start;
+            waits.fetch_add(1, std::memory_order_relaxed);
+            waitMicros.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(waitedFor).count(),
+                                 std::memory_order_relaxed);
+        }
+        acquisitions.fetch_add(1, std::memory_order_relaxed);
+        return connection;
+    }
+}
+
+void Database::release(std::unique_ptr<Connection> connection, bool failed) {
+    if (!failed) {
+        try {
+            // A transaction left open by the caller must not leak into the next checkout
+            if (connection->session.isTransaction()) connection->session.rollback();
+            failed = !connection->session.isConnected();
+        }
+        catch (const Poco::Exception&) {
+            failed = true;
+        }
+    }
+    
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (failed) {
+        connection.reset();
+        --openConnections;
+        connectionsClosed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        connection->lastUsed = std::chrono::steady_clock::now();
+        idleConnections.push_front(std::move(connection));
+    }
+    connectionReleased.notify_one();
+}
+
+Database::PooledSession::PooledSession(Database& owner, std::unique_ptr<Connection> conn)
+    : Poco::Data::Session(conn->session), database(owner), connection(std::move(conn)) {}
+
+Database::PooledSession::~PooledSession() {
+    // Released while an exception is in flight: the connection may be mid-statement,
+    // so drop its prepared statements and let release() verify it before reuse
+    if (std::uncaught_exceptions() > 0) {
+        connection->prepared.clear();
+        connection->lastChecked = std::chrono::steady_clock::time_point();
+    }
+    database.release(std::move(connection), false);
 }
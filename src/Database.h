@@ -3,19 +3,110 @@
 
 #include <Poco/Data/Session.h>
 #include <Poco/Data/PostgreSQL/Connector.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <string>
 #include <memory>
 
+struct PoolStats {
+    size_t size;
+    size_t inUse;
+    size_t idle;
+    size_t minSize;
+    size_t maxSize;
+    uint64_t connectionsCreated;
+    uint64_t connectionsClosed;
+    uint64_t acquisitions;
+    uint64_t waits;
+    uint64_t waitTimeouts;
+    uint64_t waitMicros;
+    uint64_t healthCheckFailures;
+};
+
 class Database {
+    struct Connection;
+    
 public:
+    // A pooled connection, usable anywhere a Poco::Data::Session is. It goes back to
+    // the pool when it leaves scope, so it must not be copied into a plain Session.
+    class PooledSession : public Poco::Data::Session {
+    public:
+        PooledSession(Database& owner, std::unique_ptr<Connection> conn);
+        ~PooledSession();
+        
+        PooledSession(const PooledSession&) = delete;
+        PooledSession& operator=(const PooledSession&) = delete;
+        PooledSession(PooledSession&&) = delete;
+        PooledSession& operator=(PooledSession&&) = delete;
+        
+        // Statement prepared once per physical connection and reused across checkouts.
+        // T is constructed from the session and owns its Statement and bound variables.
+        template <typename T>
+        T& prepared(const std::string& name);
+        
+    private:
+        Database& database;
+        std::unique_ptr<Connection> connection;
+    };
+    
     static Database& getInstance();
-    Poco::Data::Session getSession();
+    PooledSession getSession();
     bool initialize();
+    PoolStats getPoolStats();
     
 private:
+    struct Connection {
+        explicit Connection(const Poco::Data::Session& s) : session(s) {}
+        
+        Poco::Data::Session session;
+        std::chrono::steady_clock::time_point lastUsed;
+        std::chrono::steady_clock::time_point lastChecked;
+        // Declared after session so prepared statements are destroyed first
+        std::map<std::string, std::shared_ptr<void>> prepared;
+    };
+    
     Database() = default;
+    std::unique_ptr<Connection> acquire();
+    std::unique_ptr<Connection> openConnection();
+    bool isHealthy(Connection& connection);
+    void release(std::unique_ptr<Connection> connection, bool failed);
+    void evictIdle(std::chrono::steady_clock::time_point now);
+    
     static std::unique_ptr<Database> instance;
     std::string connectionString;
+    
+    size_t minConnections = 2;
+    size_t maxConnections = 32;
+    std::chrono::seconds idleTimeout{300};
+    std::chrono::seconds healthCheckInterval{30};
+    std::chrono::milliseconds maxWait{5000};
+    
+    std::mutex poolMutex;
+    std::condition_variable connectionReleased;
+    std::deque<std::unique_ptr<Connection>> idleConnections;  // Most recently used at the front
+    size_t openConnections = 0;
+    
+    std::atomic<uint64_t> connectionsCreated{0};
+    std::atomic<uint64_t> connectionsClosed{0};
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> waits{0};
+    std::atomic<uint64_t> waitTimeouts{0};
+    std::atomic<uint64_t> waitMicros{0};
+    std::atomic<uint64_t> healthCheckFailures{0};
 };
 
+template <typename T>
+T& Database::PooledSession::prepared(const std::string& name) {
+    std::shared_ptr<void>& slot = connection->prepared[name];
+    if (!slot) {
+        slot = std::make_shared<T>(static_cast<Poco::Data::Session&>(*this));
+    }
+    return *std::static_pointer_cast<T>(slot);
+}
+
 #endif
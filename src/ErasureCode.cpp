@@ -0,0 +1,295 @@
+#include "ErasureCode.h"
+#include <Poco/Exception.h>
+#include <atomic>
+#include <cstring>
+#include <utility>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DFS_X86_KERNELS 1
+#endif
+
+namespace {
+
+// Shards are processed in blocks this size, so a stripe's inputs stay in cache
+// while every output row is computed from them
+const size_t BLOCK_SIZE = 8 * 1024;
+const size_t SHARD_ALIGNMENT = 64;
+
+struct GaloisField {
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    GaloisField() {
+        // Generator 2 over x^8 + x^4 + x^3 + x^2 + 1, the usual Reed-Solomon polynomial
+        unsigned x = 1;
+        for (int i = 0; i < 255; ++i) {
+            exp[i] = static_cast<uint8_t>(x);
+            log[x] = static_cast<uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100) x ^= 0x11d;
+        }
+        for (int i = 255; i < 512; ++i) exp[i] = exp[i - 255];
+        log[0] = 0;
+    }
+};
+
+const GaloisField& field() {
+    static const GaloisField instance;
+    return instance;
+}
+
+uint8_t gfMultiply(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) return 0;
+    const GaloisField& gf = field();
+    return gf.exp[gf.log[a] + gf.log[b]];
+}
+
+uint8_t gfInverse(uint8_t a) {
+    const GaloisField& gf = field();
+    return gf.exp[255 - gf.log[a]];
+}
+
+// Products of one coefficient with every low nibble, then with every high nibble;
+// c * x is the XOR of the two lookups
+void nibbleTables(uint8_t c, uint8_t* tables) {
+    for (int x = 0; x < 16; ++x) {
+        tables[x] = gfMultiply(c, static_cast<uint8_t>(x));
+        tables[16 + x] = gfMultiply(c, static_cast<uint8_t>(x << 4));
+    }
+}
+
+// dst = c * src, or dst ^= c * src when accumulating
+typedef void (*RegionKernel)(uint8_t* dst, const uint8_t* src, const uint8_t* tables, size_t length, bool accumulate);
+
+void regionScalar(uint8_t* dst, const uint8_t* src, const uint8_t* tables, size_t length, bool accumulate) {
+    uint8_t products[256];
+    for (int x = 0; x < 256; ++x) products[x] = tables[x & 0x0f] ^ tables[16 + (x >> 4)];
+
+    if (accumulate) {
+        for (size_t i = 0; i < length; ++i) dst[i] ^= products[src[i]];
+    }
+    else {
+        for (size_t i = 0; i < length; ++i) dst[i] = products[src[i]];
+    }
+}
+
+#ifdef DFS_X86_KERNELS
+
+__attribute__((target("ssse3")))
+void regionSsse3(uint8_t* dst, const uint8_t* src, const uint8_t* tables, size_t length, bool accumulate) {
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables + 16));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low, _mm_and_si128(in, mask)),
+                                        _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(in, 4), mask)));
+        if (accumulate) product = _mm_xor_si128(product, _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), product);
+    }
+    if (i < length) regionScalar(dst + i, src + i, tables, length - i, accumulate);
+}
+
+__attribute__((target("avx2")))
+void regionAvx2(uint8_t* dst, const uint8_t* src, const uint8_t* tables, size_t length, bool accumulate) {
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables)));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables + 16)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m256i in0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i in1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+        __m256i product0 = _mm256_xor_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(in0, mask)),
+                                            _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(in0, 4), mask)));
+        __m256i product1 = _mm256_xor_si256(_mm256_shuffle_epi8(low, _mm256_and_si256(in1, mask)),
+                                            _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(in1, 4), mask)));
+        if (accumulate) {
+            product0 = _mm256_xor_si256(product0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i)));
+            product1 = _mm256_xor_si256(product1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i + 32)));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), product0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), product1);
+    }
+    if (i < length) regionSsse3(dst + i, src + i, tables, length - i, accumulate);
+}
+
+#endif
+
+struct Kernel {
+    const char* name;
+    RegionKernel run;
+};
+
+const Kernel KERNELS[] = {
+#ifdef DFS_X86_KERNELS
+    { "avx2", regionAvx2 },
+    { "ssse3", regionSsse3 },
+#endif
+    { "scalar", regionScalar },
+};
+const size_t KERNEL_COUNT = sizeof(KERNELS) / sizeof(KERNELS[0]);
+
+bool cpuSupports(const Kernel& kernel) {
+#ifdef DFS_X86_KERNELS
+    __builtin_cpu_init();
+    if (std::strcmp(kernel.name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (std::strcmp(kernel.name, "ssse3") == 0) return __builtin_cpu_supports("ssse3");
+#endif
+    return true;
+}
+
+// The fastest the CPU supports, unless a benchmark picked another
+std::atomic<size_t>& activeKernel() {
+    static std::atomic<size_t> index([] {
+        size_t best = 0;
+        while (!cpuSupports(KERNELS[best])) ++best;
+        return best;
+    }());
+    return index;
+}
+
+// Inverts a k x k matrix in place by Gauss-Jordan elimination
+bool invert(std::vector<uint8_t>& matrix, int k) {
+    std::vector<uint8_t> inverse(static_cast<size_t>(k) * k, 0);
+    for (int i = 0; i < k; ++i) inverse[i * k + i] = 1;
+
+    for (int column = 0; column < k; ++column) {
+        int pivot = column;
+        while (pivot < k && matrix[pivot * k + column] == 0) ++pivot;
+        if (pivot == k) return false;
+        if (pivot != column) {
+            for (int j = 0; j < k; ++j) {
+                std::swap(matrix[pivot * k + j], matrix[column * k + j]);
+                std::swap(inverse[pivot * k + j], inverse[column * k + j]);
+            }
+        }
+
+        uint8_t scale = gfInverse(matrix[column * k + column]);
+        for (int j = 0; j < k; ++j) {
+            matrix[column * k + j] = gfMultiply(matrix[column * k + j], scale);
+            inverse[column * k + j] = gfMultiply(inverse[column * k + j], scale);
+        }
+
+        for (int row = 0; row < k; ++row) {
+            uint8_t factor = matrix[row * k + column];
+            if (row == column || factor == 0) continue;
+            for (int j = 0; j < k; ++j) {
+                matrix[row * k + j] ^= gfMultiply(factor, matrix[column * k + j]);
+                inverse[row * k + j] ^= gfMultiply(factor, inverse[column * k + j]);
+            }
+        }
+    }
+
+    matrix.swap(inverse);
+    return true;
+}
+
+}
+
+ErasureCode::ErasureCode(int dataShards, int parityShards) : k(dataShards), m(parityShards) {
+    if (k < 1 || m < 1 || k + m > 256) {
+        throw Poco::InvalidArgumentException("Erasure code needs 1 <= k, 1 <= m and k + m <= 256");
+    }
+
+    matrix.assign(static_cast<size_t>(k + m) * k, 0);
+    for (int i = 0; i < k; ++i) matrix[i * k + i] = 1;
+    // Cauchy rows 1 / (x_i + y_j) with x_i = k + i and y_j = j, all distinct
+    for (int i = 0; i < m; ++i) {
+        for (int j = 0; j < k; ++j) {
+            matrix[(k + i) * k + j] = gfInverse(static_cast<uint8_t>((k + i) ^ j));
+        }
+    }
+}
+
+size_t ErasureCode::shardSize(size_t stripeBytes) const {
+    size_t perShard = (stripeBytes + k - 1) / k;
+    return (perShard + SHARD_ALIGNMENT - 1) / SHARD_ALIGNMENT * SHARD_ALIGNMENT;
+}
+
+void ErasureCode::encode(const std::vector<uint8_t*>& shards, size_t length) const {
+    std::vector<uint8_t> rows(matrix.begin() + static_cast<size_t>(k) * k, matrix.end());
+    std::vector<const uint8_t*> inputs(shards.begin(), shards.begin() + k);
+    std::vector<uint8_t*> outputs(shards.begin() + k, shards.end());
+    multiply(rows, inputs, outputs, length);
+}
+
+bool ErasureCode::reconstruct(const std::vector<uint8_t*>& shards, const std::vector<bool>& present,
+                              size_t length) const {
+    std::vector<int> sources;
+    for (int i = 0; i < k + m && static_cast<int>(sources.size()) < k; ++i) {
+        if (present[i]) sources.push_back(i);
+    }
+    if (static_cast<int>(sources.size()) < k) return false;
+
+    // Data first: invert the rows of the shards we have and apply the rows of the missing ones
+    std::vector<uint8_t> rows;
+    std::vector<uint8_t*> outputs;
+    std::vector<int> missingData;
+    for (int i = 0; i < k; ++i) {
+        if (!present[i]) missingData.push_back(i);
+    }
+    if (!missingData.empty()) {
+        std::vector<uint8_t> decode;
+        for (int source : sources) {
+            decode.insert(decode.end(), matrix.begin() + static_cast<size_t>(source) * k,
+                          matrix.begin() + static_cast<size_t>(source + 1) * k);
+        }
+        if (!invert(decode, k)) return false;
+
+        std::vector<const uint8_t*> inputs;
+        for (int source : sources) inputs.push_back(shards[source]);
+        for (int missing : missingData) {
+            rows.insert(rows.end(), decode.begin() + static_cast<size_t>(missing) * k,
+                        decode.begin() + static_cast<size_t>(missing + 1) * k);
+            outputs.push_back(shards[missing]);
+        }
+        multiply(rows, inputs, outputs, length);
+    }
+
+    // Then parity, encoded again from the now complete data
+    rows.clear();
+    outputs.clear();
+    for (int i = k; i < k + m; ++i) {
+        if (present[i]) continue;
+        rows.insert(rows.end(), matrix.begin() + static_cast<size_t>(i) * k, matrix.begin() + static_cast<size_t>(i + 1) * k);
+        outputs.push_back(shards[i]);
+    }
+    if (!outputs.empty()) {
+        std::vector<const uint8_t*> inputs(shards.begin(), shards.begin() + k);
+        multiply(rows, inputs, outputs, length);
+    }
+    return true;
+}
+
+void ErasureCode::multiply(const std::vector<uint8_t>& rows, const std::vector<const uint8_t*>& inputs,
+                           const std::vector<uint8_t*>& outputs, size_t length) const {
+    std::vector<uint8_t> tables(rows.size() * 32);
+    for (size_t i = 0; i < rows.size(); ++i) nibbleTables(rows[i], &tables[i * 32]);
+
+    RegionKernel run = KERNELS[activeKernel().load(std::memory_order_relaxed)].run;
+    for (size_t start = 0; start < length; start += BLOCK_SIZE) {
+        size_t count = length - start < BLOCK_SIZE ? length - start : BLOCK_SIZE;
+        for (size_t o = 0; o < outputs.size(); ++o) {
+            for (size_t i = 0; i < inputs.size(); ++i) {
+                run(outputs[o] + start, inputs[i] + start, &tables[(o * inputs.size() + i) * 32], count, i > 0);
+            }
+        }
+    }
+}
+
+const char* ErasureCode::kernelName() {
+    return KERNELS[activeKernel().load(std::memory_order_relaxed)].name;
+}
+
+bool ErasureCode::useKernel(const std::string& name) {
+    for (size_t i = 0; i < KERNEL_COUNT; ++i) {
+        if (name == KERNELS[i].name && cpuSupports(KERNELS[i])) {
+            activeKernel().store(i, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
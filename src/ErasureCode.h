@@ -0,0 +1,44 @@
+#ifndef ERASURECODE_H
+#define ERASURECODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Systematic Reed-Solomon code over GF(2^8): k data shards plus m parity shards,
+// any k of which rebuild the rest. The parity rows form a Cauchy matrix, so every
+// k x k submatrix of the encoding matrix is invertible. Shard arithmetic runs on
+// 16 or 32 bytes at a time with PSHUFB nibble lookups when the CPU has SSSE3 or
+// AVX2, chosen at startup, and falls back to table lookups otherwise.
+class ErasureCode {
+public:
+    // Throws Poco::InvalidArgumentException unless 1 <= k, 1 <= m and k + m <= 256
+    ErasureCode(int dataShards, int parityShards);
+
+    int dataShards() const { return k; }
+    int parityShards() const { return m; }
+    // Bytes per shard for a stripe of the given size, padded for the vector kernels
+    size_t shardSize(size_t stripeBytes) const;
+
+    // shards holds k + m buffers of length bytes; the parity ones are overwritten
+    void encode(const std::vector<uint8_t*>& shards, size_t length) const;
+    // Rebuilds every shard not marked present from the ones that are. False when
+    // fewer than k are present.
+    bool reconstruct(const std::vector<uint8_t*>& shards, const std::vector<bool>& present, size_t length) const;
+
+    // "avx2", "ssse3" or "scalar"
+    static const char* kernelName();
+    // For benchmarks: false if the CPU cannot run the named kernel
+    static bool useKernel(const std::string& name);
+
+private:
+    void multiply(const std::vector<uint8_t>& rows, const std::vector<const uint8_t*>& inputs,
+                  const std::vector<uint8_t*>& outputs, size_t length) const;
+
+    int k;
+    int m;
+    std::vector<uint8_t> matrix;  // (k + m) x k, identity on top
+};
+
+#endif
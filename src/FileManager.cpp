@@ -1,127 +1,501 @@
 #include "FileManager.h"
 #include "Database.h"
 #include "Utils.h"
+#include "Config.h"
+#include "BlobStore.h"
+#include "MetadataCache.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include "Compression.h"
+#include "StorageBackend.h"
+#include "ChunkStore.h"
+#include "Cluster.h"
+#include <Poco/Data/DataException.h>
 #include <Poco/Data/Statement.h>
+#include <Poco/Crypto/DigestEngine.h>
 #include <Poco/Exception.h>
 #include <Poco/DateTime.h>
+#include <Poco/DateTimeFormatter.h>
+#include <Poco/Nullable.h>
 #include <Poco/Path.h>
 #include <Poco/File.h>
+#include <algorithm>
+#include <cstdint>
 #include <fstream>
-#include <iostream>
+#include <map>
+#include <set>
 
 using namespace Poco::Data::Keywords;
 
+namespace {
+
+// Hot statements on the download path, prepared once per pooled connection
+
+struct FileMetadataLookup {
+    explicit FileMetadataLookup(Poco::Data::Session& session) : statement(session) {
+        statement << "SELECT filename, original_filename, file_size, content_type, owner_id, upload_date, is_public "
+                     "FROM files WHERE file_id = $1",
+            use(fileId), into(filename), into(originalFilename), into(fileSize), 
+            into(contentType), into(ownerId), into(uploadDate), into(isPublic), limit(1);
+    }
+    
+    int fileId = 0;
+    std::string filename, originalFilename, contentType, uploadDate;
+    int ownerId = 0;
+    long fileSize = 0;
+    bool isPublic = false;
+    Poco::Data::Statement statement;
+};
+
+struct ShareGrantLookup {
+    explicit ShareGrantLookup(Poco::Data::Session& session) : statement(session) {
+        statement << "SELECT COUNT(*), MAX(COALESCE(expires_at, TIMESTAMP '9999-12-31')) FROM file_shares "
+                     "WHERE file_id = $1 AND shared_with = $2 AND (expires_at IS NULL OR expires_at > CURRENT_TIMESTAMP)",
+            use(fileId), use(userId), into(shareCount), into(expiresAt);
+    }
+    
+    int fileId = 0;
+    int userId = 0;
+    int shareCount = 0;
+    Poco::Nullable<Poco::DateTime> expiresAt;
+    Poco::Data::Statement statement;
+};
+
+struct ShareTokenLookup {
+    explicit ShareTokenLookup(Poco::Data::Session& session) : statement(session) {
+        statement << "SELECT fs.file_id, COALESCE(fs.shared_with, 0), COALESCE(fs.expires_at, TIMESTAMP '9999-12-31') "
+                     "FROM file_shares fs WHERE fs.share_token = $1 AND "
+                     "(fs.expires_at IS NULL OR fs.expires_at > CURRENT_TIMESTAMP)",
+            use(token), into(fileId), into(sharedWith), into(expiresAt), limit(1);
+    }
+    
+    std::string token;
+    int fileId = 0;
+    int sharedWith = 0;
+    Poco::DateTime expiresAt;
+    Poco::Data::Statement statement;
+};
+
+}
+
 std::string FileManager::getUploadsDirectory() {
-    return "./uploads/";
+    return StorageBackend::getInstance().getStagingDirectory();
+}
+
+size_t FileManager::getUploadBufferSize() {
+    // Per-upload memory is bounded by this buffer, regardless of the body size
+    static const size_t bufferSize = [] {
+        long configured = Config::getInt("DFS_UPLOAD_BUFFER_SIZE", 64 * 1024);
+        if (configured < 4 * 1024) configured = 4 * 1024;
+        if (configured > 16 * 1024 * 1024) configured = 16 * 1024 * 1024;
+        return static_cast<size_t>(configured);
+    }();
+    return bufferSize;
 }
 
-bool FileManager::saveFileToDisk(const std::string& filename, const std::string& content) {
+bool FileManager::saveStreamToDisk(const std::string& tempFilename, std::istream& content, long expectedSize,
+                                   long& bytesWritten, std::string& contentHash) {
+    std::string tempPath = getUploadsDirectory() + tempFilename;
+    bytesWritten = 0;
+    
     try {
-        std::string fullPath = getUploadsDirectory() + filename;
-        std::ofstream file(fullPath, std::ios::binary);
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
         if (!file) return false;
         
-        file.write(content.c_str(), content.length());
+        // Hash while the bytes stream past so deduplication needs no second read
+        Poco::Crypto::DigestEngine digest("SHA256");
+        std::vector<char> buffer(getUploadBufferSize());
+        while (content) {
+            content.read(buffer.data(), buffer.size());
+            std::streamsize count = content.gcount();
+            if (count <= 0) break;
+            
+            {
+                ScopedTimer timer(Metrics::getInstance().diskWrite());
+                file.write(buffer.data(), count);
+            }
+            if (!file) break;
+            digest.update(buffer.data(), static_cast<unsigned>(count));
+            bytesWritten += count;
+        }
+        
         file.close();
-        return true;
+        // A client that disconnects mid-body ends the stream early, not with an error
+        if (expectedSize >= 0 && bytesWritten != expectedSize) {
+            DFS_LOG_WARN << "Upload rejected: received " << bytesWritten << " of " << expectedSize << " bytes";
+        }
+        else if (file && !content.bad()) {
+            contentHash = Poco::DigestEngine::digestToHex(digest.digest());
+            return true;
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Saving upload failed: " << ex.displayText();
     }
     catch (...) {
-        return false;
     }
+    
+    removeStagedFile(tempFilename);
+    return false;
+}
+
+void FileManager::removeFromDisk(const std::string& filename) {
+    StorageBackend& storage = StorageBackend::getInstance();
+    storage.remove(filename);
+    ChunkStore::getInstance().remove(filename);
+    
+    // Rows written before the fan-out migration may name the other layout
+    std::string alternate = getAlternateFilename(filename);
+    if (!storage.locate(alternate).empty()) storage.remove(alternate);
+}
+
+bool FileManager::hasStoredCopy(const std::string& filename) {
+    if (Poco::File(resolveStoredPath(filename)).exists()) return true;
+    ChunkManifest manifest;
+    return ChunkStore::getInstance().loadManifest(filename, manifest);
 }
 
-bool FileManager::loadFileFromDisk(const std::string& filename, std::string& content) {
+bool FileManager::isReferenced(const std::string& filename) {
     try {
-        std::string fullPath = getUploadsDirectory() + filename;
-        std::ifstream file(fullPath, std::ios::binary);
-        if (!file) return false;
-        
-        file.seekg(0, std::ios::end);
-        content.reserve(file.tellg());
-        file.seekg(0, std::ios::beg);
+        auto session = Database::getInstance().getSession();
+        std::string name = filename;
+        int count = 0;
+        Poco::Data::Statement select(session);
+        select << "SELECT COUNT(*) FROM files WHERE filename = $1", use(name), into(count);
+        select.execute();
+        return count > 0;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Checking references to " << filename << " failed: " << ex.displayText();
+        return true;
+    }
+}
+
+bool FileManager::findReferenced(const std::vector<std::string>& filenames, std::set<std::string>& referenced) {
+    if (filenames.empty()) return true;
+    
+    try {
+        auto session = Database::getInstance().getSession();
+        std::string filenameArray = Utils::toPostgresArray(filenames);
+        std::vector<std::string> found;
+        Poco::Data::Statement select(session);
+        select << "SELECT DISTINCT filename FROM files WHERE filename = ANY($1::text[])",
+            use(filenameArray), into(found);
+        select.execute();
         
-        content.assign((std::istreambuf_iterator<char>(file)),
-                      std::istreambuf_iterator<char>());
-        file.close();
+        referenced.insert(found.begin(), found.end());
         return true;
     }
-    catch (...) {
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Checking references to stored files failed: " << ex.displayText();
         return false;
     }
 }
 
-int FileManager::uploadFile(const std::string& originalFilename, const std::string& content, 
-                           const std::string& contentType, int ownerId) {
+bool FileManager::importStoredFile(const std::string& filename, std::istream& content, long expectedSize) {
+    std::string tempFilename = "." + Utils::generateUploadId() + ".part";
+    long fileSize = 0;
+    std::string contentHash;
+    // Peers always send a length, so a copy that stops midway is never stored
+    if (expectedSize < 0 || !saveStreamToDisk(tempFilename, content, expectedSize, fileSize, contentHash)) {
+        return false;
+    }
+    
+    std::string expectedHash = BlobStore::getHashFromFilename(filename);
+    if (!expectedHash.empty() && contentHash != expectedHash) {
+        DFS_LOG_WARN << "Copy of " << filename << " rejected: body does not match its name";
+        removeStagedFile(tempFilename);
+        return false;
+    }
+    
     try {
-        // Generate unique filename
-        std::string uniqueFilename = Utils::generateUniqueFilename(originalFilename);
-        
-        // Save to disk
-        if (!saveFileToDisk(uniqueFilename, content)) {
+        storeBlob(tempFilename, filename, fileSize);
+        return true;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Storing copy of " << filename << " failed: " << ex.displayText();
+        return false;
+    }
+}
+
+bool FileManager::storeBlob(const std::string& tempFilename, const std::string& blobFilename, long fileSize) {
+    std::string stagedPath = getUploadsDirectory() + tempFilename;
+    ChunkStore& chunks = ChunkStore::getInstance();
+    if (chunks.shouldChunk(static_cast<Poco::UInt64>(fileSize))) {
+        chunks.store(stagedPath, blobFilename);
+        return true;
+    }
+    
+    StorageBackend::getInstance().store(stagedPath, blobFilename);
+    return false;
+}
+
+void FileManager::removeStagedFile(const std::string& tempFilename) {
+    try {
+        Poco::File file(getUploadsDirectory() + tempFilename);
+        if (file.exists()) file.remove();
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Removing " << tempFilename << " failed: " << ex.displayText();
+    }
+}
+
+std::string FileManager::getFanoutFilename(const std::string& filename) {
+    // Two levels of 256 buckets keep directories small. Content hashes supply their
+    // own prefix; older "<micros>_<name>" files are bucketed by an FNV-1a hash.
+    std::string name = filename.substr(filename.find_last_of('/') + 1);
+    std::string prefix;
+    
+    if (!BlobStore::getHashFromFilename(name).empty()) {
+        prefix = name.substr(0, 4);
+    } else {
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : name) {
+            hash ^= c;
+            hash *= 16777619u;
+        }
+        static const char hexDigits[] = "0123456789abcdef";
+        for (int shift = 28; shift >= 16; shift -= 4) {
+            prefix += hexDigits[(hash >> shift) & 0xF];
+        }
+    }
+    
+    return prefix.substr(0, 2) + "/" + prefix.substr(2, 2) + "/" + name;
+}
+
+std::string FileManager::getAlternateFilename(const std::string& filename) {
+    if (filename.find('/') == std::string::npos) return getFanoutFilename(filename);
+    return filename.substr(filename.find_last_of('/') + 1);
+}
+
+std::string FileManager::resolveStoredPath(const std::string& filename) {
+    StorageBackend& storage = StorageBackend::getInstance();
+    std::string path = storage.locate(filename);
+    if (!path.empty()) return path;
+    
+    // Mid-migration the file may already have moved (flat row) or the row may be
+    // ahead of a file that could not be moved yet (fan-out row); try the other layout
+    path = storage.locate(getAlternateFilename(filename));
+    return path.empty() ? storage.getPrimaryPath(filename) : path;
+}
+
+std::string FileManager::getFilePath(const FileInfo& info) {
+    return resolveStoredPath(info.filename);
+}
+
+std::string FileManager::getETag(const FileInfo& info) {
+    // Blobs are named by their content hash, which is exactly a strong validator
+    std::string contentHash = BlobStore::getHashFromFilename(info.filename);
+    if (!contentHash.empty()) return "\"" + contentHash + "\"";
+    
+    // Stored before deduplication: each row has its own file, never rewritten
+    return "\"f" + std::to_string(info.fileId) + "-" + std::to_string(info.fileSize) + "\"";
+}
+
+void FileManager::moveIntoStore(const std::string& fromPath, const std::string& toPath) {
+    Poco::Path parent(toPath);
+    parent.makeParent();
+    Poco::File(parent).createDirectories();
+    
+    Poco::File(fromPath).renameTo(toPath);
+}
+
+int FileManager::uploadFile(const std::string& originalFilename, std::istream& content, 
+                           const std::string& contentType, int ownerId, long expectedSize,
+                           const std::string& expectedHash) {
+    if (!expectedHash.empty() && BlobStore::exists(expectedHash)) {
+        // Known content: verify the body against the claimed hash without writing anything
+        long fileSize = 0;
+        std::string actualHash = BlobStore::hashStream(content, fileSize);
+        if ((expectedSize >= 0 && fileSize != expectedSize) || actualHash != expectedHash) {
+            DFS_LOG_WARN << "File upload rejected: body is incomplete or does not match X-Content-SHA256";
             return -1;
         }
         
-        // Save metadata to database
-        auto session = Database::getInstance().getSession();
-        std::string filePath = getUploadsDirectory() + uniqueFilename;
-        long fileSize = content.length();
-        
-        // Create non-const variables for binding
-        std::string fname = uniqueFilename;
-        std::string origName = originalFilename;
-        std::string fpath = filePath;
-        std::string ctype = contentType;
-        
-        Poco::Data::Statement insert(session);
-        insert << "INSERT INTO files (filename, original_filename, file_path, file_size, content_type, owner_id) "
-                  "VALUES ($1, $2, $3, $4, $5, $6)",
-            use(fname), use(origName), use(fpath), use(fileSize), 
-            use(ctype), use(ownerId);
-        insert.execute();
+        int fileId = commitUpload("", originalFilename, contentType, ownerId, fileSize, actualHash);
+        if (fileId > 0) return fileId;
         
-        // Get the file_id
-        int fileId = 0;
-        Poco::Data::Statement getId(session);
-        getId << "SELECT file_id FROM files WHERE filename = $1 AND owner_id = $2 ORDER BY file_id DESC LIMIT 1",  // ← Fixed: $1, $2 instead of ?
-            use(fname), use(ownerId), into(fileId);
-        getId.execute();
-        
-        std::cout << "File uploaded successfully with ID: " << fileId << std::endl;
-        return fileId;
+        // The blob disappeared between the check and the commit; the body is gone too
+        return -1;
     }
-    catch (const Poco::Exception& ex) {
-        std::cerr << "File upload failed: " << ex.displayText() << std::endl;
+    
+    // Stream into a temp file first so readers never observe a partially written upload
+    std::string tempFilename = "." + Utils::generateUniqueFilename(originalFilename) + ".part";
+    
+    long fileSize = 0;
+    std::string contentHash;
+    if (!saveStreamToDisk(tempFilename, content, expectedSize, fileSize, contentHash)) {
         return -1;
     }
+    
+    if (!expectedHash.empty() && contentHash != expectedHash) {
+        DFS_LOG_WARN << "File upload rejected: body does not match X-Content-SHA256";
+        removeStagedFile(tempFilename);
+        return -1;
+    }
+    
+    return commitUpload(tempFilename, originalFilename, contentType, ownerId, fileSize, contentHash);
 }
 
-bool FileManager::downloadFile(int fileId, int requesterId, std::string& content, FileInfo& info) {
+int FileManager::commitUpload(const std::string& tempFilename, const std::string& originalFilename, 
+                             const std::string& contentType, int ownerId, long fileSize, 
+                             const std::string& contentHash,
+                             const std::function<bool(Poco::Data::Session&)>& claim) {
+    std::string hash = contentHash;
+    if (hash.empty() && !tempFilename.empty()) {
+        hash = BlobStore::hashFile(getUploadsDirectory() + tempFilename);
+    }
+    if (hash.empty()) {
+        if (!tempFilename.empty()) removeStagedFile(tempFilename);
+        return -1;
+    }
+    
+    // Identical bodies share one blob on disk, named by their hash
+    std::string blobFilename = BlobStore::getBlobFilename(hash);
+    std::string filePath = StorageBackend::getInstance().getPrimaryPath(blobFilename);
+    bool createdBlob = false;
+    bool chunked = false;
+    
     try {
         auto session = Database::getInstance().getSession();
+        session.begin();
         
-        // Get file metadata
-        std::string filename, originalFilename, contentType, uploadDate;
-        int ownerId;
-        long fileSize;
-        bool isPublic;
-        
-        Poco::Data::Statement select(session);
-        select << "SELECT filename, original_filename, file_size, content_type, owner_id, upload_date, is_public "
-                  "FROM files WHERE file_id = $1",
-            use(fileId), into(filename), into(originalFilename), into(fileSize), 
-            into(contentType), into(ownerId), into(uploadDate), into(isPublic), limit(1);
-        select.execute();
+        try {
+            if (claim && !claim(session)) {
+                session.rollback();
+                if (!tempFilename.empty()) removeStagedFile(tempFilename);
+                return -1;
+            }
+            if (!BlobStore::addReference(session, hash, fileSize, !tempFilename.empty(), createdBlob)) {
+                session.rollback();
+                return -1;
+            }
+            
+            if (createdBlob) {
+                chunked = storeBlob(tempFilename, blobFilename, fileSize);
+                Cluster::getInstance().recordLocations(session, std::vector<std::string>(1, blobFilename));
+            }
+            
+            // Create non-const variables for binding
+            std::string fname = blobFilename;
+            std::string origName = originalFilename;
+            std::string fpath = filePath;
+            std::string ctype = contentType;
+            
+            int fileId = 0;
+            Poco::Data::Statement insert(session);
+            insert << "INSERT INTO files (filename, original_filename, file_path, file_size, content_type, owner_id) "
+                      "VALUES ($1, $2, $3, $4, $5, $6) RETURNING file_id",
+                use(fname), use(origName), use(fpath), use(fileSize), 
+                use(ctype), use(ownerId), into(fileId);
+            {
+                static Histogram& latency = Metrics::getInstance().dbStatement("insert_file");
+                ScopedTimer timer(latency);
+                insert.execute();
+            }
+            
+            session.commit();
+            
+            if (!createdBlob && !tempFilename.empty()) {
+                // Duplicate content: the freshly written copy is not needed
+                removeStagedFile(tempFilename);
+            }
+            if (createdBlob && !chunked) {
+                Compression::getInstance().scheduleSidecars(resolveStoredPath(blobFilename), contentType, 
+                                                            static_cast<Poco::UInt64>(fileSize));
+            }
+            MetadataCache::getInstance().bumpListingVersion(MetadataCache::LISTING_FILES, ownerId);
+            
+            DFS_LOG_INFO << "File uploaded successfully with ID: " << fileId 
+                         << (createdBlob ? "" : " (deduplicated)");
+            return fileId;
+        }
+        catch (...) {
+            if (session.isTransaction()) session.rollback();
+            throw;
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "File upload failed: " << ex.displayText();
         
-        if (filename.empty()) return false;
+        // Don't leave an unreferenced file behind; a created blob's staged file went to the backend
+        if (createdBlob) removeFromDisk(blobFilename);
+        else if (!tempFilename.empty()) removeStagedFile(tempFilename);
+        return -1;
+    }
+}
+
+bool FileManager::loadFileMetadata(int fileId, FileInfo& info) {
+    // Viral links hit the same few rows, so metadata is served from memory when possible
+    MetadataCache& cache = MetadataCache::getInstance();
+    if (cache.getFile(fileId, info)) return true;
+    uint64_t generation = cache.getGeneration();
+    
+    auto session = Database::getInstance().getSession();
+    
+    FileMetadataLookup& select = session.prepared<FileMetadataLookup>("file_metadata");
+    select.fileId = fileId;
+    select.filename.clear();
+    {
+        static Histogram& latency = Metrics::getInstance().dbStatement("file_metadata");
+        ScopedTimer timer(latency);
+        select.statement.execute();
+    }
+    
+    if (select.filename.empty()) return false;
+    
+    info.fileId = fileId;
+    info.filename = select.filename;
+    info.originalFilename = select.originalFilename;
+    info.fileSize = select.fileSize;
+    info.contentType = select.contentType;
+    info.ownerId = select.ownerId;
+    info.uploadDate = select.uploadDate;
+    info.isPublic = select.isPublic;
+    
+    cache.putFile(info, generation);
+    return true;
+}
+
+bool FileManager::isSharedWith(int fileId, int userId) {
+    MetadataCache& cache = MetadataCache::getInstance();
+    bool granted = false;
+    if (cache.getShareGrant(fileId, userId, granted)) return granted;
+    uint64_t generation = cache.getGeneration();
+    
+    auto session = Database::getInstance().getSession();
+    
+    ShareGrantLookup& shareCheck = session.prepared<ShareGrantLookup>("share_grant");
+    shareCheck.fileId = fileId;
+    shareCheck.userId = userId;
+    shareCheck.shareCount = 0;
+    shareCheck.expiresAt.clear();
+    {
+        static Histogram& latency = Metrics::getInstance().dbStatement("share_grant");
+        ScopedTimer timer(latency);
+        shareCheck.statement.execute();
+    }
+    
+    granted = shareCheck.shareCount > 0 && !shareCheck.expiresAt.isNull();
+    cache.putShareGrant(fileId, userId, granted, 
+                        granted ? shareCheck.expiresAt.value().timestamp() : Poco::Timestamp(), generation);
+    return granted;
+}
+
+bool FileManager::downloadFile(int fileId, int requesterId, FileInfo& info) {
+    try {
+        // Get file metadata
+        FileInfo metadata;
+        if (!loadFileMetadata(fileId, metadata)) return false;
         
         // Check access permissions
         bool hasAccess = false;
         
-        if (ownerId == requesterId) {
+        if (metadata.ownerId == requesterId) {
             // User owns the file
             hasAccess = true;
         }
-        else if (isPublic) {
+        else if (metadata.isPublic) {
             // File is public
             hasAccess = true;
         }
@@ -131,81 +505,113 @@ bool FileManager::downloadFile(int fileId, int requesterId, std::string& content
         }
         else if (requesterId > 0) {
             // Check if file is specifically shared with this user
-            int shareCount = 0;
-            Poco::Data::Statement shareCheck(session);
-            shareCheck << "SELECT COUNT(*) FROM file_shares WHERE file_id = $1 AND shared_with = $2 AND (expires_at IS NULL OR expires_at > CURRENT_TIMESTAMP)",
-                use(fileId), use(requesterId), into(shareCount);
-            shareCheck.execute();
-            hasAccess = (shareCount > 0);
+            hasAccess = isSharedWith(fileId, requesterId);
         }
         
         if (!hasAccess) return false;
         
-        // Load file content
-        if (!loadFileFromDisk(filename, content)) return false;
-        
-        // Fill file info
-        info.fileId = fileId;
-        info.filename = filename;
-        info.originalFilename = originalFilename;
-        info.fileSize = fileSize;
-        info.contentType = contentType;
-        info.ownerId = ownerId;
-        info.uploadDate = uploadDate;
-        info.isPublic = isPublic;
-        
+        // The body itself is streamed by the caller from getFilePath(info)
+        info = metadata;
         return true;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "File download failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "File download failed: " << ex.displayText();
         return false;
     }
 }
 
 
-std::vector<FileInfo> FileManager::getUserFiles(int userId) {
-    std::vector<FileInfo> files;
+size_t FileManager::getListPageSize(long requested) {
+    static const long defaultSize = std::max(1L, Config::getInt("DFS_LIST_PAGE_SIZE", 100));
+    static const long maxSize = std::max(defaultSize, Config::getInt("DFS_LIST_MAX_PAGE_SIZE", 1000));
+    
+    if (requested <= 0) return static_cast<size_t>(defaultSize);
+    return static_cast<size_t>(std::min(requested, maxSize));
+}
+
+bool FileManager::parseListCursor(const std::string& text, FileListCursor& cursor) {
+    // "<file_id>.<YYYYMMDDhhmmssuuuuuu>": URL-safe, and opaque enough for clients
+    std::string::size_type dot = text.find('.');
+    if (dot == std::string::npos || dot == 0 || dot > 10 || text.size() - dot - 1 != 20) return false;
+    
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (i != dot && (text[i] < '0' || text[i] > '9')) return false;
+    }
+    
+    long fileId = std::stol(text.substr(0, dot));
+    if (fileId <= 0 || fileId > INT32_MAX) return false;
+    
+    const std::string digits = text.substr(dot + 1);
+    cursor.fileId = static_cast<int>(fileId);
+    cursor.uploadDate = digits.substr(0, 4) + "-" + digits.substr(4, 2) + "-" + digits.substr(6, 2) + " " + 
+                        digits.substr(8, 2) + ":" + digits.substr(10, 2) + ":" + digits.substr(12, 2) + "." + 
+                        digits.substr(14, 6);
+    return true;
+}
+
+bool FileManager::listUserFiles(int userId, const FileListCursor* after, size_t limit, 
+                                const std::function<void(const FileInfo&)>& visit, std::string& nextCursor) {
+    nextCursor.clear();
     
     try {
         auto session = Database::getInstance().getSession();
         
-        // Use individual variables instead of RecordSet
-        std::vector<int> fileIds;
-        std::vector<std::string> filenames;
-        std::vector<std::string> originalFilenames;
-        std::vector<long> fileSizes;
-        std::vector<std::string> contentTypes;
-        std::vector<int> ownerIds;
-        std::vector<std::string> uploadDates;
-        std::vector<bool> isPublicFlags;
+        // One row of bindings, refilled per fetch, so memory does not grow with the page
+        FileInfo info;
+        std::string position;
+        int ownerId = userId;
+        int fetchLimit = static_cast<int>(limit) + 1;  // The extra row only says whether a next page exists
+        int cursorId = after ? after->fileId : 0;
+        std::string cursorDate = after ? after->uploadDate : "";
         
         Poco::Data::Statement select(session);
-        select << "SELECT file_id, filename, original_filename, file_size, content_type, owner_id, upload_date, is_public "
-                  "FROM files WHERE owner_id = $1 ORDER BY upload_date DESC",  // ← Fixed: $1 instead of ?
-            use(userId), 
-            into(fileIds), into(filenames), into(originalFilenames), into(fileSizes),
-            into(contentTypes), into(ownerIds), into(uploadDates), into(isPublicFlags);
-        select.execute();
+        if (after) {
+            select << "SELECT file_id, filename, original_filename, file_size, content_type, owner_id, upload_date, is_public, "
+                      "to_char(upload_date, 'YYYYMMDDHH24MISSUS') FROM files "
+                      "WHERE owner_id = $1 AND (upload_date, file_id) < ($2::timestamp, $3) "
+                      "ORDER BY upload_date DESC, file_id DESC LIMIT $4",
+                use(ownerId), use(cursorDate), use(cursorId), use(fetchLimit), 
+                into(info.fileId), into(info.filename), into(info.originalFilename), into(info.fileSize), 
+                into(info.contentType), into(info.ownerId), into(info.uploadDate), into(info.isPublic), 
+                into(position), range(0, 1);
+        } else {
+            select << "SELECT file_id, filename, original_filename, file_size, content_type, owner_id, upload_date, is_public, "
+                      "to_char(upload_date, 'YYYYMMDDHH24MISSUS') FROM files "
+                      "WHERE owner_id = $1 ORDER BY upload_date DESC, file_id DESC LIMIT $2",
+                use(ownerId), use(fetchLimit), 
+                into(info.fileId), into(info.filename), into(info.originalFilename), into(info.fileSize), 
+                into(info.contentType), into(info.ownerId), into(info.uploadDate), into(info.isPublic), 
+                into(position), range(0, 1);
+        }
         
-        // Create FileInfo objects from vectors
-        for (size_t i = 0; i < fileIds.size(); ++i) {
-            FileInfo info;
-            info.fileId = fileIds[i];
-            info.filename = filenames[i];
-            info.originalFilename = originalFilenames[i];
-            info.fileSize = fileSizes[i];
-            info.contentType = contentTypes[i];
-            info.ownerId = ownerIds[i];
-            info.uploadDate = uploadDates[i];
-            info.isPublic = isPublicFlags[i];
-            files.push_back(info);
+        size_t visited = 0;
+        std::string lastPosition;
+        while (!select.done()) {
+            size_t fetched;
+            if (visited == 0) {
+                // The first fetch runs the query; later ones only step through its result
+                static Histogram& latency = Metrics::getInstance().dbStatement("list_files");
+                ScopedTimer timer(latency);
+                fetched = select.execute();
+            } else {
+                fetched = select.execute();
+            }
+            if (fetched == 0) break;
+            
+            if (visited == limit) {
+                nextCursor = lastPosition;
+                break;
+            }
+            visit(info);
+            lastPosition = std::to_string(info.fileId) + "." + position;
+            ++visited;
         }
+        return true;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "Get user files failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "Listing files failed: " << ex.displayText();
+        return false;
     }
-    
-    return files;
 }
 
 std::string FileManager::shareFile(int fileId, int ownerId, int sharedWithUserId, const std::string& expiryHours) {
@@ -233,8 +639,8 @@ std::string FileManager::shareFile(int fileId, int ownerId, int sharedWithUserId
             existingCheck.execute();
             
             if (!existingToken.empty()) {
-                std::cout << "File " << fileId << " already shared with user " << sharedWithUserId 
-                         << ". Returning existing token." << std::endl;
+                DFS_LOG_INFO << "File " << fileId << " already shared with user " << sharedWithUserId 
+                            << ". Returning existing token.";
                 return existingToken;  // Return existing share token for THIS file
             }
         }
@@ -259,11 +665,17 @@ std::string FileManager::shareFile(int fileId, int ownerId, int sharedWithUserId
         }
         insert.execute();
         
-        std::cout << "Created new share for file " << fileId << " to user " << sharedWithUserId << std::endl;
+        // A cached denial for this recipient is now wrong, and so is their listing
+        if (sharedWithUserId > 0) {
+            MetadataCache::getInstance().invalidateShareGrant(fileId, sharedWithUserId);
+            MetadataCache::getInstance().bumpListingVersion(MetadataCache::LISTING_SHARED_WITH_ME, sharedWithUserId);
+        }
+        
+        DFS_LOG_INFO << "Created new share for file " << fileId << " to user " << sharedWithUserId;
         return shareToken;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "File sharing failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "File sharing failed: " << ex.displayText();
         return "";
     }
 }
@@ -271,36 +683,49 @@ std::string FileManager::shareFile(int fileId, int ownerId, int sharedWithUserId
 
 bool FileManager::accessSharedFile(const std::string& shareToken, 
                                    int requesterId,           // ← NEW PARAMETER
-                                   std::string& content, 
                                    FileInfo& info) {
     try {
-        auto session = Database::getInstance().getSession();
-        
-        // Get file info from share token
-        int fileId = 0;          // Initialize to 0
-        int sharedWith = 0;      // ← NEW: Get shared_with column
-        std::string token = shareToken;
+        ShareTokenInfo share;
+        MetadataCache& cache = MetadataCache::getInstance();
         
-        Poco::Data::Statement select(session);
-        select << "SELECT fs.file_id, COALESCE(fs.shared_with, 0) "
-                  "FROM file_shares fs WHERE fs.share_token = $1 AND "
-                  "(fs.expires_at IS NULL OR fs.expires_at > CURRENT_TIMESTAMP)",
-            use(token), into(fileId), into(sharedWith), limit(1);  // ← Get both values
-        select.execute();
+        if (!cache.getShareToken(shareToken, share)) {
+            uint64_t generation = cache.getGeneration();
+            // Scoped so the connection is back in the pool before downloadFile takes one
+            auto session = Database::getInstance().getSession();
+            
+            // Get file info from share token
+            ShareTokenLookup& select = session.prepared<ShareTokenLookup>("share_token");
+            select.token = shareToken;
+            select.fileId = 0;
+            select.sharedWith = 0;
+            {
+                static Histogram& latency = Metrics::getInstance().dbStatement("share_token");
+                ScopedTimer timer(latency);
+                select.statement.execute();
+            }
+            
+            if (select.fileId == 0) return false;  // No such token or expired
+            
+            share.fileId = select.fileId;
+            share.sharedWith = select.sharedWith;  // ← NEW: Get shared_with column
+            share.expiresAt = select.expiresAt.timestamp();
+            cache.putShareToken(shareToken, share, generation);
+        }
         
-        if (fileId == 0) return false;  // No such token or expired
+        int fileId = share.fileId;
+        int sharedWith = share.sharedWith;
         
         // ← NEW: Check user-specific sharing permissions
         if (sharedWith > 0 && sharedWith != requesterId) {
-            std::cerr << "Share is private and not accessible to user " << requesterId << std::endl;
+            DFS_LOG_WARN << "Share is private and not accessible to user " << requesterId;
             return false;
         }
         
-        // Get file details and content
-        return downloadFile(fileId, requesterId, content, info);  // ← Pass actual requesterId
+        // Get file details and check access
+        return downloadFile(fileId, requesterId, info);  // ← Pass actual requesterId
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "Shared file access failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "Shared file access failed: " << ex.displayText();
         return false;
     }
 }
@@ -309,33 +734,68 @@ bool FileManager::accessSharedFile(const std::string& shareToken,
 bool FileManager::deleteFile(int fileId, int ownerId) {
     try {
         auto session = Database::getInstance().getSession();
+        session.begin();
         
-        // Get filename before deletion
-        std::string filename;
-        Poco::Data::Statement getFile(session);
-        getFile << "SELECT filename FROM files WHERE file_id = $1 AND owner_id = $2",  // ← Fixed: $1, $2 instead of ?
-            use(fileId), use(ownerId), into(filename), limit(1);
-        getFile.execute();
-        
-        if (filename.empty()) return false;
-        
-        // Delete from database
-        Poco::Data::Statement deleteStmt(session);
-        deleteStmt << "DELETE FROM files WHERE file_id = $1 AND owner_id = $2",  // ← Fixed: $1, $2 instead of ?
-            use(fileId), use(ownerId);
-        deleteStmt.execute();
-        
-        // Delete file from disk
-        std::string fullPath = getUploadsDirectory() + filename;
-        Poco::File file(fullPath);
-        if (file.exists()) {
-            file.remove();
+        try {
+            // Get filename before deletion
+            std::string filename;
+            Poco::Data::Statement getFile(session);
+            getFile << "SELECT filename FROM files WHERE file_id = $1 AND owner_id = $2",  // ← Fixed: $1, $2 instead of ?
+                use(fileId), use(ownerId), into(filename), limit(1);
+            getFile.execute();
+            
+            if (filename.empty()) {
+                session.rollback();
+                return false;
+            }
+            
+            // Shares reference the file, so they go first in the same transaction
+            Poco::Data::Statement deleteShares(session);
+            deleteShares << "DELETE FROM file_shares WHERE file_id = $1",
+                use(fileId);
+            deleteShares.execute();
+            
+            // Delete from database
+            Poco::Data::Statement deleteStmt(session);
+            deleteStmt << "DELETE FROM files WHERE file_id = $1 AND owner_id = $2",  // ← Fixed: $1, $2 instead of ?
+                use(fileId), use(ownerId);
+            deleteStmt.execute();
+            
+            // Shared blobs are only unlinked when their last reference goes away;
+            // files stored before deduplication have no blob row and are always unlinked
+            bool lastReference = true;
+            std::string contentHash = BlobStore::getHashFromFilename(filename);
+            if (!contentHash.empty()) {
+                BlobStore::releaseReference(session, contentHash, lastReference);
+            }
+            
+            session.commit();
+            
+            // Only once the rows are gone for good: a failed commit must not lose the bytes
+            if (lastReference) {
+                bool removed = contentHash.empty();
+                if (removed) removeFromDisk(filename);
+                else removed = !BlobStore::purgeUnreferenced(std::vector<std::string>(1, contentHash), 
+                                   [&filename](const std::string&) { removeFromDisk(filename); }).empty();
+                // Another node may hold the only copy
+                if (removed) Cluster::getInstance().scheduleRemoval(filename);
+            }
+            
+            MetadataCache& cache = MetadataCache::getInstance();
+            cache.invalidateFile(fileId);
+            cache.invalidateFileShares(fileId);
+            cache.bumpListingVersion(MetadataCache::LISTING_FILES, ownerId);
+            // Recipients are not known here, and deletes are rare
+            cache.bumpAllListingVersions(MetadataCache::LISTING_SHARED_WITH_ME);
+            return true;
+        }
+        catch (...) {
+            if (session.isTransaction()) session.rollback();
+            throw;
         }
-        
-        return true;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "File deletion failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "File deletion failed: " << ex.displayText();
         return false;
     }
 }
@@ -349,10 +809,459 @@ bool FileManager::setFilePublic(int fileId, int ownerId, bool isPublic) {
             use(isPublic), use(fileId), use(ownerId);
         update.execute();
         
+        MetadataCache::getInstance().invalidateFile(fileId);
+        MetadataCache::getInstance().bumpListingVersion(MetadataCache::LISTING_FILES, ownerId);
+        
         return true;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "Set file public failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "Set file public failed: " << ex.displayText();
         return false;
     }
 }
+
+long FileManager::purgeExpiredShares(int limit) {
+    try {
+        auto session = Database::getInstance().getSession();
+        
+        Poco::Data::Statement purge(session);
+        purge << "DELETE FROM file_shares WHERE share_id IN "
+                 "(SELECT share_id FROM file_shares WHERE expires_at < CURRENT_TIMESTAMP LIMIT $1)",
+            use(limit);
+        return static_cast<long>(purge.execute());
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Share cleanup failed: " << ex.displayText();
+        return -1;
+    }
+}
+
+size_t FileManager::getMaxBatchItems() {
+    static const size_t maxItems = [] {
+        long configured = Config::getInt("DFS_BATCH_MAX_ITEMS", 1000);
+        return static_cast<size_t>(configured < 1 ? 1 : configured);
+    }();
+    return maxItems;
+}
+
+bool FileManager::stageUpload(std::istream& content, const std::string& originalFilename, 
+                              const std::string& contentType, StagedUpload& staged) {
+    // Parts of one batch can share a name and arrive within the same microsecond
+    staged.tempFilename = "." + Utils::generateUploadId() + ".part";
+    staged.originalFilename = originalFilename;
+    staged.contentType = contentType;
+    staged.fileSize = 0;
+    staged.contentHash.clear();
+    
+    // Multipart parts carry no length of their own; a truncated body loses its closing boundary
+    return saveStreamToDisk(staged.tempFilename, content, -1, staged.fileSize, staged.contentHash);
+}
+
+void FileManager::discardStagedUploads(const std::vector<StagedUpload>& uploads) {
+    for (const auto& upload : uploads) {
+        removeStagedFile(upload.tempFilename);
+    }
+}
+
+std::vector<BatchResult> FileManager::commitUploads(const std::vector<StagedUpload>& uploads, int ownerId) {
+    std::vector<BatchResult> results(uploads.size(), BatchResult{0, false, "", "Upload failed"});
+    if (uploads.empty()) return results;
+    
+    // One blob row per distinct body; repeats within the batch add to its count
+    std::map<std::string, int> references;
+    std::vector<std::string> hashes;
+    std::vector<long> blobSizes;
+    for (const auto& upload : uploads) {
+        if (references[upload.contentHash]++ == 0) {
+            hashes.push_back(upload.contentHash);
+            blobSizes.push_back(upload.fileSize);
+        }
+    }
+    std::vector<int> counts;
+    for (const auto& hash : hashes) counts.push_back(references[hash]);
+    
+    std::vector<std::string> filenames, originalNames, paths, contentTypes;
+    std::vector<long> sizes;
+    for (const auto& upload : uploads) {
+        std::string blobFilename = BlobStore::getBlobFilename(upload.contentHash);
+        filenames.push_back(blobFilename);
+        originalNames.push_back(upload.originalFilename);
+        paths.push_back(StorageBackend::getInstance().getPrimaryPath(blobFilename));
+        contentTypes.push_back(upload.contentType);
+        sizes.push_back(upload.fileSize);
+    }
+    
+    std::set<std::string> createdBlobs;
+    std::vector<bool> moved(uploads.size(), false);
+    std::vector<bool> chunked(uploads.size(), false);
+    std::vector<int> fileIds;
+    
+    try {
+        auto session = Database::getInstance().getSession();
+        session.begin();
+        
+        try {
+            std::string hashArray = Utils::toPostgresArray(hashes);
+            std::string sizeArray = Utils::toPostgresArray(blobSizes);
+            std::string countArray = Utils::toPostgresArray(counts);
+            std::vector<std::string> returnedHashes;
+            std::vector<int> refCounts;
+            
+            Poco::Data::Statement upsert(session);
+            upsert << "INSERT INTO blobs (blob_hash, file_size, ref_count) "
+                      "SELECT * FROM unnest($1::text[], $2::bigint[], $3::int[]) "
+                      "ON CONFLICT (blob_hash) DO UPDATE SET ref_count = blobs.ref_count + EXCLUDED.ref_count "
+                      "RETURNING blob_hash, ref_count",
+                use(hashArray), use(sizeArray), use(countArray), into(returnedHashes), into(refCounts);
+            {
+                static Histogram& latency = Metrics::getInstance().dbStatement("batch_add_blobs");
+                ScopedTimer timer(latency);
+                upsert.execute();
+            }
+            
+            // A blob is new when its count is exactly what this batch contributed
+            for (size_t i = 0; i < returnedHashes.size(); ++i) {
+                if (refCounts[i] == references[returnedHashes[i]]) {
+                    createdBlobs.insert(returnedHashes[i]);
+                }
+            }
+            
+            std::set<std::string> placed;
+            std::vector<std::string> stored;
+            for (size_t i = 0; i < uploads.size(); ++i) {
+                const std::string& hash = uploads[i].contentHash;
+                if (createdBlobs.count(hash) && placed.insert(hash).second) {
+                    // The staged file belongs to the backend even if this throws
+                    moved[i] = true;
+                    chunked[i] = storeBlob(uploads[i].tempFilename, filenames[i], uploads[i].fileSize);
+                    stored.push_back(filenames[i]);
+                }
+            }
+            Cluster::getInstance().recordLocations(session, stored);
+            
+            std::string filenameArray = Utils::toPostgresArray(filenames);
+            std::string originalArray = Utils::toPostgresArray(originalNames);
+            std::string pathArray = Utils::toPostgresArray(paths);
+            std::string fileSizeArray = Utils::toPostgresArray(sizes);
+            std::string typeArray = Utils::toPostgresArray(contentTypes);
+            
+            // Rows are inserted, and returned, in array order
+            Poco::Data::Statement insert(session);
+            insert << "INSERT INTO files (filename, original_filename, file_path, file_size, content_type, owner_id) "
+                      "SELECT f, o, p, s, c, $6 FROM unnest($1::text[], $2::text[], $3::text[], $4::bigint[], $5::text[]) "
+                      "WITH ORDINALITY AS u(f, o, p, s, c, n) ORDER BY n "
+                      "RETURNING file_id",
+                use(filenameArray), use(originalArray), use(pathArray), use(fileSizeArray), 
+                use(typeArray), use(ownerId), into(fileIds);
+            {
+                static Histogram& latency = Metrics::getInstance().dbStatement("batch_insert_files");
+                ScopedTimer timer(latency);
+                insert.execute();
+            }
+            
+            if (fileIds.size() != uploads.size()) {
+                throw Poco::Data::DataException("Batch insert returned " + std::to_string(fileIds.size()) + 
+                                                " of " + std::to_string(uploads.size()) + " rows");
+            }
+            
+            session.commit();
+        }
+        catch (...) {
+            if (session.isTransaction()) session.rollback();
+            throw;
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Batch upload failed: " << ex.displayText();
+        
+        for (size_t i = 0; i < uploads.size(); ++i) {
+            if (moved[i]) removeFromDisk(filenames[i]);
+            else removeStagedFile(uploads[i].tempFilename);
+        }
+        return results;
+    }
+    
+    for (size_t i = 0; i < uploads.size(); ++i) {
+        // Duplicate content: the freshly written copy is not needed
+        if (!moved[i]) removeStagedFile(uploads[i].tempFilename);
+        else if (!chunked[i]) Compression::getInstance().scheduleSidecars(resolveStoredPath(filenames[i]), contentTypes[i], 
+                                                         static_cast<Poco::UInt64>(sizes[i]));
+        results[i] = BatchResult{fileIds[i], true, "", ""};
+    }
+    
+    MetadataCache::getInstance().bumpListingVersion(MetadataCache::LISTING_FILES, ownerId);
+    DFS_LOG_INFO << "Batch uploaded " << uploads.size() << " files (" << createdBlobs.size() << " new blobs)";
+    return results;
+}
+
+std::vector<BatchResult> FileManager::deleteFiles(const std::vector<int>& fileIds, int ownerId) {
+    std::vector<BatchResult> results;
+    if (fileIds.empty()) return results;
+    
+    std::vector<int> deletedIds;
+    std::vector<std::string> deletedFilenames;
+    std::vector<std::string> unlink;
+    std::vector<std::string> emptied;
+    
+    try {
+        auto session = Database::getInstance().getSession();
+        session.begin();
+        
+        try {
+            std::string idArray = Utils::toPostgresArray(fileIds);
+            
+            // Shares reference their file, so a shared file can only go once they have
+            Poco::Data::Statement removeShares(session);
+            removeShares << "DELETE FROM file_shares WHERE file_id IN "
+                            "(SELECT file_id FROM files WHERE owner_id = $1 AND file_id = ANY($2::int[]))",
+                use(ownerId), use(idArray);
+            {
+                static Histogram& latency = Metrics::getInstance().dbStatement("batch_delete_shares");
+                ScopedTimer timer(latency);
+                removeShares.execute();
+            }
+            
+            Poco::Data::Statement remove(session);
+            remove << "DELETE FROM files WHERE owner_id = $1 AND file_id = ANY($2::int[]) "
+                      "RETURNING file_id, filename",
+                use(ownerId), use(idArray), into(deletedIds), into(deletedFilenames);
+            {
+                static Histogram& latency = Metrics::getInstance().dbStatement("batch_delete_files");
+                ScopedTimer timer(latency);
+                remove.execute();
+            }
+            
+            // Files stored before deduplication have no blob row and are always unlinked
+            std::map<std::string, int> releases;
+            for (const auto& filename : deletedFilenames) {
+                std::string contentHash = BlobStore::getHashFromFilename(filename);
+                if (contentHash.empty()) unlink.push_back(filename);
+                else releases[contentHash]++;
+            }
+            
+            if (!releases.empty()) {
+                std::vector<std::string> hashes;
+                std::vector<int> counts;
+                for (const auto& release : releases) {
+                    hashes.push_back(release.first);
+                    counts.push_back(release.second);
+                }
+                
+                std::string hashArray = Utils::toPostgresArray(hashes);
+                std::string countArray = Utils::toPostgresArray(counts);
+                std::vector<std::string> releasedHashes;
+                std::vector<int> refCounts;
+                
+                Poco::Data::Statement release(session);
+                release << "UPDATE blobs b SET ref_count = b.ref_count - d.n "
+                           "FROM unnest($1::text[], $2::int[]) AS d(h, n) WHERE b.blob_hash = d.h "
+                           "RETURNING b.blob_hash, b.ref_count",
+                    use(hashArray), use(countArray), into(releasedHashes), into(refCounts);
+                {
+                    static Histogram& latency = Metrics::getInstance().dbStatement("batch_release_blobs");
+                    ScopedTimer timer(latency);
+                    release.execute();
+                }
+                
+                // Rows left at zero are dropped after commit, as in BlobStore::releaseReference
+                for (size_t i = 0; i < releasedHashes.size(); ++i) {
+                    if (refCounts[i] <= 0) emptied.push_back(releasedHashes[i]);
+                }
+            }
+            
+            session.commit();
+        }
+        catch (...) {
+            if (session.isTransaction()) session.rollback();
+            throw;
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Batch deletion failed: " << ex.displayText();
+        for (int fileId : fileIds) results.push_back(BatchResult{fileId, false, "", "Delete failed"});
+        return results;
+    }
+    
+    // Only once the rows are gone for good: a failed commit must not lose the bytes
+    for (const auto& filename : unlink) removeFromDisk(filename);
+    for (const auto& hash : BlobStore::purgeUnreferenced(emptied, [](const std::string& purgedHash) {
+             removeFromDisk(BlobStore::getBlobFilename(purgedHash));
+         })) {
+        unlink.push_back(BlobStore::getBlobFilename(hash));
+    }
+    for (const auto& filename : unlink) {
+        // Another node may hold the only copy
+        Cluster::getInstance().scheduleRemoval(filename);
+    }
+    
+    std::set<int> deleted(deletedIds.begin(), deletedIds.end());
+    MetadataCache& cache = MetadataCache::getInstance();
+    for (int fileId : deleted) {
+        cache.invalidateFile(fileId);
+        cache.invalidateFileShares(fileId);
+    }
+    if (!deleted.empty()) {
+        cache.bumpListingVersion(MetadataCache::LISTING_FILES, ownerId);
+        cache.bumpAllListingVersions(MetadataCache::LISTING_SHARED_WITH_ME);
+    }
+    
+    for (int fileId : fileIds) {
+        bool success = deleted.count(fileId) > 0;
+        results.push_back(BatchResult{fileId, success, "", success ? "" : "File not found or access denied"});
+    }
+    return results;
+}
+
+std::vector<BatchResult> FileManager::setFilesPublic(const std::vector<int>& fileIds, int ownerId, bool isPublic) {
+    std::vector<BatchResult> results;
+    if (fileIds.empty()) return results;
+    
+    std::vector<int> updatedIds;
+    try {
+        auto session = Database::getInstance().getSession();
+        
+        std::string idArray = Utils::toPostgresArray(fileIds);
+        Poco::Data::Statement update(session);
+        update << "UPDATE files SET is_public = $1 WHERE owner_id = $2 AND file_id = ANY($3::int[]) "
+                  "RETURNING file_id",
+            use(isPublic), use(ownerId), use(idArray), into(updatedIds);
+        {
+            static Histogram& latency = Metrics::getInstance().dbStatement("batch_set_public");
+            ScopedTimer timer(latency);
+            update.execute();
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Batch visibility update failed: " << ex.displayText();
+        for (int fileId : fileIds) results.push_back(BatchResult{fileId, false, "", "Update failed"});
+        return results;
+    }
+    
+    std::set<int> updated(updatedIds.begin(), updatedIds.end());
+    MetadataCache& cache = MetadataCache::getInstance();
+    for (int fileId : updated) cache.invalidateFile(fileId);
+    if (!updated.empty()) cache.bumpListingVersion(MetadataCache::LISTING_FILES, ownerId);
+    
+    for (int fileId : fileIds) {
+        bool success = updated.count(fileId) > 0;
+        results.push_back(BatchResult{fileId, success, "", success ? "" : "File not found or access denied"});
+    }
+    return results;
+}
+
+std::vector<BatchResult> FileManager::shareFiles(const std::vector<ShareSpec>& shares, int ownerId) {
+    std::vector<BatchResult> results;
+    if (shares.empty()) return results;
+    
+    std::vector<int> requestedIds;
+    for (const auto& share : shares) requestedIds.push_back(share.fileId);
+    
+    std::vector<int> grantFileIds, grantUserIds;
+    
+    try {
+        auto session = Database::getInstance().getSession();
+        session.begin();
+        
+        try {
+            std::string idArray = Utils::toPostgresArray(requestedIds);
+            
+            std::vector<int> ownedIds;
+            Poco::Data::Statement ownerCheck(session);
+            ownerCheck << "SELECT file_id FROM files WHERE owner_id = $1 AND file_id = ANY($2::int[])",
+                use(ownerId), use(idArray), into(ownedIds);
+            ownerCheck.execute();
+            std::set<int> owned(ownedIds.begin(), ownedIds.end());
+            
+            // Live user-specific shares are reused, as shareFile does for single files
+            std::vector<int> existingFileIds, existingUserIds;
+            std::vector<std::string> existingTokens;
+            Poco::Data::Statement existingCheck(session);
+            existingCheck << "SELECT DISTINCT ON (file_id, shared_with) file_id, shared_with, share_token "
+                             "FROM file_shares WHERE file_id = ANY($1::int[]) AND shared_with IS NOT NULL "
+                             "AND (expires_at IS NULL OR expires_at > CURRENT_TIMESTAMP)",
+                use(idArray), into(existingFileIds), into(existingUserIds), into(existingTokens);
+            existingCheck.execute();
+            
+            std::map<std::pair<int, int>, std::string> tokens;
+            for (size_t i = 0; i < existingFileIds.size(); ++i) {
+                tokens[std::make_pair(existingFileIds[i], existingUserIds[i])] = existingTokens[i];
+            }
+            
+            std::vector<int> insertFileIds, insertUserIds;
+            std::vector<std::string> insertTokens, insertExpiries;
+            
+            for (const auto& share : shares) {
+                if (!owned.count(share.fileId)) {
+                    results.push_back(BatchResult{share.fileId, false, "", "File not found or access denied"});
+                    continue;
+                }
+                if (share.expiryHours <= 0) {
+                    results.push_back(BatchResult{share.fileId, false, "", "Invalid expiry_hours"});
+                    continue;
+                }
+                
+                std::pair<int, int> key(share.fileId, share.sharedWithUserId);
+                if (share.sharedWithUserId > 0) {
+                    auto existing = tokens.find(key);
+                    if (existing != tokens.end()) {
+                        results.push_back(BatchResult{share.fileId, true, existing->second, ""});
+                        continue;
+                    }
+                }
+                
+                std::string shareToken = Utils::generateShareToken();
+                Poco::DateTime expiry;
+                expiry += Poco::Timespan(0, share.expiryHours, 0, 0, 0);
+                
+                insertFileIds.push_back(share.fileId);
+                insertUserIds.push_back(share.sharedWithUserId);
+                insertTokens.push_back(shareToken);
+                insertExpiries.push_back(Poco::DateTimeFormatter::format(expiry, "%Y-%m-%d %H:%M:%S"));
+                if (share.sharedWithUserId > 0) {
+                    tokens[key] = shareToken;
+                    grantFileIds.push_back(share.fileId);
+                    grantUserIds.push_back(share.sharedWithUserId);
+                }
+                results.push_back(BatchResult{share.fileId, true, shareToken, ""});
+            }
+            
+            if (!insertFileIds.empty()) {
+                std::string fileArray = Utils::toPostgresArray(insertFileIds);
+                std::string userArray = Utils::toPostgresArray(insertUserIds);
+                std::string tokenArray = Utils::toPostgresArray(insertTokens);
+                std::string expiryArray = Utils::toPostgresArray(insertExpiries);
+                
+                Poco::Data::Statement insert(session);
+                insert << "INSERT INTO file_shares (file_id, shared_by, shared_with, share_token, expires_at) "
+                          "SELECT f, $1, NULLIF(w, 0), t, e "
+                          "FROM unnest($2::int[], $3::int[], $4::text[], $5::timestamp[]) AS s(f, w, t, e)",
+                    use(ownerId), use(fileArray), use(userArray), use(tokenArray), use(expiryArray);
+                {
+                    static Histogram& latency = Metrics::getInstance().dbStatement("batch_insert_shares");
+                    ScopedTimer timer(latency);
+                    insert.execute();
+                }
+            }
+            
+            session.commit();
+        }
+        catch (...) {
+            if (session.isTransaction()) session.rollback();
+            throw;
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Batch sharing failed: " << ex.displayText();
+        results.clear();
+        for (const auto& share : shares) results.push_back(BatchResult{share.fileId, false, "", "Share failed"});
+        return results;
+    }
+    
+    // Cached denials for these recipients are now wrong, and so are their listings
+    MetadataCache& cache = MetadataCache::getInstance();
+    for (size_t i = 0; i < grantFileIds.size(); ++i) {
+        cache.invalidateShareGrant(grantFileIds[i], grantUserIds[i]);
+        cache.bumpListingVersion(MetadataCache::LISTING_SHARED_WITH_ME, grantUserIds[i]);
+    }
+    return results;
+}
@@ -3,6 +3,11 @@
 
 #include <string>
 #include <vector>
+#include <istream>
+#include <functional>
+#include <set>
+
+namespace Poco { namespace Data { class Session; } }
 
 struct FileInfo {
     int fileId;
@@ -15,22 +20,109 @@ struct FileInfo {
     bool isPublic;
 };
 
+// Position in a user's listing, which is ordered by (upload_date, file_id) descending
+struct FileListCursor {
+    int fileId;
+    std::string uploadDate;  // As text PostgreSQL parses back exactly
+};
+
+// Outcome of one item of a batch request, reported in request order
+struct BatchResult {
+    int fileId;
+    bool success;
+    std::string shareToken;
+    std::string error;
+};
+
+struct ShareSpec {
+    int fileId;
+    int sharedWithUserId;  // 0 for a public link
+    int expiryHours;
+};
+
+// A body already streamed to a temp file in the uploads directory, not yet recorded
+struct StagedUpload {
+    std::string tempFilename;
+    std::string originalFilename;
+    std::string contentType;
+    long fileSize;
+    std::string contentHash;
+};
+
 class FileManager {
 public:
-    static int uploadFile(const std::string& filename, const std::string& content, 
-                         const std::string& contentType, int ownerId);
-    static bool downloadFile(int fileId, int requesterId, std::string& content, FileInfo& info);
+    // expectedSize is the declared body length, -1 when unknown; a shorter body is
+    // rejected. expectedHash is an optional client-supplied SHA-256; if it names a
+    // stored blob the body is only verified, never written
+    static int uploadFile(const std::string& filename, std::istream& content, 
+                         const std::string& contentType, int ownerId, long expectedSize,
+                         const std::string& expectedHash = "");
+    // Records a fully written temp file in the uploads directory, deduplicating it
+    // against existing blobs. An empty tempFilename references an existing blob.
+    // claim, if given, runs first in the same transaction; false from it abandons the commit.
+    static int commitUpload(const std::string& tempFilename, const std::string& originalFilename, 
+                           const std::string& contentType, int ownerId, long fileSize, 
+                           const std::string& contentHash = "",
+                           const std::function<bool(Poco::Data::Session&)>& claim = nullptr);
+    static bool downloadFile(int fileId, int requesterId, FileInfo& info);
     static bool deleteFile(int fileId, int ownerId);
-    static std::vector<FileInfo> getUserFiles(int userId);
+    // Visits up to limit of the user's files after the cursor (or from the newest), one row
+    // at a time. nextCursor is left empty on the last page. False on a database error.
+    static bool listUserFiles(int userId, const FileListCursor* after, size_t limit, 
+                             const std::function<void(const FileInfo&)>& visit, std::string& nextCursor);
+    static bool parseListCursor(const std::string& text, FileListCursor& cursor);
+    static size_t getListPageSize(long requested);
     static std::string shareFile(int fileId, int ownerId, int sharedWithUserId = 0, 
                                 const std::string& expiryHours = "24");
-    static bool accessSharedFile(const std::string& shareToken, int requesterId, std::string& content, FileInfo& info);
+    static bool accessSharedFile(const std::string& shareToken, int requesterId, FileInfo& info);
     static bool setFilePublic(int fileId, int ownerId, bool isPublic);
+    // Deletes up to limit expired shares; how many went, or -1 on failure
+    static long purgeExpiredShares(int limit);
+    static std::string getFilePath(const FileInfo& info);
+    // Strong validator for the stored bytes, derived from metadata alone
+    static std::string getETag(const FileInfo& info);
+    // Where uploads are written before the storage backend takes them
+    static std::string getUploadsDirectory();
+    // Location of a stored file under the two-level fan-out layout
+    static std::string getFanoutFilename(const std::string& filename);
+    // Finds a stored file under either layout, so serving continues during migration
+    static std::string resolveStoredPath(const std::string& filename);
+    // Renames within the uploads directory, creating fan-out directories as needed
+    static void moveIntoStore(const std::string& fromPath, const std::string& toPath);
+    static size_t getUploadBufferSize();
+    // True when this node holds the stored file, under either layout or chunked
+    static bool hasStoredCopy(const std::string& filename);
+    // Removes this node's copy of a stored file
+    static void removeFromDisk(const std::string& filename);
+    // True while a files row still names the stored file, and when that cannot be checked
+    static bool isReferenced(const std::string& filename);
+    // Adds to referenced each of the names a files row still names; false on a database error
+    static bool findReferenced(const std::vector<std::string>& filenames, std::set<std::string>& referenced);
+    // Stores a copy of a file another node pushed; blob names are checked against their hash
+    static bool importStoredFile(const std::string& filename, std::istream& content, long expectedSize);
+    
+    // Batch operations: each runs in one transaction with multi-row statements and
+    // returns one result per input item
+    static bool stageUpload(std::istream& content, const std::string& originalFilename, 
+                           const std::string& contentType, StagedUpload& staged);
+    static void discardStagedUploads(const std::vector<StagedUpload>& uploads);
+    static std::vector<BatchResult> commitUploads(const std::vector<StagedUpload>& uploads, int ownerId);
+    static std::vector<BatchResult> deleteFiles(const std::vector<int>& fileIds, int ownerId);
+    static std::vector<BatchResult> setFilesPublic(const std::vector<int>& fileIds, int ownerId, bool isPublic);
+    static std::vector<BatchResult> shareFiles(const std::vector<ShareSpec>& shares, int ownerId);
+    static size_t getMaxBatchItems();
     
 private:
-    static std::string getUploadsDirectory();
-    static bool saveFileToDisk(const std::string& filename, const std::string& content);
-    static bool loadFileFromDisk(const std::string& filename, std::string& content);
+    // Fails unless exactly expectedSize bytes arrived (any number when it is -1)
+    static bool saveStreamToDisk(const std::string& tempFilename, std::istream& content, long expectedSize,
+                                long& bytesWritten, std::string& contentHash);
+    static void removeStagedFile(const std::string& tempFilename);
+    // Hands a staged upload to the chunk store or the storage backend; true if it was chunked
+    static bool storeBlob(const std::string& tempFilename, const std::string& blobFilename, long fileSize);
+    // The same file's name under the other (flat or fan-out) layout
+    static std::string getAlternateFilename(const std::string& filename);
+    static bool loadFileMetadata(int fileId, FileInfo& info);
+    static bool isSharedWith(int fileId, int userId);
 };
 
 #endif
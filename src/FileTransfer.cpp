@@ -0,0 +1,230 @@
+#include "FileTransfer.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include <Poco/Net/HTTPServerRequestImpl.h>
+#include <Poco/Net/StreamSocket.h>
+#include <Poco/Net/SocketImpl.h>
+#include <Poco/NumberParser.h>
+#include <Poco/String.h>
+#include <Poco/StringTokenizer.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+FileTransfer::FileTransfer() : fileFd(-1), fileSize(0), chunked(false) {}
+
+FileTransfer::~FileTransfer() {
+    if (fileFd >= 0) {
+        ::close(fileFd);
+    }
+}
+
+bool FileTransfer::open(const std::string& path) {
+    if (fileFd >= 0) {
+        ::close(fileFd);
+        fileFd = -1;
+    }
+    chunked = false;
+    
+    struct stat st;
+    {
+        ScopedTimer timer(Metrics::getInstance().diskRead());
+        fileFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fileFd < 0) return false;
+        
+        if (::fstat(fileFd, &st) != 0) st.st_mode = 0;
+    }
+    
+    if (!S_ISREG(st.st_mode)) {
+        ::close(fileFd);
+        fileFd = -1;
+        return false;
+    }
+    
+    fileSize = static_cast<Poco::UInt64>(st.st_size);
+    modifiedAt = Poco::Timestamp::fromEpochTime(st.st_mtime);
+    
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fileFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return true;
+}
+
+bool FileTransfer::openChunked(const std::string& filename) {
+    if (fileFd >= 0) {
+        ::close(fileFd);
+        fileFd = -1;
+    }
+    
+    chunked = ChunkStore::getInstance().loadManifest(filename, manifest);
+    if (!chunked) return false;
+    
+    fileSize = manifest.size;
+    modifiedAt = manifest.modifiedAt;
+    return true;
+}
+
+FileTransfer::RangeResult FileTransfer::parseRange(const std::string& header, Poco::UInt64 size, 
+                                                   std::vector<ByteRange>& ranges) {
+    ranges.clear();
+    
+    std::string value = Poco::trim(header);
+    if (value.compare(0, 6, "bytes=") != 0) return RANGE_NONE;
+    
+    Poco::StringTokenizer specs(value.substr(6), ",", 
+                                Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+    if (specs.count() == 0 || specs.count() > MAX_RANGES) return RANGE_NONE;
+    
+    for (const auto& spec : specs) {
+        std::string::size_type dash = spec.find('-');
+        if (dash == std::string::npos) return RANGE_NONE;
+        
+        std::string firstStr = Poco::trim(spec.substr(0, dash));
+        std::string lastStr = Poco::trim(spec.substr(dash + 1));
+        Poco::UInt64 first = 0;
+        Poco::UInt64 last = 0;
+        
+        if (firstStr.empty()) {
+            // Suffix range: the final N bytes
+            Poco::UInt64 suffix = 0;
+            if (!Poco::NumberParser::tryParseUnsigned64(lastStr, suffix)) return RANGE_NONE;
+            if (suffix == 0 || size == 0) continue;
+            first = suffix >= size ? 0 : size - suffix;
+            last = size - 1;
+        }
+        else {
+            if (!Poco::NumberParser::tryParseUnsigned64(firstStr, first)) return RANGE_NONE;
+            if (lastStr.empty()) {
+                last = size > 0 ? size - 1 : 0;
+            }
+            else {
+                if (!Poco::NumberParser::tryParseUnsigned64(lastStr, last)) return RANGE_NONE;
+                if (last < first) return RANGE_NONE;
+                if (last >= size && size > 0) last = size - 1;
+            }
+            if (first >= size) continue;
+        }
+        
+        ranges.push_back(ByteRange{first, last});
+    }
+    
+    // Overlapping or adjacent ranges are served as one part (RFC 7233 section 4.1),
+    // so a client can't make the same bytes go out many times
+    std::sort(ranges.begin(), ranges.end(), 
+              [](const ByteRange& a, const ByteRange& b) { return a.first < b.first; });
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].first <= ranges[merged].last + 1) {
+            if (ranges[i].last > ranges[merged].last) ranges[merged].last = ranges[i].last;
+        }
+        else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    if (!ranges.empty()) ranges.resize(merged + 1);
+    
+    return ranges.empty() ? RANGE_UNSATISFIABLE : RANGE_SATISFIABLE;
+}
+
+bool FileTransfer::send(Poco::Net::HTTPServerRequest& request, std::ostream& out, 
+                        Poco::UInt64 offset, Poco::UInt64 length) {
+    if (chunked) {
+        // Only the chunks the span covers are read
+        if (!ChunkStore::getInstance().read(manifest, offset, length, out)) return false;
+        Metrics::getInstance().addBytesOut(length);
+        return true;
+    }
+    if (fileFd < 0 || offset > fileSize || length > fileSize - offset) return false;
+    
+    // Headers (and anything else written so far) must hit the socket before we bypass the stream
+    out.flush();
+    if (!out) return false;
+    
+    Poco::UInt64 remaining = length;
+    int socketFd = socketDescriptor(request);
+    if (socketFd >= 0 && remaining > 0) {
+        bool unsupported = false;
+        if (sendZeroCopy(socketFd, offset, remaining, unsupported)) return true;
+        if (!unsupported) return false;
+    }
+    
+    return sendBuffered(out, offset, remaining);
+}
+
+int FileTransfer::socketDescriptor(Poco::Net::HTTPServerRequest& request) {
+    auto* impl = dynamic_cast<Poco::Net::HTTPServerRequestImpl*>(&request);
+    if (!impl) return -1;
+    return static_cast<int>(impl->socket().impl()->sockfd());
+}
+
+bool FileTransfer::sendZeroCopy(int socketFd, Poco::UInt64& offset, Poco::UInt64& remaining, bool& unsupported) {
+#ifdef __linux__
+    bool sentAny = false;
+    while (remaining > 0) {
+        off_t fileOffset = static_cast<off_t>(offset);
+        size_t count = remaining > (1u << 30) ? (1u << 30) : static_cast<size_t>(remaining);
+        
+        ssize_t sent = ::sendfile(socketFd, fileFd, &fileOffset, count);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            
+            // Nothing went out yet, so the caller can still fall back to copying
+            if (!sentAny && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                unsupported = true;
+                return false;
+            }
+            DFS_LOG_ERROR << "sendfile failed: " << std::strerror(errno);
+            return false;
+        }
+        if (sent == 0) {
+            // File shrank underneath us
+            DFS_LOG_WARN << "sendfile hit unexpected end of file";
+            return false;
+        }
+        
+        sentAny = true;
+        Metrics::getInstance().addBytesOut(static_cast<uint64_t>(sent));
+        offset += static_cast<Poco::UInt64>(sent);
+        remaining -= static_cast<Poco::UInt64>(sent);
+    }
+    return true;
+#else
+    unsupported = true;
+    return false;
+#endif
+}
+
+bool FileTransfer::sendBuffered(std::ostream& out, Poco::UInt64 offset, Poco::UInt64 remaining) {
+    std::vector<char> buffer(BUFFER_SIZE);
+    
+    while (remaining > 0) {
+        size_t count = remaining > buffer.size() ? buffer.size() : static_cast<size_t>(remaining);
+        ssize_t bytesRead;
+        {
+            ScopedTimer timer(Metrics::getInstance().diskRead());
+            bytesRead = ::pread(fileFd, buffer.data(), count, static_cast<off_t>(offset));
+        }
+        if (bytesRead < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (bytesRead == 0) return false;
+        
+        out.write(buffer.data(), bytesRead);
+        if (!out) return false;
+        Metrics::getInstance().addBytesOut(static_cast<uint64_t>(bytesRead));
+        
+        offset += static_cast<Poco::UInt64>(bytesRead);
+        remaining -= static_cast<Poco::UInt64>(bytesRead);
+    }
+    
+    out.flush();
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,69 @@
+#ifndef FILETRANSFER_H
+#define FILETRANSFER_H
+
+#include "ChunkStore.h"
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Timestamp.h>
+#include <Poco/Types.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Inclusive byte span, as in "Content-Range: bytes first-last/size"
+struct ByteRange {
+    Poco::UInt64 first;
+    Poco::UInt64 last;
+    
+    Poco::UInt64 length() const { return last - first + 1; }
+};
+
+// Sends a file on disk as (part of) a response body. On Linux the bytes go from
+// the page cache to the socket with sendfile(2); otherwise, or if the kernel
+// refuses, they are copied through a small fixed-size buffer. Chunked files have
+// no single descriptor and are copied from the chunk store's read-ahead buffers.
+class FileTransfer {
+public:
+    FileTransfer();
+    ~FileTransfer();
+    
+    FileTransfer(const FileTransfer&) = delete;
+    FileTransfer& operator=(const FileTransfer&) = delete;
+    
+    enum RangeResult { RANGE_NONE, RANGE_SATISFIABLE, RANGE_UNSATISFIABLE };
+    
+    // Parses a Range header against a representation of the given size. Invalid
+    // or unsupported headers yield RANGE_NONE so the caller sends the whole file.
+    // Satisfiable ranges come back sorted, with overlapping and adjacent ones merged.
+    static RangeResult parseRange(const std::string& header, Poco::UInt64 size, 
+                                  std::vector<ByteRange>& ranges);
+    
+    bool open(const std::string& path);
+    // Opens a file stored by ChunkStore under this name
+    bool openChunked(const std::string& filename);
+    Poco::UInt64 size() const { return fileSize; }
+    Poco::Timestamp lastModified() const { return modifiedAt; }
+    // -1 for chunked files
+    int descriptor() const { return fileFd; }
+    
+    // The connection's socket, or -1 when the request did not come from Poco's HTTPServer
+    static int socketDescriptor(Poco::Net::HTTPServerRequest& request);
+    
+    // Call after response.send(); the headers buffered in out are flushed first
+    bool send(Poco::Net::HTTPServerRequest& request, std::ostream& out, 
+             Poco::UInt64 offset, Poco::UInt64 length);
+
+private:
+    static const size_t BUFFER_SIZE = 64 * 1024;
+    static const size_t MAX_RANGES = 64;
+    
+    bool sendZeroCopy(int socketFd, Poco::UInt64& offset, Poco::UInt64& remaining, bool& unsupported);
+    bool sendBuffered(std::ostream& out, Poco::UInt64 offset, Poco::UInt64 remaining);
+    
+    int fileFd;
+    Poco::UInt64 fileSize;
+    Poco::Timestamp modifiedAt;
+    bool chunked;
+    ChunkManifest manifest;
+};
+
+#endif
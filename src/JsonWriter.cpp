@@ -0,0 +1,184 @@
+#include "JsonWriter.h"
+#include <Poco/Exception.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Buffers that grew for an unusually large response are given back rather than kept
+const size_t MAX_RETAINED_CAPACITY = 256 * 1024;
+
+struct ThreadBuffer {
+    std::string text;
+    bool inUse = false;
+};
+
+thread_local ThreadBuffer threadBuffer;
+
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+// True if any of the eight bytes is a control character, '"' or '\\' (bit tricks
+// from "Bit Twiddling Hacks"; bytes from 0x80 up never match)
+inline bool needsEscape(uint64_t word) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highBits = 0x8080808080808080ULL;
+    uint64_t quotes = word ^ (ones * '"');
+    uint64_t backslashes = word ^ (ones * '\\');
+    uint64_t found = ((word - ones * 0x20) & ~word) | 
+                     ((quotes - ones) & ~quotes) | 
+                     ((backslashes - ones) & ~backslashes);
+    return (found & highBits) != 0;
+}
+
+}
+
+JsonWriter::JsonWriter() : buffer(&ownBuffer), borrowed(false), depth(0), hasElements(0), afterKey(false) {
+    if (!threadBuffer.inUse) {
+        threadBuffer.inUse = true;
+        threadBuffer.text.clear();
+        buffer = &threadBuffer.text;
+        borrowed = true;
+    }
+}
+
+JsonWriter::~JsonWriter() {
+    if (!borrowed) return;
+    if (threadBuffer.text.capacity() > MAX_RETAINED_CAPACITY) {
+        std::string().swap(threadBuffer.text);
+    }
+    threadBuffer.inUse = false;
+}
+
+void JsonWriter::separate() {
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    uint64_t bit = uint64_t(1) << depth;
+    if (hasElements & bit) buffer->push_back(',');
+    else hasElements |= bit;
+}
+
+void JsonWriter::open(char bracket) {
+    separate();
+    if (depth + 1 >= MAX_DEPTH) throw Poco::IllegalStateException("JSON nesting too deep");
+    buffer->push_back(bracket);
+    ++depth;
+    hasElements &= ~(uint64_t(1) << depth);
+}
+
+void JsonWriter::close(char bracket) {
+    if (depth == 0) throw Poco::IllegalStateException("Unbalanced JSON close");
+    --depth;
+    buffer->push_back(bracket);
+}
+
+JsonWriter& JsonWriter::beginObject() {
+    open('{');
+    return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+    close('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+    open('[');
+    return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+    close(']');
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(const char* name) {
+    separate();
+    appendEscaped(*buffer, name, std::char_traits<char>::length(name));
+    buffer->push_back(':');
+    afterKey = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const std::string& text) {
+    separate();
+    appendEscaped(*buffer, text.data(), text.size());
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* text) {
+    separate();
+    appendEscaped(*buffer, text, std::char_traits<char>::length(text));
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(bool flag) {
+    separate();
+    if (flag) buffer->append("true", 4);
+    else buffer->append("false", 5);
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(double number) {
+    // JSON has no NaN or Infinity
+    if (!std::isfinite(number)) return null();
+    separate();
+    char digits[32];
+    int count = std::snprintf(digits, sizeof(digits), "%.17g", number);
+    buffer->append(digits, count > 0 ? static_cast<size_t>(count) : 0);
+    return *this;
+}
+
+JsonWriter& JsonWriter::null() {
+    separate();
+    buffer->append("null", 4);
+    return *this;
+}
+
+void JsonWriter::flushTo(std::ostream& out) {
+    out.write(buffer->data(), static_cast<std::streamsize>(buffer->size()));
+    buffer->clear();
+}
+
+void JsonWriter::appendEscaped(std::string& out, const char* text, size_t length) {
+    out.push_back('"');
+
+    // Runs of characters that need no escaping, which is nearly all of them, are found
+    // eight bytes at a time and copied in one append
+    size_t runStart = 0;
+    size_t i = 0;
+    while (i < length) {
+        if (i + 8 <= length) {
+            uint64_t word;
+            std::memcpy(&word, text + i, sizeof(word));
+            if (!needsEscape(word)) {
+                i += 8;
+                continue;
+            }
+        }
+        
+        unsigned char c = static_cast<unsigned char>(text[i++]);
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        out.append(text + runStart, i - 1 - runStart);
+        runStart = i;
+        switch (c) {
+            case '"': out.append("\\\"", 2); break;
+            case '\\': out.append("\\\\", 2); break;
+            case '\n': out.append("\\n", 2); break;
+            case '\r': out.append("\\r", 2); break;
+            case '\t': out.append("\\t", 2); break;
+            case '\b': out.append("\\b", 2); break;
+            case '\f': out.append("\\f", 2); break;
+            default: {
+                char escape[6] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xF]};
+                out.append(escape, sizeof(escape));
+            }
+        }
+    }
+    out.append(text + runStart, length - runStart);
+
+    out.push_back('"');
+}
@@ -0,0 +1,79 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <charconv>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+// Streaming JSON encoder for API responses. Text is appended straight into a
+// buffer that belongs to the worker thread, and so to the connection it is
+// serving; the buffer keeps its capacity from one response to the next. Commas
+// are inserted automatically, so callers only describe the structure.
+//
+//     JsonWriter json;
+//     json.beginObject().field("success", true).field("file_id", fileId).endObject();
+//     sendJSONResponse(response, json.str());
+class JsonWriter {
+public:
+    // Takes this thread's reusable buffer; a writer created while another is alive
+    // on the same thread gets a buffer of its own
+    JsonWriter();
+    ~JsonWriter();
+
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+    JsonWriter& key(const char* name);
+
+    JsonWriter& value(const std::string& text);
+    JsonWriter& value(const char* text);
+    JsonWriter& value(bool flag);
+    JsonWriter& value(double number);
+    JsonWriter& null();
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, JsonWriter&>::type
+    value(T number) {
+        separate();
+        char digits[24];
+        std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), number);
+        buffer->append(digits, static_cast<size_t>(result.ptr - digits));
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter& field(const char* name, const T& fieldValue) {
+        key(name);
+        return value(fieldValue);
+    }
+
+    const std::string& str() const { return *buffer; }
+    size_t size() const { return buffer->size(); }
+    // Hands what has been written so far to out and empties the buffer, keeping its
+    // capacity, so a long response goes out in pieces of bounded size
+    void flushTo(std::ostream& out);
+
+    static void appendEscaped(std::string& out, const char* text, size_t length);
+
+private:
+    static const int MAX_DEPTH = 64;
+
+    void separate();
+    void open(char bracket);
+    void close(char bracket);
+
+    std::string* buffer;
+    std::string ownBuffer;
+    bool borrowed;
+    int depth;
+    uint64_t hasElements;  // Bit per nesting level: something was written at that level
+    bool afterKey;
+};
+
+#endif
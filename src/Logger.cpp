@@ -0,0 +1,170 @@
+#include "Logger.h"
+#include "Config.h"
+#include <Poco/DateTimeFormatter.h>
+#include <Poco/String.h>
+#include <Poco/Timestamp.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+Logger& Logger::getInstance() {
+    static Logger instance;
+    return instance;
+}
+
+const char* Logger::levelName(Level level) {
+    switch (level) {
+        case LEVEL_DEBUG: return "DEBUG";
+        case LEVEL_INFO: return "INFO";
+        case LEVEL_WARN: return "WARN";
+        default: return "ERROR";
+    }
+}
+
+LogLine& LogLine::operator<<(double value) {
+    char digits[32];
+    int count = std::snprintf(digits, sizeof(digits), "%g", value);
+    return append(digits, count > 0 ? static_cast<size_t>(count) : 0);
+}
+
+Logger::Logger() : nextThreadId(1), stopping(false), droppedReported(0) {
+    std::string level = Poco::toLower(Config::getString("DFS_LOG_LEVEL", "info"));
+    if (level == "debug") minimumLevel = LEVEL_DEBUG;
+    else if (level == "warn") minimumLevel = LEVEL_WARN;
+    else if (level == "error") minimumLevel = LEVEL_ERROR;
+    else minimumLevel = LEVEL_INFO;
+
+    sampleEvery = std::max(1L, Config::getInt("DFS_LOG_REQUEST_SAMPLE", 1));
+    bufferRecords = static_cast<size_t>(std::max(16L, Config::getInt("DFS_LOG_BUFFER_RECORDS", 256)));
+    flushIntervalMillis = std::max(1L, Config::getInt("DFS_LOG_FLUSH_MS", 20));
+
+    flusher = std::thread([this]() { run(); });
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (flusher.joinable()) flusher.join();
+    drain();
+}
+
+bool Logger::sample(Level level) {
+    if (!isEnabled(level)) return false;
+    if (sampleEvery <= 1) return true;
+
+    thread_local uint64_t calls = 0;
+    if (calls++ % static_cast<uint64_t>(sampleEvery) == 0) return true;
+    sampledOut.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+Logger::ThreadBuffer& Logger::threadBuffer() {
+    thread_local ThreadHandle handle;
+    if (!handle.buffer) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        handle.buffer = std::make_shared<ThreadBuffer>(bufferRecords, nextThreadId++);
+        buffers.push_back(handle.buffer);
+    }
+    return *handle.buffer;
+}
+
+void Logger::write(Level level, const char* text, size_t length) {
+    ThreadBuffer& buffer = threadBuffer();
+
+    uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+    if (tail - buffer.head.load(std::memory_order_acquire) >= buffer.capacity) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Record& record = buffer.records[tail % buffer.capacity];
+    record.timestampMicros = Poco::Timestamp().epochMicroseconds();
+    record.level = level;
+    record.threadId = buffer.threadId;
+    record.length = static_cast<uint32_t>(std::min(length, MAX_LINE));
+    std::memcpy(record.text, text, record.length);
+
+    buffer.tail.store(tail + 1, std::memory_order_release);
+}
+
+void Logger::flush() {
+    drain();
+}
+
+void Logger::run() {
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    while (!stopping) {
+        wake.wait_for(lock, std::chrono::milliseconds(flushIntervalMillis));
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+void Logger::drain() {
+    std::lock_guard<std::mutex> drainLock(drainMutex);
+
+    std::vector<std::shared_ptr<ThreadBuffer>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        snapshot = buffers;
+    }
+
+    // Rings are drained one at a time, so order the batch by time before printing
+    struct Pending {
+        int64_t timestampMicros;
+        bool error;
+        std::string line;
+    };
+    std::vector<Pending> batch;
+
+    for (const auto& buffer : snapshot) {
+        uint64_t head = buffer->head.load(std::memory_order_relaxed);
+        uint64_t tail = buffer->tail.load(std::memory_order_acquire);
+
+        for (; head < tail; ++head) {
+            const Record& record = buffer->records[head % buffer->capacity];
+            std::string line = Poco::DateTimeFormatter::format(Poco::Timestamp(record.timestampMicros),
+                                                               "%Y-%m-%d %H:%M:%S.%F");
+            line += ' ';
+            line += levelName(record.level);
+            line += " [t";
+            line += std::to_string(record.threadId);
+            line += "] ";
+            line.append(record.text, record.length);
+            line += '\n';
+            batch.push_back(Pending{record.timestampMicros, record.level >= LEVEL_WARN, std::move(line)});
+        }
+        buffer->head.store(head, std::memory_order_release);
+    }
+
+    uint64_t droppedNow = dropped.load(std::memory_order_relaxed);
+    if (droppedNow != droppedReported) {
+        batch.push_back(Pending{Poco::Timestamp().epochMicroseconds(), true,
+                                "Logger dropped " + std::to_string(droppedNow - droppedReported) +
+                                " records: thread buffers were full\n"});
+        droppedReported = droppedNow;
+    }
+
+    if (!batch.empty()) {
+        std::stable_sort(batch.begin(), batch.end(), [](const Pending& a, const Pending& b) {
+            return a.timestampMicros < b.timestampMicros;
+        });
+
+        for (const auto& pending : batch) {
+            std::fwrite(pending.line.data(), 1, pending.line.size(), pending.error ? stderr : stdout);
+        }
+        std::fflush(stdout);
+        std::fflush(stderr);
+    }
+
+    // Threads that have exited and been fully drained no longer need a ring
+    std::lock_guard<std::mutex> lock(registryMutex);
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](const std::shared_ptr<ThreadBuffer>& buffer) {
+        return buffer->retired.load(std::memory_order_acquire) &&
+               buffer->head.load(std::memory_order_relaxed) == buffer->tail.load(std::memory_order_acquire);
+    }), buffers.end());
+}
@@ -0,0 +1,146 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Asynchronous logger. Each thread appends fixed-size records to its own
+// single-producer ring, and a background thread drains the rings to
+// stdout/stderr. Request threads never lock, allocate or block on the terminal;
+// when a ring is full the record is dropped and counted instead.
+class Logger {
+public:
+    enum Level { LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR };
+
+    static const size_t MAX_LINE = 400;
+
+    struct Record {
+        int64_t timestampMicros;
+        Level level;
+        uint32_t threadId;
+        uint32_t length;
+        char text[MAX_LINE];
+    };
+
+    static Logger& getInstance();
+    static const char* levelName(Level level);
+
+    bool isEnabled(Level level) const { return level >= minimumLevel; }
+    // Per-request lines: only every Nth call per thread is kept
+    bool sample(Level level);
+
+    void write(Level level, const char* text, size_t length);
+    // Drains everything queued so far; used before exit
+    void flush();
+
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+    uint64_t getSampledOut() const { return sampledOut.load(std::memory_order_relaxed); }
+
+private:
+    struct ThreadBuffer {
+        explicit ThreadBuffer(size_t capacity, uint32_t id)
+            : records(new Record[capacity]), capacity(capacity), threadId(id) {}
+
+        std::unique_ptr<Record[]> records;
+        const size_t capacity;
+        const uint32_t threadId;
+        alignas(64) std::atomic<uint64_t> head{0};  // Next record the flusher reads
+        alignas(64) std::atomic<uint64_t> tail{0};  // Next slot the owning thread writes
+        std::atomic<bool> retired{false};
+    };
+
+    // Marks the thread's ring for removal once the flusher has drained it
+    struct ThreadHandle {
+        std::shared_ptr<ThreadBuffer> buffer;
+        ~ThreadHandle() { if (buffer) buffer->retired.store(true, std::memory_order_release); }
+    };
+
+    Logger();
+    ~Logger();
+
+    ThreadBuffer& threadBuffer();
+    void run();
+    void drain();
+
+    Level minimumLevel;
+    long sampleEvery;
+    size_t bufferRecords;
+    long flushIntervalMillis;
+
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    uint32_t nextThreadId;
+
+    std::mutex drainMutex;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread flusher;
+
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> sampledOut{0};
+    uint64_t droppedReported;
+};
+
+// One log line, formatted into a fixed buffer and handed to the logger when it
+// goes out of scope. Longer lines are truncated.
+class LogLine {
+public:
+    explicit LogLine(Logger::Level level) : level(level), length(0) {}
+    ~LogLine() { Logger::getInstance().write(level, text, length); }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& operator<<(const char* value) { return append(value, value ? std::strlen(value) : 0); }
+    LogLine& operator<<(const std::string& value) { return append(value.data(), value.size()); }
+    LogLine& operator<<(char value) { return append(&value, 1); }
+    LogLine& operator<<(bool value) { return value ? append("true", 4) : append("false", 5); }
+    LogLine& operator<<(double value);
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value, LogLine&>::type operator<<(T value) {
+        char digits[24];
+        std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+        return append(digits, static_cast<size_t>(result.ptr - digits));
+    }
+
+private:
+    LogLine& append(const char* data, size_t count) {
+        size_t room = Logger::MAX_LINE - length;
+        if (count > room) count = room;
+        std::memcpy(text + length, data, count);
+        length += count;
+        return *this;
+    }
+
+    Logger::Level level;
+    size_t length;
+    char text[Logger::MAX_LINE];
+};
+
+// Lets the macros below discard the stream expression in a single statement
+struct LogVoidify {
+    void operator&(const LogLine&) {}
+};
+
+#define DFS_LOG(level) \
+    !Logger::getInstance().isEnabled(level) ? (void)0 : LogVoidify() & LogLine(level)
+#define DFS_LOG_SAMPLED(level) \
+    !Logger::getInstance().sample(level) ? (void)0 : LogVoidify() & LogLine(level)
+
+#define DFS_LOG_DEBUG DFS_LOG(Logger::LEVEL_DEBUG)
+#define DFS_LOG_INFO DFS_LOG(Logger::LEVEL_INFO)
+#define DFS_LOG_WARN DFS_LOG(Logger::LEVEL_WARN)
+#define DFS_LOG_ERROR DFS_LOG(Logger::LEVEL_ERROR)
+
+#endif
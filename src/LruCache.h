@@ -0,0 +1,122 @@
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <Poco/Timestamp.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Bounded, thread-safe least-recently-used map whose entries also carry an expiry
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+public:
+    explicit LruCache(size_t capacity) : maxEntries(capacity > 0 ? capacity : 1) {}
+    
+    bool get(const Key& key, Value& value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end()) {
+            missCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        
+        if (it->second->expiresAt <= Poco::Timestamp()) {
+            order.erase(it->second);
+            index.erase(it);
+            missCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        
+        order.splice(order.begin(), order, it->second);
+        value = it->second->value;
+        hitCount.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    void put(const Key& key, const Value& value, const Poco::Timestamp& expiresAt) {
+        putIf(key, value, expiresAt, nullptr);
+    }
+    
+    // Stores only if allowed() holds; it runs under the cache's lock, so an invalidation
+    // that changes its answer before calling remove() can't be overtaken by this put
+    bool putIf(const Key& key, const Value& value, const Poco::Timestamp& expiresAt, 
+               const std::function<bool()>& allowed) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (allowed && !allowed()) return false;
+        
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->value = value;
+            it->second->expiresAt = expiresAt;
+            order.splice(order.begin(), order, it->second);
+            return true;
+        }
+        
+        if (index.size() >= maxEntries) {
+            index.erase(order.back().key);
+            order.pop_back();
+            evictionCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        order.push_front(Node{key, value, expiresAt});
+        index[key] = order.begin();
+        return true;
+    }
+    
+    void remove(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            order.erase(it->second);
+            index.erase(it);
+        }
+    }
+    
+    void removeIf(const std::function<bool(const Key&, const Value&)>& matches) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = order.begin(); it != order.end();) {
+            if (matches(it->key, it->value)) {
+                index.erase(it->key);
+                it = order.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        order.clear();
+    }
+    
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.size();
+    }
+    
+    uint64_t hits() const { return hitCount.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return missCount.load(std::memory_order_relaxed); }
+    uint64_t evictions() const { return evictionCount.load(std::memory_order_relaxed); }
+    
+private:
+    struct Node {
+        Key key;
+        Value value;
+        Poco::Timestamp expiresAt;
+    };
+    
+    size_t maxEntries;
+    std::mutex mutex;
+    std::list<Node> order;  // Most recently used first
+    std::unordered_map<Key, typename std::list<Node>::iterator, Hash> index;
+    
+    std::atomic<uint64_t> hitCount{0};
+    std::atomic<uint64_t> missCount{0};
+    std::atomic<uint64_t> evictionCount{0};
+};
+
+#endif
@@ -0,0 +1,320 @@
+#include "Maintenance.h"
+#include "Config.h"
+#include "FileManager.h"
+#include "Logger.h"
+#include "StorageBackend.h"
+#include "UploadSession.h"
+#include "User.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <set>
+
+namespace {
+
+// Reconciliation descends this far: the two fan-out levels under each root
+const int FANOUT_DEPTH = 2;
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Strips a ".c<N>"-style suffix; false when filename does not end in one
+bool stripNumberedSuffix(std::string& filename, const char* marker) {
+    size_t at = filename.rfind(marker);
+    if (at == std::string::npos || at + 2 == filename.size() ||
+        filename.find_first_not_of("0123456789", at + 2) != std::string::npos) {
+        return false;
+    }
+    filename.erase(at);
+    return true;
+}
+
+// Erasure-coded shards are named for their chunk and may sit in directories
+// configured under a storage root; their manifest is what a files row names
+bool isShard(const std::string& filename) {
+    std::string chunk = filename;
+    return stripNumberedSuffix(chunk, ".s") && stripNumberedSuffix(chunk, ".c");
+}
+
+// Sidecars, chunk manifests and chunks belong to the stored file they extend
+std::string getOwningFilename(const std::string& filename) {
+    for (const char* suffix : { ".gz", ".zst", ".manifest" }) {
+        if (endsWith(filename, suffix)) return filename.substr(0, filename.size() - std::strlen(suffix));
+    }
+
+    std::string owner = filename;
+    stripNumberedSuffix(owner, ".c");
+    return owner;
+}
+
+// Every name a files row could use for this file: itself or its owner, under
+// either layout, so nothing is taken for an orphan mid-migration
+std::vector<std::string> getReferencingNames(const std::string& filename) {
+    std::vector<std::string> names;
+    for (const std::string& name : { filename, getOwningFilename(filename) }) {
+        names.push_back(name);
+        if (name.find('/') == std::string::npos) names.push_back(FileManager::getFanoutFilename(name));
+        else names.push_back(name.substr(name.find_last_of('/') + 1));
+    }
+    return names;
+}
+
+// Seconds since the file was last written, or -1 if it is gone or not a regular file
+long getAgeSeconds(const std::string& path) {
+    struct stat info;
+    if (::lstat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return -1;
+    return static_cast<long>(std::time(nullptr) - info.st_mtime);
+}
+
+}
+
+Maintenance& Maintenance::getInstance() {
+    static Maintenance instance;
+    return instance;
+}
+
+Maintenance::Maintenance() : stopping(true) {
+    enabled = Config::getBool("DFS_MAINTENANCE", true);
+    batchSize = static_cast<int>(std::max(1L, std::min(Config::getInt("DFS_MAINTENANCE_BATCH", 1000), 100000L)));
+    pauseMillis = std::max(0L, Config::getInt("DFS_MAINTENANCE_PAUSE_MS", 100));
+    // Longer than an upload session lives, so no staged upload still in use looks abandoned
+    orphanMinAgeSeconds = std::max(UploadSession::LIFETIME_SECONDS + 3600,
+                                   Config::getInt("DFS_MAINTENANCE_ORPHAN_MIN_AGE_SECONDS", 2 * 86400));
+
+    addJob("expired_sessions", "DFS_MAINTENANCE_SESSIONS_SECONDS", 600,
+           [this]() { return purgeInBatches(User::cleanupExpiredSessions); });
+    addJob("expired_shares", "DFS_MAINTENANCE_SHARES_SECONDS", 3600,
+           [this]() { return purgeInBatches(FileManager::purgeExpiredShares); });
+    addJob("expired_uploads", "DFS_MAINTENANCE_UPLOADS_SECONDS", 3600,
+           [this]() { return purgeInBatches(UploadSession::purgeExpired); });
+    addJob("storage_reconcile", "DFS_MAINTENANCE_RECONCILE_SECONDS", 86400,
+           [this]() { return reconcileStorage(); });
+}
+
+Maintenance::~Maintenance() {
+    stop();
+}
+
+void Maintenance::addJob(const std::string& name, const char* intervalSetting, long defaultSeconds,
+                         std::function<long()> run) {
+    // An interval of 0 turns the job off
+    long seconds = Config::getInt(intervalSetting, defaultSeconds);
+    if (seconds <= 0) return;
+
+    std::unique_ptr<Job> job(new Job);
+    job->name = name;
+    job->interval = std::chrono::seconds(seconds);
+    job->run = std::move(run);
+    jobs.push_back(std::move(job));
+}
+
+void Maintenance::start() {
+    if (!enabled || jobs.empty()) return;
+
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (scheduler.joinable()) return;
+    stopping = false;
+
+    // Each job first runs a minute after startup, or sooner if its interval is shorter
+    auto now = std::chrono::steady_clock::now();
+    for (auto& job : jobs) job->nextRun = now + std::min(job->interval, std::chrono::seconds(60));
+    scheduler = std::thread([this]() { runScheduler(); });
+}
+
+void Maintenance::stop() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!scheduler.joinable()) return;
+        stopping = true;
+    }
+    stateChanged.notify_all();
+    scheduler.join();
+}
+
+void Maintenance::runScheduler() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (!stopping) {
+        auto next = jobs.front()->nextRun;
+        for (const auto& job : jobs) next = std::min(next, job->nextRun);
+        stateChanged.wait_until(lock, next, [this]() { return stopping; });
+        if (stopping) break;
+        lock.unlock();
+
+        // One job at a time: housekeeping never needs more than one connection
+        for (auto& job : jobs) {
+            if (std::chrono::steady_clock::now() < job->nextRun) continue;
+            runJob(*job);
+            job->nextRun = std::chrono::steady_clock::now() + job->interval;
+
+            lock.lock();
+            bool done = stopping;
+            lock.unlock();
+            if (done) break;
+        }
+
+        lock.lock();
+    }
+}
+
+void Maintenance::runJob(Job& job) {
+    auto started = std::chrono::steady_clock::now();
+    long removed = job.run();
+    auto elapsed = std::chrono::steady_clock::now() - started;
+
+    job.duration.observe(elapsed);
+    job.lastDurationMicros.store(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()), std::memory_order_relaxed);
+    job.runs.fetch_add(1, std::memory_order_relaxed);
+    if (removed < 0) {
+        job.failures.fetch_add(1, std::memory_order_relaxed);
+        DFS_LOG_WARN << "Maintenance: " << job.name << " did not finish";
+        return;
+    }
+
+    job.removed.fetch_add(static_cast<uint64_t>(removed), std::memory_order_relaxed);
+    if (removed > 0) {
+        DFS_LOG_INFO << "Maintenance: " << job.name << " removed " << removed << " in "
+                     << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms";
+    }
+}
+
+long Maintenance::purgeInBatches(const std::function<long(int)>& purge) {
+    long total = 0;
+    while (true) {
+        long removed = purge(batchSize);
+        if (removed < 0) return -1;
+
+        total += removed;
+        if (removed < batchSize || !pause()) return total;
+    }
+}
+
+bool Maintenance::pause() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    stateChanged.wait_for(lock, std::chrono::milliseconds(pauseMillis), [this]() { return stopping; });
+    return !stopping;
+}
+
+long Maintenance::reconcileStorage() {
+    StorageBackend& storage = StorageBackend::getInstance();
+    std::vector<std::string> roots = storage.getRoots();
+    if (std::find(roots.begin(), roots.end(), storage.getStagingDirectory()) == roots.end()) {
+        roots.push_back(storage.getStagingDirectory());
+    }
+
+    long removed = 0;
+    for (const auto& root : roots) {
+        std::vector<std::string> pending;
+        if (!reconcileDirectory(root, "", 0, pending, removed) || !removeOrphans(root, pending, removed)) {
+            return -1;
+        }
+    }
+    return removed;
+}
+
+bool Maintenance::reconcileDirectory(const std::string& root, const std::string& relative, int depth,
+                                     std::vector<std::string>& pending, long& removed) {
+    std::string directory = root + relative;
+    DIR* handle = ::opendir(directory.c_str());
+    if (!handle) {
+        // A replica that is offline is the storage backend's to report
+        if (errno != ENOENT) DFS_LOG_WARN << "Maintenance: cannot read " << directory << ": " << std::strerror(errno);
+        return true;
+    }
+    std::unique_ptr<DIR, int (*)(DIR*)> closer(handle, ::closedir);
+
+    while (dirent* entry = ::readdir(handle)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        std::string filename = relative + name;
+        std::string path = root + filename;
+
+        struct stat info;
+        if (::lstat(path.c_str(), &info) != 0) continue;
+        if (S_ISDIR(info.st_mode)) {
+            if (depth < FANOUT_DEPTH && name[0] != '.' &&
+                !reconcileDirectory(root, filename + "/", depth + 1, pending, removed)) {
+                return false;
+            }
+            continue;
+        }
+        if (!S_ISREG(info.st_mode) || static_cast<long>(std::time(nullptr) - info.st_mtime) < orphanMinAgeSeconds) {
+            continue;
+        }
+
+        if (isShard(name)) continue;
+        if (name[0] == '.') {
+            // Upload bodies (and their staged chunks) whose commit never came; other
+            // hidden files are the storage backend's own
+            if (name.find(".part") != std::string::npos && ::unlink(path.c_str()) == 0) {
+                DFS_LOG_INFO << "Maintenance: removed abandoned upload " << path;
+                ++removed;
+            }
+            continue;
+        }
+
+        pending.push_back(filename);
+        if (pending.size() >= static_cast<size_t>(batchSize) && !removeOrphans(root, pending, removed)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Maintenance::removeOrphans(const std::string& root, std::vector<std::string>& pending, long& removed) {
+    if (pending.empty()) return true;
+
+    std::vector<std::string> candidates;
+    for (const auto& filename : pending) {
+        std::vector<std::string> names = getReferencingNames(filename);
+        candidates.insert(candidates.end(), names.begin(), names.end());
+    }
+    std::set<std::string> referenced;
+    if (!FileManager::findReferenced(candidates, referenced)) return false;
+
+    for (const auto& filename : pending) {
+        std::vector<std::string> names = getReferencingNames(filename);
+        if (std::any_of(names.begin(), names.end(),
+                        [&referenced](const std::string& name) { return referenced.count(name) > 0; })) {
+            continue;
+        }
+
+        // Stat again: an upload of the same content may have just stored it afresh
+        std::string path = root + filename;
+        if (getAgeSeconds(path) >= orphanMinAgeSeconds && ::unlink(path.c_str()) == 0) {
+            DFS_LOG_INFO << "Maintenance: removed orphaned " << path;
+            ++removed;
+        }
+    }
+    pending.clear();
+    return pause();
+}
+
+void Maintenance::render(std::ostream& out) const {
+    out << "# TYPE dfs_maintenance_job_runs_total counter\n";
+    for (const auto& job : jobs) {
+        uint64_t runs = job->runs.load(std::memory_order_relaxed);
+        uint64_t failures = job->failures.load(std::memory_order_relaxed);
+        out << "dfs_maintenance_job_runs_total{job=\"" << job->name << "\",result=\"ok\"} " << runs - failures << "\n";
+        out << "dfs_maintenance_job_runs_total{job=\"" << job->name << "\",result=\"failed\"} " << failures << "\n";
+    }
+    out << "# TYPE dfs_maintenance_removed_total counter\n";
+    for (const auto& job : jobs) {
+        out << "dfs_maintenance_removed_total{job=\"" << job->name << "\"} "
+            << job->removed.load(std::memory_order_relaxed) << "\n";
+    }
+    out << "# TYPE dfs_maintenance_job_duration_seconds histogram\n";
+    for (const auto& job : jobs) {
+        job->duration.render(out, "dfs_maintenance_job_duration_seconds", "job=\"" + job->name + "\"");
+    }
+    out << "# TYPE dfs_maintenance_job_last_duration_seconds gauge\n";
+    for (const auto& job : jobs) {
+        out << "dfs_maintenance_job_last_duration_seconds{job=\"" << job->name << "\"} "
+            << job->lastDurationMicros.load(std::memory_order_relaxed) / 1e6 << "\n";
+    }
+}
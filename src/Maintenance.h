@@ -0,0 +1,76 @@
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+
+#include "Metrics.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Periodic housekeeping on one background thread, each job on its own interval.
+// Purges delete expired rows a bounded batch at a time with a pause in between,
+// so they never hold many locks or crowd out requests. Reconciliation walks the
+// storage directories and removes what no files row names any more: blobs left
+// by a crash between storing and committing, copies a failed delete missed, and
+// staged uploads nobody finished.
+class Maintenance {
+public:
+    static Maintenance& getInstance();
+
+    void start();
+    void stop();
+
+    void render(std::ostream& out) const;
+
+private:
+    // A job returns the rows or files it removed, or -1 if it failed
+    struct Job {
+        std::string name;
+        std::chrono::seconds interval;
+        std::function<long()> run;
+        std::chrono::steady_clock::time_point nextRun;
+
+        Histogram duration;
+        std::atomic<uint64_t> runs{0};
+        std::atomic<uint64_t> failures{0};
+        std::atomic<uint64_t> removed{0};
+        std::atomic<uint64_t> lastDurationMicros{0};
+    };
+
+    Maintenance();
+    ~Maintenance();
+
+    void addJob(const std::string& name, const char* intervalSetting, long defaultSeconds,
+                std::function<long()> run);
+    void runScheduler();
+    void runJob(Job& job);
+    // Calls purge until a batch comes back short; -1 if a batch failed
+    long purgeInBatches(const std::function<long(int)>& purge);
+    // Waits out the pause between batches; false when stopping
+    bool pause();
+
+    long reconcileStorage();
+    bool reconcileDirectory(const std::string& root, const std::string& relative, int depth,
+                            std::vector<std::string>& pending, long& removed);
+    bool removeOrphans(const std::string& root, std::vector<std::string>& pending, long& removed);
+
+    bool enabled;
+    int batchSize;
+    long pauseMillis;
+    long orphanMinAgeSeconds;
+    std::vector<std::unique_ptr<Job>> jobs;
+
+    std::mutex stateMutex;
+    std::condition_variable stateChanged;
+    bool stopping;
+    std::thread scheduler;
+};
+
+#endif
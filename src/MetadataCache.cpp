@@ -0,0 +1,148 @@
+#include "MetadataCache.h"
+#include "Config.h"
+#include "Cluster.h"
+#include "Logger.h"
+
+MetadataCache& MetadataCache::getInstance() {
+    static MetadataCache instance;
+    return instance;
+}
+
+MetadataCache::MetadataCache()
+    : ttl(Config::getInt("DFS_METADATA_CACHE_TTL_SECONDS", 300) * Poco::Timestamp::resolution()),
+      negativeTtl(Config::getInt("DFS_METADATA_CACHE_NEGATIVE_TTL_SECONDS", 5) * Poco::Timestamp::resolution()),
+      files(static_cast<size_t>(Config::getInt("DFS_METADATA_CACHE_ENTRIES", 10000))),
+      shareTokens(static_cast<size_t>(Config::getInt("DFS_METADATA_CACHE_ENTRIES", 10000))),
+      shareGrants(static_cast<size_t>(Config::getInt("DFS_METADATA_CACHE_ENTRIES", 10000))),
+      listingVersionsEnabled(true),
+      // Seeded from the clock so versions handed out before a restart are never reused
+      nextListingVersion(static_cast<uint64_t>(Poco::Timestamp().epochMicroseconds())),
+      maxListingEntries(static_cast<size_t>(Config::getInt("DFS_METADATA_CACHE_ENTRIES", 10000))) {
+    // Nodes sharing a database never hear of each other's writes, so nothing may be
+    // answered from this process's memory
+    if (Cluster::getInstance().isEnabled()) {
+        ttl = 0;
+        negativeTtl = 0;
+        listingVersionsEnabled = false;
+        DFS_LOG_INFO << "Metadata cache and listing ETags are off in cluster mode";
+    }
+}
+
+uint64_t MetadataCache::grantKey(int fileId, int userId) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(fileId)) << 32) | static_cast<uint32_t>(userId);
+}
+
+std::function<bool()> MetadataCache::isCurrent(uint64_t readGeneration) const {
+    return [this, readGeneration]() { return getGeneration() == readGeneration; };
+}
+
+bool MetadataCache::getFile(int fileId, FileInfo& info) {
+    return files.get(fileId, info);
+}
+
+void MetadataCache::putFile(const FileInfo& info, uint64_t readGeneration) {
+    if (ttl <= 0) return;
+    
+    Poco::Timestamp expiresAt;
+    expiresAt += ttl;
+    files.putIf(info.fileId, info, expiresAt, isCurrent(readGeneration));
+}
+
+void MetadataCache::invalidateFile(int fileId) {
+    advanceGeneration();
+    files.remove(fileId);
+}
+
+bool MetadataCache::getShareToken(const std::string& token, ShareTokenInfo& share) {
+    return shareTokens.get(token, share) && share.expiresAt > Poco::Timestamp();
+}
+
+void MetadataCache::putShareToken(const std::string& token, const ShareTokenInfo& share, uint64_t readGeneration) {
+    if (ttl <= 0) return;
+    
+    Poco::Timestamp expiresAt;
+    expiresAt += ttl;
+    if (share.expiresAt < expiresAt) expiresAt = share.expiresAt;
+    shareTokens.putIf(token, share, expiresAt, isCurrent(readGeneration));
+}
+
+bool MetadataCache::getShareGrant(int fileId, int userId, bool& granted) {
+    return shareGrants.get(grantKey(fileId, userId), granted);
+}
+
+void MetadataCache::putShareGrant(int fileId, int userId, bool granted, const Poco::Timestamp& shareExpiry, 
+                                  uint64_t readGeneration) {
+    // Denials are kept briefly; shareFile also invalidates them when a grant appears
+    Poco::Timestamp expiresAt;
+    expiresAt += granted ? ttl : negativeTtl;
+    if (granted && shareExpiry < expiresAt) expiresAt = shareExpiry;
+    if (expiresAt <= Poco::Timestamp()) return;
+    
+    shareGrants.putIf(grantKey(fileId, userId), granted, expiresAt, isCurrent(readGeneration));
+}
+
+void MetadataCache::invalidateShareGrant(int fileId, int userId) {
+    advanceGeneration();
+    shareGrants.remove(grantKey(fileId, userId));
+}
+
+void MetadataCache::invalidateFileShares(int fileId) {
+    advanceGeneration();
+    shareTokens.removeIf([fileId](const std::string&, const ShareTokenInfo& share) { return share.fileId == fileId; });
+    shareGrants.removeIf([fileId](uint64_t key, bool) { return static_cast<int>(key >> 32) == fileId; });
+}
+
+uint64_t MetadataCache::getListingVersion(Listing listing, int userId) {
+    uint64_t key = grantKey(static_cast<int>(listing), userId);
+    std::lock_guard<std::mutex> lock(listingMutex);
+    
+    auto it = listingVersions.find(key);
+    if (it != listingVersions.end() && it->second.validUntil > Poco::Timestamp()) {
+        return it->second.version;
+    }
+    
+    // Forgetting versions is always safe: everyone just gets a fresh one
+    if (it == listingVersions.end() && listingVersions.size() >= maxListingEntries) {
+        listingVersions.clear();
+    }
+    
+    ListingVersion& entry = listingVersions[key];
+    entry.version = ++nextListingVersion;
+    entry.validUntil = Poco::Timestamp(Poco::Timestamp::TIMEVAL_MAX);
+    return entry.version;
+}
+
+void MetadataCache::bumpListingVersion(Listing listing, int userId) {
+    std::lock_guard<std::mutex> lock(listingMutex);
+    listingVersions.erase(grantKey(static_cast<int>(listing), userId));
+}
+
+void MetadataCache::bumpAllListingVersions(Listing listing) {
+    std::lock_guard<std::mutex> lock(listingMutex);
+    for (auto it = listingVersions.begin(); it != listingVersions.end();) {
+        if (static_cast<int>(it->first >> 32) == static_cast<int>(listing)) it = listingVersions.erase(it);
+        else ++it;
+    }
+}
+
+void MetadataCache::expireListingVersion(Listing listing, int userId, uint64_t version, const Poco::Timestamp& at) {
+    std::lock_guard<std::mutex> lock(listingMutex);
+    auto it = listingVersions.find(grantKey(static_cast<int>(listing), userId));
+    if (it != listingVersions.end() && it->second.version == version && at < it->second.validUntil) {
+        it->second.validUntil = at;
+    }
+}
+
+MetadataCacheStats MetadataCache::getStats() {
+    MetadataCacheStats stats;
+    stats.fileHits = files.hits();
+    stats.fileMisses = files.misses();
+    stats.shareTokenHits = shareTokens.hits();
+    stats.shareTokenMisses = shareTokens.misses();
+    stats.shareGrantHits = shareGrants.hits();
+    stats.shareGrantMisses = shareGrants.misses();
+    stats.fileEntries = files.size();
+    stats.shareTokenEntries = shareTokens.size();
+    stats.shareGrantEntries = shareGrants.size();
+    return stats;
+}
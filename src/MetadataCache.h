@@ -0,0 +1,96 @@
+#ifndef METADATACACHE_H
+#define METADATACACHE_H
+
+#include "FileManager.h"
+#include "LruCache.h"
+#include <Poco/Timestamp.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct ShareTokenInfo {
+    int fileId;
+    int sharedWith;  // 0 for public links
+    Poco::Timestamp expiresAt;
+};
+
+struct MetadataCacheStats {
+    uint64_t fileHits;
+    uint64_t fileMisses;
+    uint64_t shareTokenHits;
+    uint64_t shareTokenMisses;
+    uint64_t shareGrantHits;
+    uint64_t shareGrantMisses;
+    size_t fileEntries;
+    size_t shareTokenEntries;
+    size_t shareGrantEntries;
+};
+
+// Download hot path cache: file metadata by file_id, share tokens, and whether a
+// file is shared with a given user. FileManager invalidates entries on writes.
+// Fills pass the generation they read before going to the database; a fill that
+// an invalidation overtook is dropped rather than caching what was just changed.
+class MetadataCache {
+public:
+    static MetadataCache& getInstance();
+    
+    uint64_t getGeneration() const { return generation.load(std::memory_order_acquire); }
+    
+    bool getFile(int fileId, FileInfo& info);
+    void putFile(const FileInfo& info, uint64_t readGeneration);
+    void invalidateFile(int fileId);
+    
+    bool getShareToken(const std::string& token, ShareTokenInfo& share);
+    void putShareToken(const std::string& token, const ShareTokenInfo& share, uint64_t readGeneration);
+    
+    // Returns true if the answer is cached; granted then says whether access is allowed
+    bool getShareGrant(int fileId, int userId, bool& granted);
+    void putShareGrant(int fileId, int userId, bool granted, const Poco::Timestamp& shareExpiry, 
+                       uint64_t readGeneration);
+    void invalidateShareGrant(int fileId, int userId);
+    // Every share token and grant of a deleted file
+    void invalidateFileShares(int fileId);
+    
+    // Opaque version of a user's listing, used as its ETag. Writes that change a
+    // listing bump it; an unknown user gets a fresh version, so a stale tag never matches.
+    // Versions only see this node's writes, so in cluster mode there are none.
+    enum Listing { LISTING_FILES, LISTING_SHARED_WITH_ME };
+    bool hasListingVersions() const { return listingVersionsEnabled; }
+    uint64_t getListingVersion(Listing listing, int userId);
+    void bumpListingVersion(Listing listing, int userId);
+    void bumpAllListingVersions(Listing listing);
+    // The listing changes on its own at this time, e.g. when a share in it expires
+    void expireListingVersion(Listing listing, int userId, uint64_t version, const Poco::Timestamp& at);
+    
+    MetadataCacheStats getStats();
+    
+private:
+    struct ListingVersion {
+        uint64_t version;
+        Poco::Timestamp validUntil;
+    };
+    
+    MetadataCache();
+    static uint64_t grantKey(int fileId, int userId);
+    // Called before removing entries, so puts checked after it see the change
+    void advanceGeneration() { generation.fetch_add(1, std::memory_order_acq_rel); }
+    std::function<bool()> isCurrent(uint64_t readGeneration) const;
+    
+    Poco::Timestamp::TimeDiff ttl;
+    Poco::Timestamp::TimeDiff negativeTtl;
+    LruCache<int, FileInfo> files;
+    LruCache<std::string, ShareTokenInfo> shareTokens;
+    LruCache<uint64_t, bool> shareGrants;
+    std::atomic<uint64_t> generation{0};
+    
+    bool listingVersionsEnabled;
+    std::mutex listingMutex;
+    std::unordered_map<uint64_t, ListingVersion> listingVersions;
+    uint64_t nextListingVersion;
+    size_t maxListingEntries;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <iomanip>
+
+Histogram::Histogram() : count(0), sumNanos(0) {
+    for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+}
+
+const std::array<uint64_t, Histogram::BUCKET_COUNT>& Histogram::upperBoundsMicros() {
+    // 50us to 60s, roughly doubling
+    static const std::array<uint64_t, BUCKET_COUNT> bounds = {{
+        50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 
+        250000, 500000, 1000000, 2500000, 5000000, 10000000, 15000000, 
+        20000000, 30000000, 45000000, 60000000
+    }};
+    return bounds;
+}
+
+void Histogram::observe(std::chrono::nanoseconds elapsed) {
+    uint64_t nanos = elapsed.count() > 0 ? static_cast<uint64_t>(elapsed.count()) : 0;
+    uint64_t micros = nanos / 1000;
+    
+    const auto& bounds = upperBoundsMicros();
+    size_t index = std::lower_bound(bounds.begin(), bounds.end(), micros) - bounds.begin();
+    
+    buckets[index].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sumNanos.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+double Histogram::quantile(double q) const {
+    uint64_t total = 0;
+    std::array<uint64_t, BUCKET_COUNT + 1> snapshot;
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+        snapshot[i] = buckets[i].load(std::memory_order_relaxed);
+        total += snapshot[i];
+    }
+    if (total == 0) return 0.0;
+    
+    const auto& bounds = upperBoundsMicros();
+    double rank = q * static_cast<double>(total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < snapshot.size(); ++i) {
+        if (snapshot[i] == 0) continue;
+        if (static_cast<double>(seen + snapshot[i]) >= rank) {
+            double lower = i == 0 ? 0.0 : static_cast<double>(bounds[i - 1]);
+            if (i == BUCKET_COUNT) return lower / 1e6;  // +Inf bucket: report its lower bound
+            double upper = static_cast<double>(bounds[i]);
+            double fraction = (rank - static_cast<double>(seen)) / static_cast<double>(snapshot[i]);
+            return (lower + (upper - lower) * fraction) / 1e6;
+        }
+        seen += snapshot[i];
+    }
+    return static_cast<double>(bounds.back()) / 1e6;
+}
+
+void Histogram::render(std::ostream& out, const std::string& name, const std::string& labels) const {
+    const auto& bounds = upperBoundsMicros();
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        out << name << "_bucket{" << prefix << "le=\"" << static_cast<double>(bounds[i]) / 1e6 << "\"} " 
+            << cumulative << "\n";
+    }
+    cumulative += buckets[BUCKET_COUNT].load(std::memory_order_relaxed);
+    out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << cumulative << "\n";
+    out << name << "_sum{" << labels << "} " 
+        << static_cast<double>(sumNanos.load(std::memory_order_relaxed)) / 1e9 << "\n";
+    out << name << "_count{" << labels << "} " << count.load(std::memory_order_relaxed) << "\n";
+}
+
+Metrics& Metrics::getInstance() {
+    static Metrics instance;
+    return instance;
+}
+
+Metrics::Metrics() : bytesIn(0), bytesOut(0), activeRequests(0) {
+    for (auto& statuses : routeStatus) {
+        for (auto& counter : statuses) counter.store(0, std::memory_order_relaxed);
+    }
+}
+
+const char* Metrics::routeName(Route route) {
+    static const char* names[ROUTE_COUNT] = {
+        "register", "login", "logout", "upload", "uploads", "download", "share", 
+        "files", "shared", "shared_with_me", "metrics", "batch", "cluster", "other"
+    };
+    return route < ROUTE_COUNT ? names[route] : "other";
+}
+
+void Metrics::recordRequest(Route route, int status, std::chrono::nanoseconds elapsed) {
+    if (route >= ROUTE_COUNT) route = ROUTE_OTHER;
+    routeLatency[route].observe(elapsed);
+    
+    int statusClass = status / 100 - 1;
+    if (statusClass >= 0 && statusClass < 5) {
+        routeStatus[route][statusClass].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Histogram& Metrics::dbStatement(const std::string& name) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::unique_ptr<Histogram>& histogram = dbLatency[name];
+    if (!histogram) histogram.reset(new Histogram());
+    return *histogram;
+}
+
+void Metrics::addCollector(const Collector& collector) {
+    std::lock_guard<std::mutex> lock(collectorMutex);
+    collectors.push_back(collector);
+}
+
+void Metrics::removeCollectors() {
+    std::lock_guard<std::mutex> lock(collectorMutex);
+    collectors.clear();
+}
+
+void Metrics::render(std::ostream& out) {
+    out << std::setprecision(6);
+    
+    out << "# TYPE dfs_http_requests_total counter\n";
+    for (int r = 0; r < ROUTE_COUNT; ++r) {
+        for (int c = 0; c < 5; ++c) {
+            uint64_t value = routeStatus[r][c].load(std::memory_order_relaxed);
+            if (value == 0) continue;
+            out << "dfs_http_requests_total{route=\"" << routeName(static_cast<Route>(r)) 
+                << "\",status=\"" << (c + 1) << "xx\"} " << value << "\n";
+        }
+    }
+    
+    out << "# TYPE dfs_http_request_duration_seconds histogram\n";
+    for (int r = 0; r < ROUTE_COUNT; ++r) {
+        std::string labels = std::string("route=\"") + routeName(static_cast<Route>(r)) + "\"";
+        routeLatency[r].render(out, "dfs_http_request_duration_seconds", labels);
+    }
+    
+    out << "# TYPE dfs_http_request_latency_quantile_seconds gauge\n";
+    for (int r = 0; r < ROUTE_COUNT; ++r) {
+        for (double q : {0.5, 0.95, 0.99}) {
+            out << "dfs_http_request_latency_quantile_seconds{route=\"" << routeName(static_cast<Route>(r)) 
+                << "\",quantile=\"" << q << "\"} " << routeLatency[r].quantile(q) << "\n";
+        }
+    }
+    
+    out << "# TYPE dfs_http_bytes_in_total counter\n";
+    out << "dfs_http_bytes_in_total " << bytesIn.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_http_bytes_out_total counter\n";
+    out << "dfs_http_bytes_out_total " << bytesOut.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_http_requests_in_flight gauge\n";
+    out << "dfs_http_requests_in_flight " << activeRequests.load(std::memory_order_relaxed) << "\n";
+    
+    out << "# TYPE dfs_disk_read_duration_seconds histogram\n";
+    diskReadLatency.render(out, "dfs_disk_read_duration_seconds", "");
+    out << "# TYPE dfs_disk_write_duration_seconds histogram\n";
+    diskWriteLatency.render(out, "dfs_disk_write_duration_seconds", "");
+    
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        out << "# TYPE dfs_db_query_duration_seconds histogram\n";
+        for (const auto& entry : dbLatency) {
+            entry.second->render(out, "dfs_db_query_duration_seconds", "statement=\"" + entry.first + "\"");
+        }
+    }
+    
+    // Collectors may take registryMutex themselves (dbStatement), so they run under their own
+    std::lock_guard<std::mutex> lock(collectorMutex);
+    for (const auto& collector : collectors) {
+        collector(out);
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Latency histogram with fixed exponential buckets. Recording is a couple of
+// relaxed atomic adds, so hot paths never take a lock.
+class Histogram {
+public:
+    static const size_t BUCKET_COUNT = 22;
+    
+    Histogram();
+    void observe(std::chrono::nanoseconds elapsed);
+    // Estimated from the buckets by linear interpolation, in seconds
+    double quantile(double q) const;
+    void render(std::ostream& out, const std::string& name, const std::string& labels) const;
+    
+private:
+    static const std::array<uint64_t, BUCKET_COUNT>& upperBoundsMicros();
+    
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT + 1> buckets;  // Last one is +Inf
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sumNanos;
+};
+
+// Records elapsed time into a histogram when it leaves scope
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& target) 
+        : histogram(target), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { histogram.observe(std::chrono::steady_clock::now() - start); }
+    
+private:
+    Histogram& histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Process-wide metrics, rendered in Prometheus text format on /metrics
+class Metrics {
+public:
+    enum Route {
+        ROUTE_REGISTER, ROUTE_LOGIN, ROUTE_LOGOUT, ROUTE_UPLOAD, ROUTE_UPLOAD_SESSION, 
+        ROUTE_DOWNLOAD, ROUTE_SHARE, ROUTE_FILES, ROUTE_SHARED, ROUTE_SHARED_WITH_ME, 
+        ROUTE_METRICS, ROUTE_BATCH, ROUTE_CLUSTER, ROUTE_OTHER, ROUTE_COUNT
+    };
+    
+    typedef std::function<void(std::ostream&)> Collector;
+    
+    static Metrics& getInstance();
+    static const char* routeName(Route route);
+    
+    void recordRequest(Route route, int status, std::chrono::nanoseconds elapsed);
+    void addBytesIn(uint64_t bytes) { bytesIn.fetch_add(bytes, std::memory_order_relaxed); }
+    void addBytesOut(uint64_t bytes) { bytesOut.fetch_add(bytes, std::memory_order_relaxed); }
+    void requestStarted() { activeRequests.fetch_add(1, std::memory_order_relaxed); }
+    void requestFinished() { activeRequests.fetch_sub(1, std::memory_order_relaxed); }
+    
+    Histogram& diskRead() { return diskReadLatency; }
+    Histogram& diskWrite() { return diskWriteLatency; }
+    // Registered once per statement name; callers keep the reference in a static
+    Histogram& dbStatement(const std::string& name);
+    
+    // Collectors contribute gauges owned by other components at scrape time
+    void addCollector(const Collector& collector);
+    // Waits for a scrape in progress, so nothing a collector reads is in use afterwards
+    void removeCollectors();
+    void render(std::ostream& out);
+    
+private:
+    Metrics();
+    
+    std::array<Histogram, ROUTE_COUNT> routeLatency;
+    std::array<std::array<std::atomic<uint64_t>, 5>, ROUTE_COUNT> routeStatus;  // 1xx..5xx
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> bytesOut;
+    std::atomic<int64_t> activeRequests;
+    Histogram diskReadLatency;
+    Histogram diskWriteLatency;
+    
+    std::mutex registryMutex;
+    std::map<std::string, std::unique_ptr<Histogram>> dbLatency;
+    // Held while collectors run; scrapes are rare enough to take turns
+    std::mutex collectorMutex;
+    std::vector<Collector> collectors;
+};
+
+#endif
@@ -0,0 +1,518 @@
+#include "ReplicatedStorageBackend.h"
+#include "ChunkStore.h"
+#include "Compression.h"
+#include "Config.h"
+#include "Database.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Utils.h"
+#include <Poco/Data/Statement.h>
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Path.h>
+#include <Poco/Types.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace Poco::Data::Keywords;
+
+namespace {
+
+std::string getParentDirectory(const std::string& path) {
+    Poco::Path parent(path);
+    parent.makeParent();
+    return parent.toString();
+}
+
+void createParentDirectories(const std::string& path) {
+    Poco::File(getParentDirectory(path)).createDirectories();
+}
+
+void removeQuietly(const std::string& path) {
+    try {
+        Poco::File file(path);
+        if (file.exists()) file.remove();
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Removing " << path << " failed: " << ex.displayText();
+    }
+}
+
+bool fileExists(const std::string& path, Poco::UInt64& size) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) return false;
+    size = static_cast<Poco::UInt64>(info.st_size);
+    return true;
+}
+
+// Flushes a file, or with directory set the directory entries that name it, to disk
+void syncPath(const std::string& path, bool directory) {
+    int fd = ::open(path.c_str(), (directory ? O_RDONLY | O_DIRECTORY : O_WRONLY) | O_CLOEXEC);
+    if (fd < 0) throw Poco::OpenFileException(path);
+    int result = directory ? ::fsync(fd) : ::fdatasync(fd);
+    ::close(fd);
+    if (result != 0) throw Poco::WriteFileException(path);
+}
+
+}
+
+ReplicatedStorageBackend::ReplicatedStorageBackend(const std::vector<std::string>& roots,
+                                                   const std::string& stagingDirectory, size_t writeQuorum)
+    : stagingDirectory(stagingDirectory), writeQuorum(writeQuorum), stoppingWriters(false),
+      scanRequested(false), stoppingRepairs(false) {
+    repairQueueLimit = static_cast<size_t>(std::max(1L, Config::getInt("DFS_STORAGE_REPAIR_QUEUE", 10000)));
+    repairIntervalSeconds = std::max(1L, Config::getInt("DFS_STORAGE_REPAIR_INTERVAL_SECONDS", 3600));
+    probeIntervalSeconds = std::max(1L, Config::getInt("DFS_STORAGE_PROBE_SECONDS", 10));
+    repairBatchSize = static_cast<int>(std::max(1L, Config::getInt("DFS_STORAGE_REPAIR_BATCH", 500)));
+    repairPauseMillis = std::max(0L, Config::getInt("DFS_STORAGE_REPAIR_PAUSE_MS", 100));
+
+    // Writers record into the metrics, which must therefore be destroyed after this
+    Metrics::getInstance();
+
+    Utils::createDirectory(stagingDirectory);
+    for (const auto& root : roots) {
+        std::unique_ptr<Replica> replica(new Replica);
+        replica->root = root;
+        replica->loadUpdated = std::chrono::steady_clock::now();
+        if (!Utils::createDirectory(root)) markUnhealthy(*replica, "cannot create directory");
+        replicas.push_back(std::move(replica));
+    }
+
+    // Stores wait on these, so they run whether or not the server is started
+    for (size_t i = 0; i < replicas.size(); ++i) {
+        Replica& replica = *replicas[i];
+        replica.writer = std::thread([this, &replica, i]() { runWriter(replica, i); });
+    }
+}
+
+ReplicatedStorageBackend::~ReplicatedStorageBackend() {
+    stop();
+
+    // Copies already queued are finished, so every acknowledged file reaches every replica
+    for (auto& replica : replicas) {
+        {
+            std::lock_guard<std::mutex> lock(replica->queueMutex);
+            stoppingWriters = true;
+        }
+        replica->queueReady.notify_one();
+    }
+    for (auto& replica : replicas) {
+        if (replica->writer.joinable()) replica->writer.join();
+    }
+}
+
+void ReplicatedStorageBackend::start() {
+    std::lock_guard<std::mutex> lock(repairMutex);
+    if (repairer.joinable()) return;
+
+    stoppingRepairs = false;
+    repairer = std::thread([this]() { runRepairs(); });
+}
+
+void ReplicatedStorageBackend::stop() {
+    {
+        std::lock_guard<std::mutex> lock(repairMutex);
+        if (!repairer.joinable()) return;
+        stoppingRepairs = true;
+    }
+    repairReady.notify_one();
+    repairer.join();
+}
+
+std::vector<std::string> ReplicatedStorageBackend::getRoots() const {
+    std::vector<std::string> roots;
+    for (const auto& replica : replicas) roots.push_back(replica->root);
+    return roots;
+}
+
+std::string ReplicatedStorageBackend::getPrimaryPath(const std::string& filename) const {
+    return replicas.front()->root + filename;
+}
+
+void ReplicatedStorageBackend::store(const std::string& stagedPath, const std::string& filename) {
+    std::vector<size_t> targets;
+    for (size_t i = 0; i < replicas.size(); ++i) {
+        if (replicas[i]->healthy.load(std::memory_order_relaxed)) targets.push_back(i);
+    }
+    if (targets.size() < writeQuorum) {
+        quorumFailures.fetch_add(1, std::memory_order_relaxed);
+        throw Poco::IOException("Only " + std::to_string(targets.size()) + " of " +
+                                std::to_string(replicas.size()) + " storage replicas are healthy");
+    }
+
+    std::shared_ptr<WriteOp> op = std::make_shared<WriteOp>();
+    op->stagedPath = stagedPath;
+    op->filename = filename;
+    op->pending = targets.size();
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pendingWrites[filename] = op;
+    }
+
+    for (size_t index : targets) {
+        Replica& replica = *replicas[index];
+        {
+            std::lock_guard<std::mutex> lock(replica.queueMutex);
+            replica.queue.push_back(op);
+        }
+        replica.queueReady.notify_one();
+    }
+
+    std::unique_lock<std::mutex> lock(op->mutex);
+    op->progress.wait(lock, [&]() { return op->succeeded >= writeQuorum || op->pending == 0; });
+    if (op->succeeded < writeQuorum) {
+        quorumFailures.fetch_add(1, std::memory_order_relaxed);
+        throw Poco::IOException("Stored " + filename + " on " + std::to_string(op->succeeded) +
+                                " replicas, write quorum is " + std::to_string(writeQuorum));
+    }
+}
+
+void ReplicatedStorageBackend::runWriter(Replica& replica, size_t index) {
+    while (true) {
+        std::shared_ptr<WriteOp> op;
+        {
+            std::unique_lock<std::mutex> lock(replica.queueMutex);
+            replica.queueReady.wait(lock, [&]() { return stoppingWriters || !replica.queue.empty(); });
+            if (replica.queue.empty()) return;
+            op = std::move(replica.queue.front());
+            replica.queue.pop_front();
+        }
+
+        bool cancelled;
+        {
+            std::lock_guard<std::mutex> lock(op->mutex);
+            cancelled = op->cancelled;
+        }
+
+        bool ok = false;
+        if (!cancelled) {
+            std::string target = replica.root + op->filename;
+            try {
+                // Copied aside and renamed, so the stored name only ever holds a complete file
+                createParentDirectories(target);
+                {
+                    ScopedTimer timer(Metrics::getInstance().diskWrite());
+                    Poco::File(op->stagedPath).copyTo(target + ".part");
+                    syncPath(target + ".part", false);
+                }
+                ok = true;
+            }
+            catch (const Poco::Exception& ex) {
+                removeQuietly(target + ".part");
+                Poco::UInt64 size = 0;
+                if (fileExists(op->stagedPath, size)) markUnhealthy(replica, ex.displayText());
+            }
+        }
+        finishCopy(op, index, ok);
+    }
+}
+
+void ReplicatedStorageBackend::finishCopy(const std::shared_ptr<WriteOp>& op, size_t index, bool ok) {
+    Replica& replica = *replicas[index];
+    std::string target = replica.root + op->filename;
+    bool last;
+    {
+        // remove() cancels under this lock, so nothing is renamed into place after it ran
+        std::lock_guard<std::mutex> lock(op->mutex);
+        if (ok && !op->cancelled) {
+            try {
+                Poco::File(target + ".part").renameTo(target);
+                syncPath(getParentDirectory(target), true);
+            }
+            catch (const Poco::Exception& ex) {
+                ok = false;
+                markUnhealthy(replica, ex.displayText());
+            }
+        }
+        if (ok && !op->cancelled) {
+            ++op->succeeded;
+            replica.writes.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            removeQuietly(target + ".part");
+            if (!op->cancelled) {
+                op->failed.push_back(index);
+                replica.writeFailures.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        last = --op->pending == 0;
+    }
+    op->progress.notify_all();
+    if (!last) return;
+
+    // Every copy is done with the staged file
+    removeQuietly(op->stagedPath);
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        auto it = pendingWrites.find(op->filename);
+        if (it != pendingWrites.end() && it->second.lock() == op) pendingWrites.erase(it);
+    }
+    if (!op->cancelled && op->succeeded > 0 && !op->failed.empty()) scheduleRepair(op->filename);
+}
+
+std::string ReplicatedStorageBackend::locate(const std::string& filename) {
+    // Healthy replicas by recent read load, then the others as a last resort
+    std::vector<std::pair<double, size_t>> order;
+    {
+        std::lock_guard<std::mutex> lock(loadMutex);
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < replicas.size(); ++i) {
+            Replica& replica = *replicas[i];
+            double elapsed = std::chrono::duration<double>(now - replica.loadUpdated).count();
+            replica.readLoad *= std::exp(-elapsed);
+            replica.loadUpdated = now;
+            bool healthy = replica.healthy.load(std::memory_order_relaxed);
+            order.push_back(std::make_pair(healthy ? replica.readLoad : HUGE_VAL, i));
+        }
+    }
+    std::stable_sort(order.begin(), order.end());
+
+    bool missing = false;
+    for (const auto& candidate : order) {
+        Replica& replica = *replicas[candidate.second];
+        std::string path = replica.root + filename;
+        Poco::UInt64 size = 0;
+        if (!fileExists(path, size)) {
+            missing = missing || replica.healthy.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(loadMutex);
+            replica.readLoad += static_cast<double>(size);
+        }
+        replica.reads.fetch_add(1, std::memory_order_relaxed);
+        if (missing) scheduleRepair(filename);
+        return path;
+    }
+    return "";
+}
+
+void ReplicatedStorageBackend::remove(const std::string& filename) {
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        auto it = pendingWrites.find(filename);
+        if (it != pendingWrites.end()) {
+            if (std::shared_ptr<WriteOp> op = it->second.lock()) {
+                std::lock_guard<std::mutex> opLock(op->mutex);
+                op->cancelled = true;
+            }
+        }
+    }
+
+    for (const auto& replica : replicas) {
+        std::string path = replica->root + filename;
+        removeQuietly(path);
+        Compression::removeSidecars(path);
+    }
+}
+
+void ReplicatedStorageBackend::markUnhealthy(Replica& replica, const std::string& reason) {
+    if (replica.healthy.exchange(false)) {
+        DFS_LOG_ERROR << "Storage replica " << replica.root << " marked unhealthy: " << reason;
+    }
+}
+
+void ReplicatedStorageBackend::scheduleRepair(const std::string& filename) {
+    {
+        std::lock_guard<std::mutex> lock(repairMutex);
+        if (repairQueued.count(filename)) return;
+        if (repairQueue.size() >= repairQueueLimit) {
+            // The periodic scan finds it anyway
+            repairsDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        repairQueue.push_back(filename);
+        repairQueued.insert(filename);
+    }
+    repairReady.notify_one();
+}
+
+void ReplicatedStorageBackend::runRepairs() {
+    auto now = std::chrono::steady_clock::now();
+    auto nextProbe = now;
+    // The first scan soon after startup brings a newly added, empty replica up to date
+    auto nextScan = now + std::chrono::seconds(probeIntervalSeconds);
+    bool scanning = false;
+    std::string scanPosition;
+
+    std::unique_lock<std::mutex> lock(repairMutex);
+    while (!stoppingRepairs) {
+        auto wait = scanning ? std::chrono::milliseconds(repairPauseMillis) : std::chrono::milliseconds(probeIntervalSeconds * 1000);
+        repairReady.wait_for(lock, wait, [this]() { return stoppingRepairs || !repairQueue.empty() || scanRequested; });
+        if (stoppingRepairs) break;
+
+        // Files someone just asked for come before the scan
+        while (!repairQueue.empty() && !stoppingRepairs) {
+            std::string filename = std::move(repairQueue.front());
+            repairQueue.pop_front();
+            repairQueued.erase(filename);
+            lock.unlock();
+            repairFile(filename);
+            lock.lock();
+        }
+        if (scanRequested) {
+            scanRequested = false;
+            nextScan = std::chrono::steady_clock::now();
+        }
+        lock.unlock();
+
+        now = std::chrono::steady_clock::now();
+        if (now >= nextProbe) {
+            probeReplicas();
+            nextProbe = now + std::chrono::seconds(probeIntervalSeconds);
+        }
+        if (!scanning && now >= nextScan) {
+            scanning = true;
+            scanPosition.clear();
+        }
+        if (scanning && !scanBatch(scanPosition)) {
+            scanning = false;
+            nextScan = std::chrono::steady_clock::now() + std::chrono::seconds(repairIntervalSeconds);
+            scansCompleted.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        lock.lock();
+    }
+}
+
+bool ReplicatedStorageBackend::scanBatch(std::string& after) {
+    std::vector<std::string> filenames;
+    try {
+        auto session = Database::getInstance().getSession();
+        std::string from = after;
+        int batchSize = repairBatchSize;
+        Poco::Data::Statement select(session);
+        select << "SELECT DISTINCT filename FROM files WHERE filename > $1 ORDER BY filename LIMIT $2",
+            use(from), use(batchSize), into(filenames);
+        select.execute();
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Storage repair scan failed: " << ex.displayText();
+        return false;
+    }
+
+    for (const auto& filename : filenames) {
+        repairFile(filename);
+        // A chunked file is stored as its manifest and chunks
+        for (const auto& part : ChunkStore::getInstance().getPartFilenames(filename)) repairFile(part);
+    }
+    if (filenames.empty()) return false;
+
+    after = filenames.back();
+    return filenames.size() == static_cast<size_t>(repairBatchSize);
+}
+
+void ReplicatedStorageBackend::repairFile(const std::string& filename) {
+    {
+        // A store still in flight creates its own copies
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        auto it = pendingWrites.find(filename);
+        if (it != pendingWrites.end() && !it->second.expired()) return;
+    }
+
+    std::string source;
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < replicas.size(); ++i) {
+        Poco::UInt64 size = 0;
+        if (fileExists(replicas[i]->root + filename, size)) {
+            if (source.empty()) source = replicas[i]->root + filename;
+        }
+        else if (replicas[i]->healthy.load(std::memory_order_relaxed)) {
+            missing.push_back(i);
+        }
+    }
+    if (source.empty() || missing.empty()) return;
+
+    for (size_t index : missing) {
+        Replica& replica = *replicas[index];
+        std::string target = replica.root + filename;
+        try {
+            createParentDirectories(target);
+            // Flushed before and after the rename, like a first copy
+            Poco::File(source).copyTo(target + ".repair");
+            syncPath(target + ".repair", false);
+            Poco::File(target + ".repair").renameTo(target);
+            syncPath(getParentDirectory(target), true);
+            replica.repairs.fetch_add(1, std::memory_order_relaxed);
+        }
+        catch (const Poco::Exception& ex) {
+            removeQuietly(target + ".repair");
+            Poco::UInt64 size = 0;
+            if (!fileExists(source, size)) return;  // Deleted while we copied
+            markUnhealthy(replica, ex.displayText());
+            continue;
+        }
+
+        // A delete that ran meanwhile removed the other copies before this one existed
+        Poco::UInt64 size = 0;
+        if (!fileExists(source, size)) {
+            removeQuietly(target);
+            return;
+        }
+    }
+    DFS_LOG_INFO << "Storage: repaired " << filename << " on " << missing.size() << " replicas";
+}
+
+void ReplicatedStorageBackend::probeReplicas() {
+    for (auto& replica : replicas) {
+        std::string probe = replica->root + ".probe";
+        bool ok = false;
+        try {
+            {
+                std::ofstream out(probe, std::ios::binary | std::ios::trunc);
+                out << "probe";
+                out.close();
+                ok = static_cast<bool>(out);
+            }
+            Poco::File(probe).remove();
+        }
+        catch (const Poco::Exception&) {
+            ok = false;
+        }
+
+        if (!ok) {
+            markUnhealthy(*replica, "probe write failed");
+        }
+        else if (!replica->healthy.exchange(true)) {
+            // It missed every write while it was out
+            DFS_LOG_INFO << "Storage replica " << replica->root << " is healthy again";
+            std::lock_guard<std::mutex> lock(repairMutex);
+            scanRequested = true;
+        }
+    }
+}
+
+void ReplicatedStorageBackend::render(std::ostream& out) const {
+    out << "# TYPE dfs_storage_replica_healthy gauge\n";
+    for (const auto& replica : replicas) {
+        out << "dfs_storage_replica_healthy{replica=\"" << replica->root << "\"} "
+            << (replica->healthy.load(std::memory_order_relaxed) ? 1 : 0) << "\n";
+    }
+    out << "# TYPE dfs_storage_replica_reads_total counter\n";
+    for (const auto& replica : replicas) {
+        out << "dfs_storage_replica_reads_total{replica=\"" << replica->root << "\"} "
+            << replica->reads.load(std::memory_order_relaxed) << "\n";
+    }
+    out << "# TYPE dfs_storage_replica_writes_total counter\n";
+    for (const auto& replica : replicas) {
+        out << "dfs_storage_replica_writes_total{replica=\"" << replica->root << "\",result=\"ok\"} "
+            << replica->writes.load(std::memory_order_relaxed) << "\n";
+        out << "dfs_storage_replica_writes_total{replica=\"" << replica->root << "\",result=\"failed\"} "
+            << replica->writeFailures.load(std::memory_order_relaxed) << "\n";
+    }
+    out << "# TYPE dfs_storage_replica_repairs_total counter\n";
+    for (const auto& replica : replicas) {
+        out << "dfs_storage_replica_repairs_total{replica=\"" << replica->root << "\"} "
+            << replica->repairs.load(std::memory_order_relaxed) << "\n";
+    }
+    out << "# TYPE dfs_storage_quorum_failures_total counter\n";
+    out << "dfs_storage_quorum_failures_total " << quorumFailures.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_storage_repairs_dropped_total counter\n";
+    out << "dfs_storage_repairs_dropped_total " << repairsDropped.load(std::memory_order_relaxed) << "\n";
+    out << "# TYPE dfs_storage_repair_scans_total counter\n";
+    out << "dfs_storage_repair_scans_total " << scansCompleted.load(std::memory_order_relaxed) << "\n";
+}
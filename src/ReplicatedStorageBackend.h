@@ -0,0 +1,112 @@
+#ifndef REPLICATEDSTORAGEBACKEND_H
+#define REPLICATEDSTORAGEBACKEND_H
+
+#include "StorageBackend.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Keeps a full copy of every stored file under each of N roots, normally one per
+// disk. Each root has its own writer thread, so a store copies to all of them in
+// parallel and returns once the write quorum has landed; the rest finish in the
+// background. Reads go to the healthy copy whose disk has served the fewest bytes
+// recently. Copies that are missing, because a write failed or a disk was
+// replaced, are rebuilt by a repair thread that also walks the files table.
+class ReplicatedStorageBackend : public StorageBackend {
+public:
+    ReplicatedStorageBackend(const std::vector<std::string>& roots, const std::string& stagingDirectory,
+                             size_t writeQuorum);
+    ~ReplicatedStorageBackend() override;
+
+    void start() override;
+    void stop() override;
+
+    std::string getStagingDirectory() const override { return stagingDirectory; }
+    std::vector<std::string> getRoots() const override;
+    std::string getPrimaryPath(const std::string& filename) const override;
+
+    void store(const std::string& stagedPath, const std::string& filename) override;
+    std::string locate(const std::string& filename) override;
+    void remove(const std::string& filename) override;
+
+    void render(std::ostream& out) const override;
+
+private:
+    // Shared by the copies of one store() call
+    struct WriteOp {
+        std::mutex mutex;
+        std::condition_variable progress;
+        std::string stagedPath;
+        std::string filename;
+        size_t pending = 0;
+        size_t succeeded = 0;
+        bool cancelled = false;  // Removed before every copy landed
+        std::vector<size_t> failed;
+    };
+
+    struct Replica {
+        std::string root;
+        std::atomic<bool> healthy{true};
+
+        std::mutex queueMutex;
+        std::condition_variable queueReady;
+        std::deque<std::shared_ptr<WriteOp>> queue;
+        std::thread writer;
+
+        // Bytes handed out for reading, decaying with a one second time constant
+        double readLoad = 0;
+        std::chrono::steady_clock::time_point loadUpdated;
+
+        std::atomic<uint64_t> reads{0};
+        std::atomic<uint64_t> writes{0};
+        std::atomic<uint64_t> writeFailures{0};
+        std::atomic<uint64_t> repairs{0};
+    };
+
+    void runWriter(Replica& replica, size_t index);
+    void finishCopy(const std::shared_ptr<WriteOp>& op, size_t index, bool ok);
+    void markUnhealthy(Replica& replica, const std::string& reason);
+
+    void scheduleRepair(const std::string& filename);
+    void runRepairs();
+    void repairFile(const std::string& filename);
+    void probeReplicas();
+    bool scanBatch(std::string& after);
+
+    std::vector<std::unique_ptr<Replica>> replicas;
+    std::string stagingDirectory;
+    size_t writeQuorum;
+    std::atomic<bool> stoppingWriters;
+
+    std::mutex loadMutex;
+
+    std::mutex pendingMutex;
+    std::map<std::string, std::weak_ptr<WriteOp>> pendingWrites;
+
+    std::mutex repairMutex;
+    std::condition_variable repairReady;
+    std::deque<std::string> repairQueue;
+    std::set<std::string> repairQueued;
+    size_t repairQueueLimit;
+    long repairIntervalSeconds;
+    long probeIntervalSeconds;
+    int repairBatchSize;
+    long repairPauseMillis;
+    bool scanRequested;
+    bool stoppingRepairs;
+    std::thread repairer;
+
+    std::atomic<uint64_t> quorumFailures{0};
+    std::atomic<uint64_t> repairsDropped{0};
+    std::atomic<uint64_t> scansCompleted{0};
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include "RequestLanes.h"
+#include "Config.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+namespace {
+
+struct LaneDefaults {
+    const char* prefix;
+    long threads;
+    long queued;
+    long waitMillis;
+};
+
+// Transfers queue briefly and then shed load; auth and metadata requests are short,
+// so they may wait a little longer for a slot
+const LaneDefaults DEFAULTS[RequestLanes::LANE_COUNT] = {
+    { "DFS_LANE_AUTH", 4, 32, 2000 },
+    { "DFS_LANE_METADATA", 6, 64, 2000 },
+    { "DFS_LANE_TRANSFER", 8, 16, 500 },
+};
+
+}
+
+void RequestLanes::Ticket::release() {
+    if (owner) {
+        owner->release(lane);
+        owner = nullptr;
+    }
+}
+
+RequestLanes& RequestLanes::getInstance() {
+    static RequestLanes instance;
+    return instance;
+}
+
+const char* RequestLanes::laneName(Lane lane) {
+    switch (lane) {
+        case LANE_AUTH: return "auth";
+        case LANE_METADATA: return "metadata";
+        case LANE_TRANSFER: return "transfer";
+        default: return "unknown";
+    }
+}
+
+RequestLanes::RequestLanes() {
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        const LaneDefaults& defaults = DEFAULTS[i];
+        std::string prefix = defaults.prefix;
+        State& state = lanes[i];
+
+        state.maxActive = static_cast<int>(std::max(1L, Config::getInt(prefix + "_THREADS", defaults.threads)));
+        state.maxQueued = static_cast<int>(std::max(0L, Config::getInt(prefix + "_QUEUE", defaults.queued)));
+        state.maxWaitMillis = std::max(0L, Config::getInt(prefix + "_WAIT_MS", defaults.waitMillis));
+        state.active = 0;
+        state.queued = 0;
+    }
+}
+
+bool RequestLanes::admit(Lane lane, Ticket& ticket) {
+    State& state = lanes[lane];
+    auto started = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    if (state.active >= state.maxActive) {
+        if (state.queued >= state.maxQueued) {
+            state.rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        ++state.queued;
+        bool freed = state.slotFreed.wait_for(lock, std::chrono::milliseconds(state.maxWaitMillis),
+                                              [&state]() { return state.active < state.maxActive; });
+        --state.queued;
+
+        if (!freed) {
+            state.timedOut.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    ++state.active;
+    lock.unlock();
+
+    state.admitted.fetch_add(1, std::memory_order_relaxed);
+    state.waitTime.observe(std::chrono::steady_clock::now() - started);
+
+    ticket.release();
+    ticket.owner = this;
+    ticket.lane = lane;
+    return true;
+}
+
+void RequestLanes::release(Lane lane) {
+    State& state = lanes[lane];
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        --state.active;
+    }
+    state.slotFreed.notify_one();
+}
+
+int RequestLanes::totalThreads() const {
+    int total = 0;
+    for (const auto& state : lanes) {
+        total += state.maxActive + state.maxQueued;
+    }
+    // One spare for requests that are not assigned to a lane (preflight, 404s)
+    return total + 1;
+}
+
+void RequestLanes::render(std::ostream& out) {
+    std::array<int, LANE_COUNT> active;
+    std::array<int, LANE_COUNT> queued;
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        std::lock_guard<std::mutex> lock(lanes[i].mutex);
+        active[i] = lanes[i].active;
+        queued[i] = lanes[i].queued;
+    }
+
+    out << "# TYPE dfs_lane_active gauge\n";
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        out << "dfs_lane_active{lane=\"" << laneName(static_cast<Lane>(i)) << "\"} " << active[i] << "\n";
+    }
+    out << "# TYPE dfs_lane_queue_depth gauge\n";
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        out << "dfs_lane_queue_depth{lane=\"" << laneName(static_cast<Lane>(i)) << "\"} " << queued[i] << "\n";
+    }
+    out << "# TYPE dfs_lane_capacity gauge\n";
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        std::string lane = laneName(static_cast<Lane>(i));
+        out << "dfs_lane_capacity{lane=\"" << lane << "\",kind=\"threads\"} " << lanes[i].maxActive << "\n";
+        out << "dfs_lane_capacity{lane=\"" << lane << "\",kind=\"queue\"} " << lanes[i].maxQueued << "\n";
+    }
+
+    out << "# TYPE dfs_lane_admissions_total counter\n";
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        const State& state = lanes[i];
+        std::string lane = laneName(static_cast<Lane>(i));
+        out << "dfs_lane_admissions_total{lane=\"" << lane << "\",result=\"admitted\"} "
+            << state.admitted.load(std::memory_order_relaxed) << "\n";
+        out << "dfs_lane_admissions_total{lane=\"" << lane << "\",result=\"queue_full\"} "
+            << state.rejected.load(std::memory_order_relaxed) << "\n";
+        out << "dfs_lane_admissions_total{lane=\"" << lane << "\",result=\"wait_timeout\"} "
+            << state.timedOut.load(std::memory_order_relaxed) << "\n";
+    }
+
+    out << "# TYPE dfs_lane_wait_seconds histogram\n";
+    for (int i = 0; i < LANE_COUNT; ++i) {
+        std::string lane = std::string("lane=\"") + laneName(static_cast<Lane>(i)) + "\"";
+        lanes[i].waitTime.render(out, "dfs_lane_wait_seconds", lane);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef REQUESTLANES_H
+#define REQUESTLANES_H
+
+#include "Metrics.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+// Admission control per request class. Each lane has its own worker budget and
+// wait queue, and the Poco thread pool is sized to the sum of all lanes, so a
+// burst of uploads can only ever occupy the transfer lane's threads while
+// logins and listings keep theirs.
+class RequestLanes {
+public:
+    enum Lane { LANE_AUTH, LANE_METADATA, LANE_TRANSFER, LANE_COUNT };
+
+    // Releases the lane slot when the handler finishes, however it exits
+    class Ticket {
+    public:
+        Ticket() : owner(nullptr), lane(LANE_COUNT) {}
+        ~Ticket() { release(); }
+
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+        void release();
+
+    private:
+        friend class RequestLanes;
+        RequestLanes* owner;
+        Lane lane;
+    };
+
+    static RequestLanes& getInstance();
+    static const char* laneName(Lane lane);
+
+    // Waits for a free slot in the lane's queue; false when the queue is full or
+    // the wait limit passed, in which case the caller should answer 503
+    bool admit(Lane lane, Ticket& ticket);
+
+    // Worker threads needed so that every lane can run and queue at full size at once
+    int totalThreads() const;
+
+    void render(std::ostream& out);
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable slotFreed;
+        int maxActive;
+        int maxQueued;
+        long maxWaitMillis;
+        int active;
+        int queued;
+
+        std::atomic<uint64_t> admitted{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> timedOut{0};
+        Histogram waitTime;
+    };
+
+    RequestLanes();
+    void release(Lane lane);
+
+    std::array<State, LANE_COUNT> lanes;
+};
+
+#endif
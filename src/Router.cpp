@@ -0,0 +1,127 @@
+#include "Router.h"
+#include <Poco/Exception.h>
+#include <Poco/NumberParser.h>
+#include <string_view>
+
+namespace {
+
+// Yields the next '/'-separated segment of a path that starts with '/'
+bool nextSegment(std::string_view& rest, std::string_view& segment) {
+    if (rest.empty() || rest.front() != '/') return false;
+    rest.remove_prefix(1);
+    std::string_view::size_type slash = rest.find('/');
+    segment = rest.substr(0, slash);
+    rest = slash == std::string_view::npos ? std::string_view() : rest.substr(slash);
+    return true;
+}
+
+}
+
+const std::string& RouteMatch::param(const std::string& name) const {
+    static const std::string empty;
+    for (const auto& p : params) {
+        if (*p.name == name) return p.text;
+    }
+    return empty;
+}
+
+Poco::Int64 RouteMatch::intParam(const std::string& name) const {
+    for (const auto& p : params) {
+        if (*p.name == name) return p.number;
+    }
+    return 0;
+}
+
+Router::Router() {}
+
+void Router::add(const std::string& method, const std::string& pattern, RouteHandler handler,
+                 Metrics::Route metric, RequestLanes::Lane lane) {
+    Node* node = &root;
+    std::string_view rest(pattern);
+    std::string_view segment;
+
+    while (nextSegment(rest, segment)) {
+        if (segment.size() > 2 && segment.front() == '{' && segment.back() == '}') {
+            std::string_view spec = segment.substr(1, segment.size() - 2);
+            std::string_view::size_type colon = spec.find(':');
+            std::string name(spec.substr(0, colon));
+            ParamType type = PARAM_STRING;
+            if (colon != std::string_view::npos) {
+                if (spec.substr(colon + 1) != "int") {
+                    throw Poco::InvalidArgumentException("Unknown parameter type in route", pattern);
+                }
+                type = PARAM_INT;
+            }
+
+            if (!node->param) {
+                node->param.reset(new Node());
+                node->param->paramName = name;
+                node->param->paramType = type;
+            }
+            else if (node->param->paramName != name || node->param->paramType != type) {
+                throw Poco::InvalidArgumentException("Conflicting parameter in route", pattern);
+            }
+            node = node->param.get();
+        }
+        else {
+            auto it = node->literals.find(segment);
+            if (it == node->literals.end()) {
+                it = node->literals.emplace(std::string(segment), std::unique_ptr<Node>(new Node())).first;
+            }
+            node = it->second.get();
+        }
+    }
+
+    for (const Route* existing : node->routes) {
+        if (existing->method == method) {
+            throw Poco::ExistsException("Duplicate route", method + " " + pattern);
+        }
+    }
+
+    routes.push_back(Route{method, pattern, handler, metric, lane});
+    node->routes.push_back(&routes.back());
+}
+
+bool Router::match(const std::string& method, const std::string& target, RouteMatch& match) const {
+    match.route = nullptr;
+    match.params.clear();
+
+    try {
+        match.uri = Poco::URI(target);
+    }
+    catch (const Poco::SyntaxException&) {
+        return false;
+    }
+
+    const Node* node = &root;
+    const std::string& path = match.uri.getPath();
+    std::string_view rest(path);
+    std::string_view segment;
+
+    // Literal segments take precedence over a parameter at the same position
+    while (nextSegment(rest, segment)) {
+        auto it = node->literals.find(segment);
+        if (it != node->literals.end()) {
+            node = it->second.get();
+            continue;
+        }
+
+        const Node* param = node->param.get();
+        if (!param || segment.empty()) return false;
+
+        PathParam value{&param->paramName, std::string(segment), 0};
+        if (param->paramType == PARAM_INT && !Poco::NumberParser::tryParse64(value.text, value.number)) {
+            return false;
+        }
+        match.params.push_back(std::move(value));
+        node = param;
+    }
+
+    for (const Route* route : node->routes) {
+        if (route->method == method) {
+            match.route = route;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,79 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "Metrics.h"
+#include "RequestLanes.h"
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Types.h>
+#include <Poco/URI.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class RouteMatch;
+
+typedef void (*RouteHandler)(Poco::Net::HTTPServerRequest& request,
+                             Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+
+struct Route {
+    std::string method;
+    std::string pattern;
+    RouteHandler handler;
+    Metrics::Route metric;
+    RequestLanes::Lane lane;
+};
+
+struct PathParam {
+    const std::string* name;
+    std::string text;
+    Poco::Int64 number;  // Only meaningful for {name:int} segments
+};
+
+// Result of routing one request. The target URI is parsed exactly once, here,
+// and handlers read their path parameters and query from it.
+class RouteMatch {
+public:
+    RouteMatch() : route(nullptr) {}
+
+    const Route* route;
+    Poco::URI uri;
+    std::vector<PathParam> params;
+
+    const std::string& param(const std::string& name) const;
+    Poco::Int64 intParam(const std::string& name) const;
+};
+
+// Method + path route table built once at startup. Patterns are literal
+// segments plus {name} or {name:int} placeholders, e.g. "/uploads/{id}/complete";
+// lookups walk a segment trie, so cost grows with path depth, not route count.
+class Router {
+public:
+    Router();
+
+    void add(const std::string& method, const std::string& pattern, RouteHandler handler,
+             Metrics::Route metric, RequestLanes::Lane lane);
+
+    // Parses the request target into match.uri; false when no route fits
+    bool match(const std::string& method, const std::string& target, RouteMatch& match) const;
+
+private:
+    enum ParamType { PARAM_STRING, PARAM_INT };
+
+    struct Node {
+        std::map<std::string, std::unique_ptr<Node>, std::less<>> literals;
+        std::unique_ptr<Node> param;
+        std::string paramName;
+        ParamType paramType;
+        std::vector<const Route*> routes;  // One per method
+
+        Node() : paramType(PARAM_STRING) {}
+    };
+
+    Node root;
+    std::deque<Route> routes;  // Stable addresses for the trie and for RouteMatch
+};
+
+#endif
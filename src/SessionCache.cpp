@@ -0,0 +1,141 @@
+#include "SessionCache.h"
+#include "Config.h"
+#include "Cluster.h"
+#include "Logger.h"
+#include <functional>
+
+SessionCache& SessionCache::getInstance() {
+    static SessionCache instance;
+    return instance;
+}
+
+SessionCache::SessionCache() {
+    positiveTtl = Config::getInt("DFS_SESSION_CACHE_TTL_SECONDS", 60) * Poco::Timestamp::resolution();
+    negativeTtl = Config::getInt("DFS_SESSION_CACHE_NEGATIVE_TTL_SECONDS", 5) * Poco::Timestamp::resolution();
+    // A logout on another node could not reach this node's entries
+    if (Cluster::getInstance().isEnabled()) {
+        positiveTtl = 0;
+        negativeTtl = 0;
+        DFS_LOG_INFO << "Session cache is off in cluster mode";
+    }
+    
+    long maxEntries = Config::getInt("DFS_SESSION_CACHE_MAX_ENTRIES", 100000);
+    maxEntriesPerShard = maxEntries > 0 ? static_cast<size_t>(maxEntries) / SHARD_COUNT + 1 : 1;
+}
+
+SessionCache::Shard& SessionCache::shardFor(const std::string& token) {
+    return shards[std::hash<std::string>()(token) % SHARD_COUNT];
+}
+
+SessionCache::LookupResult SessionCache::lookup(const std::string& token, int& userId) {
+    Shard& shard = shardFor(token);
+    Poco::Timestamp now;
+    
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(token);
+        if (it != shard.entries.end()) {
+            if (it->second.expiresAt > now) {
+                if (it->second.userId > 0) {
+                    userId = it->second.userId;
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return HIT_VALID;
+                }
+                negativeHits.fetch_add(1, std::memory_order_relaxed);
+                return HIT_INVALID;
+            }
+            shard.entries.erase(it);
+        }
+    }
+    
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return MISS;
+}
+
+uint64_t SessionCache::getGeneration(const std::string& token) {
+    Shard& shard = shardFor(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.generation;
+}
+
+void SessionCache::storeValid(const std::string& token, int userId, const Poco::Timestamp& sessionExpiry, 
+                              uint64_t generation) {
+    if (positiveTtl <= 0) return;
+    
+    Poco::Timestamp expiresAt;
+    expiresAt += positiveTtl;
+    if (sessionExpiry < expiresAt) expiresAt = sessionExpiry;
+    
+    insert(token, Entry{userId, expiresAt}, &generation);
+}
+
+void SessionCache::storeInvalid(const std::string& token) {
+    if (negativeTtl <= 0) return;
+    
+    Poco::Timestamp expiresAt;
+    expiresAt += negativeTtl;
+    insert(token, Entry{0, expiresAt});
+}
+
+bool SessionCache::insert(const std::string& token, const Entry& entry, const uint64_t* generation) {
+    Shard& shard = shardFor(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (generation && *generation != shard.generation) return false;
+    
+    if (shard.entries.size() >= maxEntriesPerShard && shard.entries.find(token) == shard.entries.end()) {
+        // Make room: expired entries first, then an arbitrary one
+        Poco::Timestamp now;
+        for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+            if (it->second.expiresAt <= now) {
+                it = shard.entries.erase(it);
+                evictions.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                ++it;
+            }
+        }
+        if (shard.entries.size() >= maxEntriesPerShard) {
+            // A flood of bogus tokens must not push out real sessions
+            if (entry.userId == 0) return false;
+            shard.entries.erase(shard.entries.begin());
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    
+    shard.entries[token] = entry;
+    return true;
+}
+
+void SessionCache::invalidate(const std::string& token) {
+    Shard& shard = shardFor(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.entries.erase(token);
+    ++shard.generation;
+}
+
+void SessionCache::purgeExpired() {
+    Poco::Timestamp now;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+            if (it->second.expiresAt <= now) {
+                it = shard.entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+SessionCacheStats SessionCache::getStats() {
+    SessionCacheStats stats;
+    stats.hits = hits.load(std::memory_order_relaxed);
+    stats.negativeHits = negativeHits.load(std::memory_order_relaxed);
+    stats.misses = misses.load(std::memory_order_relaxed);
+    stats.evictions = evictions.load(std::memory_order_relaxed);
+    stats.entries = 0;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.entries += shard.entries.size();
+    }
+    return stats;
+}
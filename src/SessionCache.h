@@ -0,0 +1,71 @@
+#ifndef SESSIONCACHE_H
+#define SESSIONCACHE_H
+
+#include <Poco/Timestamp.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct SessionCacheStats {
+    uint64_t hits;
+    uint64_t negativeHits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+};
+
+// Sharded in-memory map of session token -> user id, consulted before the
+// user_sessions table. Entries live until the session expires or the cache TTL
+// runs out, whichever is first; unknown tokens are cached briefly as negatives.
+// Each shard counts its invalidations, so a fill from a database read that began
+// before a logout is dropped instead of reviving the token.
+class SessionCache {
+public:
+    enum LookupResult { MISS, HIT_VALID, HIT_INVALID };
+    
+    static SessionCache& getInstance();
+    
+    LookupResult lookup(const std::string& token, int& userId);
+    // Taken before reading the database; storeValid skips the fill if it changed since
+    uint64_t getGeneration(const std::string& token);
+    void storeValid(const std::string& token, int userId, const Poco::Timestamp& sessionExpiry, 
+                    uint64_t generation);
+    void storeInvalid(const std::string& token);
+    void invalidate(const std::string& token);
+    void purgeExpired();
+    SessionCacheStats getStats();
+    
+private:
+    static const size_t SHARD_COUNT = 16;
+    
+    struct Entry {
+        int userId;  // 0 marks a negative entry
+        Poco::Timestamp expiresAt;
+    };
+    
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        uint64_t generation = 0;  // Bumped by every invalidate
+    };
+    
+    SessionCache();
+    Shard& shardFor(const std::string& token);
+    // Returns false, storing nothing, if generation is given and no longer current
+    bool insert(const std::string& token, const Entry& entry, const uint64_t* generation = nullptr);
+    
+    std::array<Shard, SHARD_COUNT> shards;
+    Poco::Timestamp::TimeDiff positiveTtl;
+    Poco::Timestamp::TimeDiff negativeTtl;
+    size_t maxEntriesPerShard;
+    
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> negativeHits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> evictions{0};
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "StorageBackend.h"
+#include "ReplicatedStorageBackend.h"
+#include "FileManager.h"
+#include "Compression.h"
+#include "Config.h"
+#include "Logger.h"
+#include "Utils.h"
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/String.h>
+#include <Poco/StringTokenizer.h>
+#include <algorithm>
+#include <memory>
+
+namespace {
+
+std::string asDirectory(const std::string& path) {
+    return (path.empty() || path.back() == '/') ? path : path + "/";
+}
+
+StorageBackend* createBackend() {
+    std::string kind = Poco::toLower(Config::getString("DFS_STORAGE_BACKEND", "local"));
+
+    if (kind == "replicated") {
+        std::vector<std::string> roots;
+        Poco::StringTokenizer replicas(Config::getString("DFS_STORAGE_REPLICAS", ""), ",",
+                                       Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        for (const auto& replica : replicas) roots.push_back(asDirectory(replica));
+
+        if (!roots.empty()) {
+            // A majority by default, so any two successful writes overlap
+            long quorum = Config::getInt("DFS_STORAGE_WRITE_QUORUM", static_cast<long>(roots.size() / 2 + 1));
+            quorum = std::max(1L, std::min(quorum, static_cast<long>(roots.size())));
+            std::string staging = asDirectory(Config::getString("DFS_STORAGE_STAGING_DIR", roots.front()));
+
+            DFS_LOG_INFO << "Storage: " << roots.size() << " replicas, write quorum " << quorum;
+            return new ReplicatedStorageBackend(roots, staging, static_cast<size_t>(quorum));
+        }
+        DFS_LOG_ERROR << "Storage: DFS_STORAGE_REPLICAS is empty, using the local backend";
+    }
+    else if (kind != "local") {
+        DFS_LOG_ERROR << "Storage: unknown backend \"" << kind << "\", using the local backend";
+    }
+
+    return new LocalStorageBackend("./uploads/");
+}
+
+}
+
+StorageBackend& StorageBackend::getInstance() {
+    static std::unique_ptr<StorageBackend> instance(createBackend());
+    return *instance;
+}
+
+LocalStorageBackend::LocalStorageBackend(const std::string& root) : root(root) {
+    Utils::createDirectory(root);
+}
+
+void LocalStorageBackend::store(const std::string& stagedPath, const std::string& filename) {
+    try {
+        // rename(2) is atomic, so the stored name only ever holds a complete file
+        FileManager::moveIntoStore(stagedPath, root + filename);
+    }
+    catch (const Poco::Exception&) {
+        Poco::File staged(stagedPath);
+        if (staged.exists()) staged.remove();
+        throw;
+    }
+}
+
+std::string LocalStorageBackend::locate(const std::string& filename) {
+    std::string path = root + filename;
+    return Poco::File(path).exists() ? path : "";
+}
+
+void LocalStorageBackend::remove(const std::string& filename) {
+    std::string path = root + filename;
+    try {
+        Poco::File file(path);
+        if (file.exists()) file.remove();
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Removing " << filename << " failed: " << ex.displayText();
+    }
+    Compression::removeSidecars(path);
+}
@@ -0,0 +1,55 @@
+#ifndef STORAGEBACKEND_H
+#define STORAGEBACKEND_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Where stored files live. FileManager names them relative to the store
+// ("ab/cd/<sha256>") and asks the backend for a local path whenever it reads,
+// so downloads keep using sendfile whichever backend is configured.
+class StorageBackend {
+public:
+    // Chosen once from DFS_STORAGE_BACKEND: "local" (default) or "replicated"
+    static StorageBackend& getInstance();
+    virtual ~StorageBackend() {}
+
+    virtual void start() {}
+    virtual void stop() {}
+
+    // Uploads are written here before they are stored
+    virtual std::string getStagingDirectory() const = 0;
+    // Every directory that holds stored files
+    virtual std::vector<std::string> getRoots() const = 0;
+    // Recorded in files.file_path; names the preferred copy, which may be missing
+    virtual std::string getPrimaryPath(const std::string& filename) const = 0;
+
+    // Stores a complete staged file under filename; the staged file belongs to the
+    // backend from then on. Throws Poco::Exception if it could not be stored.
+    virtual void store(const std::string& stagedPath, const std::string& filename) = 0;
+    // Path of a readable copy, or "" when there is none
+    virtual std::string locate(const std::string& filename) = 0;
+    // Removes every copy, along with its precompressed sidecars
+    virtual void remove(const std::string& filename) = 0;
+
+    virtual void render(std::ostream& out) const {}
+};
+
+// One directory on one disk: the layout the server has always used
+class LocalStorageBackend : public StorageBackend {
+public:
+    explicit LocalStorageBackend(const std::string& root);
+
+    std::string getStagingDirectory() const override { return root; }
+    std::vector<std::string> getRoots() const override { return std::vector<std::string>(1, root); }
+    std::string getPrimaryPath(const std::string& filename) const override { return root + filename; }
+
+    void store(const std::string& stagedPath, const std::string& filename) override;
+    std::string locate(const std::string& filename) override;
+    void remove(const std::string& filename) override;
+
+private:
+    std::string root;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "StorageMigrator.h"
+#include "FileManager.h"
+#include "StorageBackend.h"
+#include "Database.h"
+#include "Logger.h"
+#include <Poco/Data/Statement.h>
+#include <Poco/Exception.h>
+#include <Poco/File.h>
+#include <Poco/Thread.h>
+#include <set>
+#include <vector>
+
+using namespace Poco::Data::Keywords;
+
+bool StorageMigrator::moveFile(const std::string& filename, const std::string& fanoutFilename, 
+                               MigrationStats& stats) {
+    bool moved = false;
+    bool alreadyMoved = false;
+    
+    try {
+        // Every storage root keeps its copy under the same name
+        for (const auto& root : StorageBackend::getInstance().getRoots()) {
+            std::string fromPath = root + filename;
+            std::string toPath = root + fanoutFilename;
+            
+            Poco::File source(fromPath);
+            if (source.exists()) {
+                FileManager::moveIntoStore(fromPath, toPath);
+                moved = true;
+            }
+            // An earlier, interrupted run may have moved it without rewriting the row
+            else if (Poco::File(toPath).exists()) {
+                alreadyMoved = true;
+            }
+        }
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Migration: moving " << filename << " failed: " << ex.displayText();
+        ++stats.failed;
+        return false;
+    }
+    
+    if (moved) {
+        ++stats.filesMoved;
+    } else if (alreadyMoved) {
+        ++stats.alreadyMoved;
+    } else {
+        DFS_LOG_WARN << "Migration: " << filename << " is missing from disk";
+        ++stats.missing;
+    }
+    return true;
+}
+
+bool StorageMigrator::migrateBatch(int batchSize, MigrationStats& stats) {
+    static std::set<std::string> skipped;  // Failures are not retried within one process
+    
+    try {
+        auto session = Database::getInstance().getSession();
+        
+        std::vector<std::string> filenames;
+        int fetchLimit = batchSize + static_cast<int>(skipped.size());
+        Poco::Data::Statement select(session);
+        select << "SELECT DISTINCT filename FROM files WHERE filename NOT LIKE '%/%' LIMIT $1",
+            use(fetchLimit), into(filenames);
+        select.execute();
+        
+        int processed = 0;
+        for (const auto& filename : filenames) {
+            if (skipped.count(filename)) continue;
+            if (processed++ >= batchSize) break;
+            
+            std::string fanoutFilename = FileManager::getFanoutFilename(filename);
+            if (!moveFile(filename, fanoutFilename, stats)) {
+                skipped.insert(filename);
+                continue;
+            }
+            
+            // Several rows can share one deduplicated blob; rewrite them all at once
+            std::string oldName = filename;
+            std::string newName = fanoutFilename;
+            std::string newPath = StorageBackend::getInstance().getPrimaryPath(fanoutFilename);
+            Poco::Data::Statement update(session);
+            update << "UPDATE files SET filename = $1, file_path = $2 WHERE filename = $3",
+                use(newName), use(newPath), use(oldName);
+            stats.rowsUpdated += static_cast<long>(update.execute());
+        }
+        
+        return processed > 0;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Migration batch failed: " << ex.displayText();
+        return false;
+    }
+}
+
+MigrationStats StorageMigrator::migrateAll(int batchSize, int pauseMillis) {
+    MigrationStats stats;
+    
+    while (migrateBatch(batchSize, stats)) {
+        DFS_LOG_INFO << "Migration progress: " << stats.filesMoved << " moved, " 
+                     << stats.rowsUpdated << " rows updated";
+        
+        // Leave disk and database headroom for live traffic
+        if (pauseMillis > 0) Poco::Thread::sleep(pauseMillis);
+    }
+    
+    DFS_LOG_INFO << "Migration finished: " << stats.filesMoved << " moved, " 
+                 << stats.alreadyMoved << " already in place, " << stats.missing << " missing, " 
+                 << stats.failed << " failed, " << stats.rowsUpdated << " rows updated";
+    return stats;
+}
@@ -0,0 +1,28 @@
+#ifndef STORAGEMIGRATOR_H
+#define STORAGEMIGRATOR_H
+
+#include <string>
+
+struct MigrationStats {
+    long filesMoved = 0;
+    long alreadyMoved = 0;
+    long missing = 0;
+    long failed = 0;
+    long rowsUpdated = 0;
+};
+
+// Moves files stored flat in the uploads directory into the fan-out layout and
+// rewrites files.filename/file_path in batches. Safe to run while the server is
+// serving: FileManager resolves both locations until a row is rewritten.
+class StorageMigrator {
+public:
+    // Migrates up to batchSize distinct stored files; returns false once none remain
+    static bool migrateBatch(int batchSize, MigrationStats& stats);
+    static MigrationStats migrateAll(int batchSize = 500, int pauseMillis = 100);
+    
+private:
+    static bool moveFile(const std::string& filename, const std::string& fanoutFilename, 
+                        MigrationStats& stats);
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include "TransferReactor.h"
+#include "Config.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#endif
+
+namespace {
+
+int64_t monotonicSeconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Every reactor connection holds two descriptors, so the default soft limit
+// of 1024 would cap us at a few hundred downloads
+void raiseDescriptorLimit() {
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+    if (limit.rlim_cur >= limit.rlim_max) return;
+
+    limit.rlim_cur = limit.rlim_max;
+    if (::setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        DFS_LOG_WARN << "Could not raise descriptor limit: " << std::strerror(errno);
+    }
+}
+
+}
+
+TransferReactor& TransferReactor::getInstance() {
+    static TransferReactor instance;
+    return instance;
+}
+
+TransferReactor::TransferReactor() {
+    long threads = Config::getInt("DFS_TRANSFER_THREADS", 2);
+    threadCount = static_cast<size_t>(std::max(1L, std::min(threads, 64L)));
+
+    long limit = Config::getInt("DFS_TRANSFER_MAX_CONNECTIONS", 50000);
+    maxConnections = static_cast<uint64_t>(std::max(1L, limit));
+
+    idleTimeoutSeconds = std::max(1L, Config::getInt("DFS_TRANSFER_IDLE_SECONDS", 60));
+    minimumTransferSize = static_cast<Poco::UInt64>(std::max(0L, Config::getInt("DFS_TRANSFER_MIN_BYTES", 256 * 1024)));
+}
+
+TransferReactor::~TransferReactor() {
+    stop();
+}
+
+void TransferReactor::start() {
+#ifdef __linux__
+    std::lock_guard<std::mutex> lock(lifecycleMutex);
+    if (running.load() || !Config::getBool("DFS_TRANSFER_REACTOR", true)) return;
+
+    raiseDescriptorLimit();
+
+    if (loops.empty()) {
+        for (size_t i = 0; i < threadCount; ++i) {
+            std::unique_ptr<Loop> loop(new Loop());
+            loop->epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+            loop->wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            epoll_event event;
+            std::memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = loop->wakeFd;
+            if (loop->epollFd < 0 || loop->wakeFd < 0 ||
+                ::epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &event) != 0) {
+                DFS_LOG_ERROR << "Transfer reactor disabled: " << std::strerror(errno);
+                if (loop->epollFd >= 0) ::close(loop->epollFd);
+                if (loop->wakeFd >= 0) ::close(loop->wakeFd);
+                for (auto& created : loops) {
+                    ::close(created->epollFd);
+                    ::close(created->wakeFd);
+                }
+                loops.clear();
+                return;
+            }
+            loops.push_back(std::move(loop));
+        }
+    }
+
+    running.store(true, std::memory_order_release);
+    for (auto& loop : loops) {
+        Loop* target = loop.get();
+        loop->thread = std::thread([this, target]() { run(*target); });
+    }
+
+    DFS_LOG_INFO << "Transfer reactor started with " << loops.size() << " threads";
+#endif
+}
+
+void TransferReactor::stop() {
+#ifdef __linux__
+    std::lock_guard<std::mutex> lock(lifecycleMutex);
+    if (!running.exchange(false)) return;
+
+    for (auto& loop : loops) {
+        uint64_t one = 1;
+        ssize_t ignored = ::write(loop->wakeFd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    for (auto& loop : loops) {
+        if (loop->thread.joinable()) loop->thread.join();
+
+        // In-flight downloads are cut off; clients resume them with a Range request
+        adopt(*loop);
+        std::vector<int> sockets;
+        for (const auto& entry : loop->transfers) sockets.push_back(entry.first);
+        for (int socketFd : sockets) finish(*loop, socketFd, false);
+    }
+#endif
+}
+
+bool TransferReactor::submit(int socketFd, int fileFd, std::vector<TransferSegment>&& segments) {
+#ifdef __linux__
+    if (!running.load(std::memory_order_acquire) || loops.empty()) return false;
+
+    if (active.load(std::memory_order_relaxed) >= maxConnections) {
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    int flags = ::fcntl(socketFd, F_GETFL, 0);
+    if (flags < 0 || ::fcntl(socketFd, F_SETFL, flags | O_NONBLOCK) != 0) return false;
+
+    std::unique_ptr<Transfer> transfer(new Transfer());
+    transfer->socketFd = socketFd;
+    transfer->fileFd = fileFd;
+    transfer->segments = std::move(segments);
+    transfer->segmentIndex = 0;
+    transfer->prefixSent = 0;
+    transfer->fileSent = 0;
+    transfer->zeroCopy = true;
+    transfer->bufferedStart = 0;
+    transfer->bufferedEnd = 0;
+    transfer->lastProgress = monotonicSeconds();
+
+    active.fetch_add(1, std::memory_order_relaxed);
+    accepted.fetch_add(1, std::memory_order_relaxed);
+
+    Loop& loop = *loops[nextLoop.fetch_add(1, std::memory_order_relaxed) % loops.size()];
+    {
+        std::lock_guard<std::mutex> lock(loop.incomingMutex);
+        loop.incoming.push_back(std::move(transfer));
+    }
+
+    uint64_t one = 1;
+    ssize_t ignored = ::write(loop.wakeFd, &one, sizeof(one));
+    (void)ignored;
+    return true;
+#else
+    return false;
+#endif
+}
+
+TransferReactorStats TransferReactor::getStats() const {
+    TransferReactorStats stats;
+    stats.active = active.load(std::memory_order_relaxed);
+    stats.accepted = accepted.load(std::memory_order_relaxed);
+    stats.rejected = rejected.load(std::memory_order_relaxed);
+    stats.completed = completed.load(std::memory_order_relaxed);
+    stats.aborted = aborted.load(std::memory_order_relaxed);
+    stats.timedOut = timedOut.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void TransferReactor::run(Loop& loop) {
+#ifdef __linux__
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    int64_t lastSweep = monotonicSeconds();
+
+    while (running.load(std::memory_order_acquire)) {
+        int count = ::epoll_wait(loop.epollFd, events, MAX_EVENTS, 1000);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            DFS_LOG_ERROR << "epoll_wait failed: " << std::strerror(errno);
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == loop.wakeFd) {
+                uint64_t drained;
+                while (::read(loop.wakeFd, &drained, sizeof(drained)) > 0) {}
+                adopt(loop);
+                continue;
+            }
+
+            auto it = loop.transfers.find(fd);
+            if (it == loop.transfers.end()) continue;
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                finish(loop, fd, false);
+                continue;
+            }
+
+            Progress progress = drive(*it->second);
+            if (progress != PROGRESS_BLOCKED) finish(loop, fd, progress == PROGRESS_DONE);
+        }
+
+        int64_t now = monotonicSeconds();
+        if (now != lastSweep) {
+            expireIdle(loop, now);
+            lastSweep = now;
+        }
+    }
+#endif
+}
+
+void TransferReactor::adopt(Loop& loop) {
+#ifdef __linux__
+    std::vector<std::unique_ptr<Transfer>> pending;
+    {
+        std::lock_guard<std::mutex> lock(loop.incomingMutex);
+        pending.swap(loop.incoming);
+    }
+
+    for (auto& transfer : pending) {
+        int socketFd = transfer->socketFd;
+
+        // Edge-triggered: each drive() writes until the socket would block
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
+        event.data.fd = socketFd;
+
+        loop.transfers[socketFd] = std::move(transfer);
+        if (::epoll_ctl(loop.epollFd, EPOLL_CTL_ADD, socketFd, &event) != 0) {
+            DFS_LOG_ERROR << "Could not register transfer socket: " << std::strerror(errno);
+            finish(loop, socketFd, false);
+            continue;
+        }
+
+        Progress progress = drive(*loop.transfers[socketFd]);
+        if (progress != PROGRESS_BLOCKED) finish(loop, socketFd, progress == PROGRESS_DONE);
+    }
+#endif
+}
+
+TransferReactor::Progress TransferReactor::drive(Transfer& transfer) {
+    while (transfer.segmentIndex < transfer.segments.size()) {
+        const TransferSegment& segment = transfer.segments[transfer.segmentIndex];
+
+        while (transfer.prefixSent < segment.prefix.size()) {
+            ssize_t sent = ::send(transfer.socketFd, segment.prefix.data() + transfer.prefixSent,
+                                  segment.prefix.size() - transfer.prefixSent, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return PROGRESS_BLOCKED;
+                return PROGRESS_FAILED;
+            }
+            transfer.prefixSent += static_cast<size_t>(sent);
+            transfer.lastProgress = monotonicSeconds();
+            Metrics::getInstance().addBytesOut(static_cast<uint64_t>(sent));
+        }
+
+        if (transfer.fileSent < segment.fileLength) {
+            bool blocked = false;
+            if (!sendFileSpan(transfer, segment, blocked)) return PROGRESS_FAILED;
+            if (blocked) return PROGRESS_BLOCKED;
+        }
+
+        ++transfer.segmentIndex;
+        transfer.prefixSent = 0;
+        transfer.fileSent = 0;
+    }
+    return PROGRESS_DONE;
+}
+
+bool TransferReactor::sendFileSpan(Transfer& transfer, const TransferSegment& segment, bool& blocked) {
+    while (transfer.fileSent < segment.fileLength) {
+        Poco::UInt64 remaining = segment.fileLength - transfer.fileSent;
+
+#ifdef __linux__
+        if (transfer.zeroCopy) {
+            off_t offset = static_cast<off_t>(segment.fileOffset + transfer.fileSent);
+            size_t count = remaining > (1u << 30) ? (1u << 30) : static_cast<size_t>(remaining);
+
+            ssize_t sent = ::sendfile(transfer.socketFd, transfer.fileFd, &offset, count);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    blocked = true;
+                    return true;
+                }
+                if (transfer.fileSent == 0 && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                    transfer.zeroCopy = false;
+                    continue;
+                }
+                return false;
+            }
+            if (sent == 0) return false;  // File shrank underneath us
+
+            transfer.fileSent += static_cast<Poco::UInt64>(sent);
+            transfer.lastProgress = monotonicSeconds();
+            Metrics::getInstance().addBytesOut(static_cast<uint64_t>(sent));
+            continue;
+        }
+#endif
+
+        if (transfer.bufferedStart == transfer.bufferedEnd) {
+            if (!transfer.buffer) transfer.buffer.reset(new char[BUFFER_SIZE]);
+            size_t count = remaining > BUFFER_SIZE ? BUFFER_SIZE : static_cast<size_t>(remaining);
+            ssize_t bytesRead;
+            {
+                ScopedTimer timer(Metrics::getInstance().diskRead());
+                bytesRead = ::pread(transfer.fileFd, transfer.buffer.get(), count,
+                                    static_cast<off_t>(segment.fileOffset + transfer.fileSent));
+            }
+            if (bytesRead < 0 && errno == EINTR) continue;
+            if (bytesRead <= 0) return false;
+            transfer.bufferedStart = 0;
+            transfer.bufferedEnd = static_cast<size_t>(bytesRead);
+        }
+
+        ssize_t sent = ::send(transfer.socketFd, transfer.buffer.get() + transfer.bufferedStart,
+                              transfer.bufferedEnd - transfer.bufferedStart, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                blocked = true;
+                return true;
+            }
+            return false;
+        }
+
+        transfer.bufferedStart += static_cast<size_t>(sent);
+        transfer.fileSent += static_cast<Poco::UInt64>(sent);
+        transfer.lastProgress = monotonicSeconds();
+        Metrics::getInstance().addBytesOut(static_cast<uint64_t>(sent));
+    }
+    return true;
+}
+
+void TransferReactor::finish(Loop& loop, int socketFd, bool succeeded) {
+    auto it = loop.transfers.find(socketFd);
+    if (it == loop.transfers.end()) return;
+
+#ifdef __linux__
+    ::epoll_ctl(loop.epollFd, EPOLL_CTL_DEL, socketFd, nullptr);
+#endif
+    // The response was sent with "Connection: close", so the body ends with our FIN
+    if (succeeded) ::shutdown(socketFd, SHUT_WR);
+    ::close(socketFd);
+    ::close(it->second->fileFd);
+    loop.transfers.erase(it);
+
+    active.fetch_sub(1, std::memory_order_relaxed);
+    if (succeeded) completed.fetch_add(1, std::memory_order_relaxed);
+    else aborted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransferReactor::expireIdle(Loop& loop, int64_t now) {
+    std::vector<int> stalled;
+    for (const auto& entry : loop.transfers) {
+        if (now - entry.second->lastProgress > idleTimeoutSeconds) stalled.push_back(entry.first);
+    }
+
+    for (int socketFd : stalled) {
+        timedOut.fetch_add(1, std::memory_order_relaxed);
+        finish(loop, socketFd, false);
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef TRANSFERREACTOR_H
+#define TRANSFERREACTOR_H
+
+#include <Poco/Types.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct TransferReactorStats {
+    uint64_t active;
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t completed;
+    uint64_t aborted;
+    uint64_t timedOut;
+};
+
+// One piece of a response: literal bytes (headers, multipart boundaries)
+// followed by an optional span of the file
+struct TransferSegment {
+    std::string prefix;
+    Poco::UInt64 fileOffset;
+    Poco::UInt64 fileLength;
+};
+
+// Drives long downloads on a few epoll threads once the request has been
+// authorised. The reactor takes ownership of a socket descriptor and a file
+// descriptor, writes the queued segments as the socket becomes writable and
+// closes both when done, so the Poco worker thread returns immediately.
+class TransferReactor {
+public:
+    static TransferReactor& getInstance();
+
+    void start();
+    void stop();
+    bool isRunning() const { return running.load(std::memory_order_acquire); }
+
+    // Bodies smaller than this are cheaper to send inline on the worker thread
+    Poco::UInt64 getMinimumTransferSize() const { return minimumTransferSize; }
+
+    // Takes ownership of both descriptors on success only; on failure the caller
+    // still owns them and should fall back to sending inline
+    bool submit(int socketFd, int fileFd, std::vector<TransferSegment>&& segments);
+
+    TransferReactorStats getStats() const;
+
+private:
+    struct Transfer {
+        int socketFd;
+        int fileFd;
+        std::vector<TransferSegment> segments;
+        size_t segmentIndex;
+        size_t prefixSent;
+        Poco::UInt64 fileSent;
+        bool zeroCopy;
+        std::unique_ptr<char[]> buffer;  // Only allocated when sendfile is unavailable
+        size_t bufferedStart;
+        size_t bufferedEnd;
+        int64_t lastProgress;
+    };
+
+    struct Loop {
+        int epollFd;
+        int wakeFd;
+        std::thread thread;
+        std::mutex incomingMutex;
+        std::vector<std::unique_ptr<Transfer>> incoming;
+        std::unordered_map<int, std::unique_ptr<Transfer>> transfers;
+    };
+
+    enum Progress { PROGRESS_BLOCKED, PROGRESS_DONE, PROGRESS_FAILED };
+
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+    TransferReactor();
+    ~TransferReactor();
+
+    void run(Loop& loop);
+    void adopt(Loop& loop);
+    Progress drive(Transfer& transfer);
+    bool sendFileSpan(Transfer& transfer, const TransferSegment& segment, bool& blocked);
+    void finish(Loop& loop, int socketFd, bool completed);
+    void expireIdle(Loop& loop, int64_t now);
+
+    std::vector<std::unique_ptr<Loop>> loops;
+    std::atomic<size_t> nextLoop{0};
+    std::atomic<bool> running{false};
+    std::mutex lifecycleMutex;
+
+    size_t threadCount;
+    uint64_t maxConnections;
+    int64_t idleTimeoutSeconds;
+    Poco::UInt64 minimumTransferSize;
+
+    std::atomic<uint64_t> active{0};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> completed{0};
+    std::atomic<uint64_t> aborted{0};
+    std::atomic<uint64_t> timedOut{0};
+};
+
+#endif
@@ -0,0 +1,334 @@
+#include "UploadSession.h"
+#include "FileManager.h"
+#include "Database.h"
+#include "Utils.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include <Poco/Data/Statement.h>
+#include <Poco/Exception.h>
+#include <Poco/DateTime.h>
+#include <Poco/File.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <vector>
+
+using namespace Poco::Data::Keywords;
+
+namespace {
+
+// The commit gets its own copy of the staged bytes: in the kernel where the filesystem
+// allows it (a reflink on XFS and btrfs), through a buffer otherwise
+bool copyStagedFile(const std::string& fromPath, const std::string& toPath, long length) {
+    int from = ::open(fromPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (from < 0) return false;
+    int to = ::open(toPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (to < 0) {
+        ::close(from);
+        return false;
+    }
+    
+    off_t in = 0;
+    off_t out = 0;
+    bool ok = true;
+#ifdef __linux__
+    while (ok && length > 0) {
+        ssize_t copied = ::copy_file_range(from, &in, to, &out, static_cast<size_t>(length), 0);
+        if (copied < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL) break;
+            ok = false;
+        }
+        else if (copied == 0) ok = false;
+        else length -= copied;
+    }
+#endif
+    
+    std::vector<char> buffer(ok && length > 0 ? FileManager::getUploadBufferSize() : 0);
+    while (ok && length > 0) {
+        size_t count = length > static_cast<long>(buffer.size()) ? buffer.size() : static_cast<size_t>(length);
+        ssize_t bytesRead = ::pread(from, buffer.data(), count, in);
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead <= 0) {
+            ok = false;
+            break;
+        }
+        
+        ssize_t written = 0;
+        while (ok && written < bytesRead) {
+            ssize_t n = ::pwrite(to, buffer.data() + written, static_cast<size_t>(bytesRead - written), out + written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) ok = false;
+            else written += n;
+        }
+        in += bytesRead;
+        out += bytesRead;
+        length -= bytesRead;
+    }
+    
+    if (ok && ::fdatasync(to) != 0) ok = false;
+    ::close(from);
+    ::close(to);
+    if (!ok) ::unlink(toPath.c_str());
+    return ok;
+}
+
+bool loadStatus(Poco::Data::Session& session, const std::string& uploadId, int ownerId, UploadStatus& status) {
+    std::string id = uploadId;
+    std::string originalFilename, contentType;
+    long totalSize = -1;
+    
+    Poco::Data::Statement select(session);
+    select << "SELECT original_filename, COALESCE(content_type, ''), total_size FROM upload_sessions "
+              "WHERE upload_id = $1 AND owner_id = $2 AND (expires_at IS NULL OR expires_at > CURRENT_TIMESTAMP)",
+        use(id), use(ownerId), into(originalFilename), into(contentType), into(totalSize), limit(1);
+    select.execute();
+    
+    if (totalSize < 0) return false;
+    
+    std::vector<long> offsets;
+    std::vector<long> lengths;
+    Poco::Data::Statement chunks(session);
+    chunks << "SELECT chunk_offset, chunk_length FROM upload_chunks WHERE upload_id = $1 ORDER BY chunk_offset",
+        use(id), into(offsets), into(lengths);
+    chunks.execute();
+    
+    // Merge the (possibly overlapping) chunk intervals
+    long offset = 0;
+    long received = 0;
+    long coveredEnd = 0;
+    bool contiguous = true;
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        long start = offsets[i];
+        long end = offsets[i] + lengths[i];
+        if (start > coveredEnd) contiguous = false;
+        if (end > coveredEnd) {
+            received += end - (start > coveredEnd ? start : coveredEnd);
+            coveredEnd = end;
+        }
+        if (contiguous) offset = coveredEnd;
+    }
+    
+    status.uploadId = uploadId;
+    status.originalFilename = originalFilename;
+    status.contentType = contentType;
+    status.totalSize = totalSize;
+    status.offset = offset;
+    status.receivedBytes = received;
+    return true;
+}
+
+}
+
+std::string UploadSession::getTempFilename(const std::string& uploadId) {
+    return ".upload-" + uploadId + ".part";
+}
+
+std::string UploadSession::create(int ownerId, const std::string& filename, 
+                                  const std::string& contentType, long totalSize) {
+    if (totalSize < 0) return "";
+    
+    std::string uploadId = Utils::generateUploadId();
+    std::string tempFilename = getTempFilename(uploadId);
+    std::string tempPath = FileManager::getUploadsDirectory() + tempFilename;
+    
+    try {
+        // Preallocate so chunks can land at any offset, in any order
+        Poco::File temp(tempPath);
+        temp.createFile();
+        temp.setSize(totalSize);
+        
+        auto session = Database::getInstance().getSession();
+        
+        Poco::DateTime expiry;
+        expiry += Poco::Timespan(LIFETIME_SECONDS, 0);
+        
+        std::string origName = filename;
+        std::string ctype = contentType;
+        
+        Poco::Data::Statement insert(session);
+        insert << "INSERT INTO upload_sessions (upload_id, owner_id, original_filename, content_type, "
+                  "total_size, temp_filename, expires_at) VALUES ($1, $2, $3, $4, $5, $6, $7)",
+            use(uploadId), use(ownerId), use(origName), use(ctype), use(totalSize), 
+            use(tempFilename), use(expiry);
+        insert.execute();
+        
+        return uploadId;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Upload session creation failed: " << ex.displayText();
+        try {
+            Poco::File temp(tempPath);
+            if (temp.exists()) temp.remove();
+        }
+        catch (...) {
+        }
+        return "";
+    }
+}
+
+bool UploadSession::getStatus(const std::string& uploadId, int ownerId, UploadStatus& status) {
+    try {
+        auto session = Database::getInstance().getSession();
+        return loadStatus(session, uploadId, ownerId, status);
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Upload status lookup failed: " << ex.displayText();
+        return false;
+    }
+}
+
+UploadSession::ChunkResult UploadSession::writeChunk(const std::string& uploadId, int ownerId, long offset, 
+                                                     long length, std::istream& data, UploadStatus& status) {
+    try {
+        auto session = Database::getInstance().getSession();
+        if (!loadStatus(session, uploadId, ownerId, status)) return CHUNK_NOT_FOUND;
+        
+        if (offset < 0 || length <= 0 || offset > status.totalSize || length > status.totalSize - offset) {
+            return CHUNK_INVALID;
+        }
+        
+        std::string tempPath = FileManager::getUploadsDirectory() + getTempFilename(uploadId);
+        int fd = ::open(tempPath.c_str(), O_WRONLY | O_CLOEXEC);
+        if (fd < 0) return CHUNK_FAILED;
+        
+        // Each chunk writes its own region with pwrite, so parallel PATCHes don't interfere
+        std::vector<char> buffer(FileManager::getUploadBufferSize());
+        long written = 0;
+        bool ioError = false;
+        while (written < length && data) {
+            long wanted = length - written;
+            std::streamsize count = wanted < static_cast<long>(buffer.size()) ? wanted : buffer.size();
+            data.read(buffer.data(), count);
+            std::streamsize got = data.gcount();
+            if (got <= 0) break;
+            
+            const char* p = buffer.data();
+            while (got > 0) {
+                ssize_t n;
+                {
+                    ScopedTimer timer(Metrics::getInstance().diskWrite());
+                    n = ::pwrite(fd, p, got, offset + written);
+                }
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    ioError = true;
+                    break;
+                }
+                p += n;
+                got -= n;
+                written += n;
+            }
+            if (ioError) break;
+        }
+        
+        // The chunk is only recorded once it is durable, so a crash never claims missing bytes
+        if (!ioError && written == length && ::fdatasync(fd) != 0) ioError = true;
+        ::close(fd);
+        
+        if (ioError) return CHUNK_FAILED;
+        if (written != length) return CHUNK_INCOMPLETE;
+        
+        std::string id = uploadId;
+        Poco::Data::Statement insert(session);
+        insert << "INSERT INTO upload_chunks (upload_id, chunk_offset, chunk_length) VALUES ($1, $2, $3) "
+                  "ON CONFLICT (upload_id, chunk_offset) DO UPDATE "
+                  "SET chunk_length = GREATEST(upload_chunks.chunk_length, EXCLUDED.chunk_length)",
+            use(id), use(offset), use(length);
+        insert.execute();
+        
+        loadStatus(session, uploadId, ownerId, status);
+        return CHUNK_OK;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Upload chunk write failed: " << ex.displayText();
+        return CHUNK_FAILED;
+    }
+}
+
+int UploadSession::complete(const std::string& uploadId, int ownerId) {
+    try {
+        auto session = Database::getInstance().getSession();
+        
+        UploadStatus status;
+        if (!loadStatus(session, uploadId, ownerId, status)) return -1;
+        if (status.receivedBytes != status.totalSize) return 0;
+        
+        // The commit consumes a private copy of the staged bytes: a late PATCH can't rewrite
+        // the blob after it is hashed, and if the commit fails the session still has its
+        // file and the client can complete again
+        std::string commitFilename = "." + Utils::generateUploadId() + ".part";
+        std::string directory = FileManager::getUploadsDirectory();
+        if (!copyStagedFile(directory + getTempFilename(uploadId), directory + commitFilename, status.totalSize)) {
+            DFS_LOG_ERROR << "Upload completion failed: cannot copy staged file";
+            return -1;
+        }
+        
+        // Deleting the session row in the commit's transaction claims it: concurrent
+        // completes can't both commit, and a failed commit restores the session
+        std::string id = uploadId;
+        int fileId = FileManager::commitUpload(commitFilename, status.originalFilename, status.contentType, 
+                                               ownerId, status.totalSize, "",
+                                               [&id, ownerId](Poco::Data::Session& transaction) {
+            Poco::Data::Statement claim(transaction);
+            claim << "DELETE FROM upload_sessions WHERE upload_id = $1 AND owner_id = $2",
+                use(id), use(ownerId);
+            return claim.execute() > 0;
+        });
+        
+        if (fileId > 0) {
+            Poco::File temp(directory + getTempFilename(uploadId));
+            if (temp.exists()) temp.remove();
+        }
+        return fileId;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Upload completion failed: " << ex.displayText();
+        return -1;
+    }
+}
+
+bool UploadSession::cancel(const std::string& uploadId, int ownerId) {
+    try {
+        auto session = Database::getInstance().getSession();
+        
+        std::string id = uploadId;
+        Poco::Data::Statement remove(session);
+        remove << "DELETE FROM upload_sessions WHERE upload_id = $1 AND owner_id = $2",
+            use(id), use(ownerId);
+        if (remove.execute() == 0) return false;
+        
+        Poco::File temp(FileManager::getUploadsDirectory() + getTempFilename(uploadId));
+        if (temp.exists()) temp.remove();
+        return true;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Upload cancel failed: " << ex.displayText();
+        return false;
+    }
+}
+
+long UploadSession::purgeExpired(int limit) {
+    try {
+        auto session = Database::getInstance().getSession();
+        
+        std::vector<std::string> uploadIds;
+        Poco::Data::Statement purge(session);
+        purge << "DELETE FROM upload_sessions WHERE upload_id IN "
+                 "(SELECT upload_id FROM upload_sessions WHERE expires_at < CURRENT_TIMESTAMP LIMIT $1) "
+                 "RETURNING upload_id",
+            use(limit), into(uploadIds);
+        purge.execute();
+        
+        // Expired sessions accept no more chunks, so nothing still writes these
+        for (const auto& uploadId : uploadIds) {
+            Poco::File temp(FileManager::getUploadsDirectory() + getTempFilename(uploadId));
+            if (temp.exists()) temp.remove();
+        }
+        return static_cast<long>(uploadIds.size());
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Upload session cleanup failed: " << ex.displayText();
+        return -1;
+    }
+}
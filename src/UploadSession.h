@@ -0,0 +1,41 @@
+#ifndef UPLOADSESSION_H
+#define UPLOADSESSION_H
+
+#include <string>
+#include <istream>
+
+struct UploadStatus {
+    std::string uploadId;
+    std::string originalFilename;
+    std::string contentType;
+    long totalSize;
+    long offset;          // Length of the contiguous prefix received from byte 0
+    long receivedBytes;   // Total bytes received, including chunks past a gap
+};
+
+// Resumable uploads: a session is created with the final size, chunks are written
+// at arbitrary offsets (possibly in parallel) into a preallocated temp file, and
+// the session is finalized into a files row once every byte has arrived.
+class UploadSession {
+public:
+    enum ChunkResult { CHUNK_OK, CHUNK_NOT_FOUND, CHUNK_INVALID, CHUNK_INCOMPLETE, CHUNK_FAILED };
+    
+    // Time from creation to finish the upload
+    static const long LIFETIME_SECONDS = 86400;
+    
+    static std::string create(int ownerId, const std::string& filename, 
+                             const std::string& contentType, long totalSize);
+    static bool getStatus(const std::string& uploadId, int ownerId, UploadStatus& status);
+    static ChunkResult writeChunk(const std::string& uploadId, int ownerId, long offset, long length, 
+                                 std::istream& data, UploadStatus& status);
+    // Returns the new file_id, 0 if bytes are still missing, -1 on error
+    static int complete(const std::string& uploadId, int ownerId);
+    static bool cancel(const std::string& uploadId, int ownerId);
+    // Deletes up to limit expired sessions and their temp files; how many went, or -1 on failure
+    static long purgeExpired(int limit);
+    
+private:
+    static std::string getTempFilename(const std::string& uploadId);
+};
+
+#endif
@@ -1,14 +1,52 @@
 #include "User.h"
 #include "Database.h"
 #include "Utils.h"
+#include "SessionCache.h"
+#include "Metrics.h"
+#include "Logger.h"
 #include <Poco/Data/Statement.h>
 #include <Poco/Exception.h>
 #include <Poco/DateTime.h>
-#include <iostream>
 
 using namespace Poco::Data::Keywords;
 
-bool User::registerUser(const std::string& username, const std::string& password, const std::string& email) {
+namespace {
+
+// Runs on every authenticated request, so it is prepared once per pooled connection
+struct SessionLookup {
+    explicit SessionLookup(Poco::Data::Session& session) : statement(session) {
+        statement << "SELECT user_id, expires_at FROM user_sessions WHERE session_id = $1 AND expires_at > $2",
+            use(token), use(currentTime), into(userId), into(expiresAt), limit(1);
+    }
+    
+    std::string token;
+    Poco::DateTime currentTime;
+    int userId = 0;
+    Poco::DateTime expiresAt;
+    Poco::Data::Statement statement;
+};
+
+// Credential check and session insert as one statement: no row comes back when
+// the username or password is wrong, and nothing is written
+struct LoginStatement {
+    explicit LoginStatement(Poco::Data::Session& session) : statement(session) {
+        statement << "WITH matched AS (SELECT user_id FROM users WHERE username = $1 AND password_hash = $2) "
+                     "INSERT INTO user_sessions (session_id, user_id, expires_at) "
+                     "SELECT $3, user_id, $4 FROM matched RETURNING user_id",
+            use(username), use(passwordHash), use(token), use(expiresAt), into(userIds);
+    }
+    
+    std::string username;
+    std::string passwordHash;
+    std::string token;
+    Poco::DateTime expiresAt;
+    std::vector<int> userIds;
+    Poco::Data::Statement statement;
+};
+
+}
+
+int User::registerUser(const std::string& username, const std::string& password, const std::string& email) {
     try {
         auto session = Database::getInstance().getSession();
         std::string hashedPassword = Utils::hashPassword(password);
@@ -18,64 +56,93 @@ bool User::registerUser(const std::string& username, const std::string& password
         std::string pass = hashedPassword;
         std::string mail = email;
         
+        // A taken username yields no row instead of a unique-violation error
         Poco::Data::Statement insert(session);
-        insert << "INSERT INTO users (username, password_hash, email) VALUES ($1, $2, $3)",
-            use(user), use(pass), use(mail);
+        std::vector<int> newUserId;
+        insert << "INSERT INTO users (username, password_hash, email) VALUES ($1, $2, $3) "
+                  "ON CONFLICT (username) DO NOTHING RETURNING user_id",
+            use(user), use(pass), use(mail), into(newUserId);
         insert.execute();
         
-        // Get the newly created user ID
-        int newUserId = 0;
-        Poco::Data::Statement getId(session);
-        getId << "SELECT user_id FROM users WHERE username = $1",
-            use(user), into(newUserId), limit(1);
-        getId.execute();
+        if (newUserId.empty()) {
+            DFS_LOG_INFO << "Registration failed: username '" << username << "' already exists";
+            return 0;
+        }
         
-        std::cout << "User '" << username << "' registered successfully with ID: " << newUserId << std::endl;
-        return true;
+        DFS_LOG_INFO << "User '" << username << "' registered successfully with ID: " << newUserId.front();
+        return newUserId.front();
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "Registration failed: " << ex.displayText() << std::endl;
-        return false;
+        DFS_LOG_ERROR << "Registration failed: " << ex.displayText();
+        return -1;
     }
 }
 
-bool User::authenticateUser(const std::string& username, const std::string& password) {
+int User::authenticateUser(const std::string& username, const std::string& password) {
     try {
         auto session = Database::getInstance().getSession();
         
-        std::string storedHash;
-        int userId = 0;  // ← ADD: Variable to store user ID
+        int userId = 0;
         std::string user = username;
+        std::string hash = Utils::hashPassword(password);
         
         Poco::Data::Statement select(session);
-        select << "SELECT password_hash, user_id FROM users WHERE username = $1",  // ← MODIFIED: Get both hash and ID
-            use(user), into(storedHash), into(userId), limit(1);  // ← MODIFIED: Retrieve both values
+        select << "SELECT user_id FROM users WHERE username = $1 AND password_hash = $2",
+            use(user), use(hash), into(userId), limit(1);
         select.execute();
         
-        if (storedHash.empty()) {
-            std::cout << "Authentication failed: User '" << username << "' not found" << std::endl;
-            return false;
+        if (userId > 0) {
+            DFS_LOG_INFO << "User '" << username << "' authenticated successfully with ID: " << userId;
+        } else {
+            DFS_LOG_INFO << "Authentication failed for user '" << username << "'";
         }
+        return userId;
+    }
+    catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Authentication failed: " << ex.displayText();
+        return 0;
+    }
+}
+
+std::string User::login(const std::string& username, const std::string& password, int& userId) {
+    userId = 0;
+    try {
+        auto session = Database::getInstance().getSession();
         
-        bool isAuthenticated = Utils::hashPassword(password) == storedHash;
+        Poco::DateTime expiry;
+        expiry += Poco::Timespan(1, 0, 0, 0, 0); // 1 day
         
-        if (isAuthenticated) {
-            // ← ADD: Print success message with user ID
-            std::cout << "User '" << username << "' authenticated successfully with ID: " << userId << std::endl;
-        } else {
-            // ← ADD: Print failure message
-            std::cout << "Authentication failed: Invalid password for user '" << username << "' (ID: " << userId << ")" << std::endl;
+        LoginStatement& insert = session.prepared<LoginStatement>("login");
+        insert.username = username;
+        insert.passwordHash = Utils::hashPassword(password);
+        insert.token = Utils::generateSessionToken();
+        insert.expiresAt = expiry;
+        insert.userIds.clear();
+        {
+            static Histogram& latency = Metrics::getInstance().dbStatement("login");
+            ScopedTimer timer(latency);
+            insert.statement.execute();
         }
         
-        return isAuthenticated;
+        if (insert.userIds.empty()) {
+            DFS_LOG_INFO << "Authentication failed for user '" << username << "'";
+            return "";
+        }
+        
+        userId = insert.userIds.front();
+        DFS_LOG_INFO << "User '" << username << "' logged in with ID: " << userId;
+        
+        // The first authenticated request right after login then skips the database
+        SessionCache& cache = SessionCache::getInstance();
+        cache.storeValid(insert.token, userId, expiry.timestamp(), cache.getGeneration(insert.token));
+        return insert.token;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "Authentication failed: " << ex.displayText() << std::endl;
-        return false;
+        DFS_LOG_ERROR << "Login failed: " << ex.displayText();
+        return "";
     }
 }
 
-
 std::string User::createSession(int userId) {
     try {
         auto session = Database::getInstance().getSession();
@@ -93,26 +160,71 @@ std::string User::createSession(int userId) {
         return sessionToken;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "Session creation failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "Session creation failed: " << ex.displayText();
         return "";
     }
 }
 
 bool User::validateSession(const std::string& sessionToken, int& userId) {
     try {
+        // Common case: answered from memory without touching the database
+        SessionCache& cache = SessionCache::getInstance();
+        switch (cache.lookup(sessionToken, userId)) {
+            case SessionCache::HIT_VALID:
+                return true;
+            case SessionCache::HIT_INVALID:
+                return false;
+            default:
+                break;
+        }
+        
+        // Taken before the read, so a logout that lands during it wins
+        uint64_t generation = cache.getGeneration(sessionToken);
         auto session = Database::getInstance().getSession();
         
-        Poco::DateTime now;
+        SessionLookup& select = session.prepared<SessionLookup>("validate_session");
+        select.token = sessionToken;
+        select.currentTime = Poco::DateTime();
+        select.userId = 0;
+        {
+            static Histogram& latency = Metrics::getInstance().dbStatement("validate_session");
+            ScopedTimer timer(latency);
+            select.statement.execute();
+        }
+        
+        userId = select.userId;
+        if (userId > 0) {
+            cache.storeValid(sessionToken, userId, select.expiresAt.timestamp(), generation);
+        } else {
+            cache.storeInvalid(sessionToken);
+        }
+        return userId > 0;
+    }
+    catch (const Poco::Exception& ex) {
+        return false;
+    }
+}
+
+bool User::destroySession(const std::string& sessionToken) {
+    // Drop the cached entry first so the token stops working even if the DELETE fails
+    SessionCache& cache = SessionCache::getInstance();
+    cache.invalidate(sessionToken);
+    
+    try {
+        auto session = Database::getInstance().getSession();
         std::string token = sessionToken;
         
-        Poco::Data::Statement select(session);
-        select << "SELECT user_id FROM user_sessions WHERE session_id = $1 AND expires_at > $2",  // ← Fixed: $1, $2 instead of ?
-            use(token), use(now), into(userId), limit(1);
-        select.execute();
+        Poco::Data::Statement remove(session);
+        remove << "DELETE FROM user_sessions WHERE session_id = $1", use(token);
+        bool removed = remove.execute() > 0;
         
-        return userId > 0;
+        // Again now the row is gone: a lookup that read it after the first
+        // invalidation must not cache it
+        cache.invalidate(sessionToken);
+        return removed;
     }
     catch (const Poco::Exception& ex) {
+        DFS_LOG_ERROR << "Session removal failed: " << ex.displayText();
         return false;
     }
 }
@@ -133,16 +245,23 @@ bool User::getUserInfo(int userId, UserInfo& userInfo) {
     }
 }
 
-void User::cleanupExpiredSessions() {
+long User::cleanupExpiredSessions(int limit) {
     try {
         auto session = Database::getInstance().getSession();
         Poco::DateTime now;
         
+        // One bounded statement at a time, so no purge holds many row locks
         Poco::Data::Statement cleanup(session);
-        cleanup << "DELETE FROM user_sessions WHERE expires_at < $1", use(now);  // ← Fixed: $1 instead of ?
-        cleanup.execute();
+        cleanup << "DELETE FROM user_sessions WHERE session_id IN "
+                   "(SELECT session_id FROM user_sessions WHERE expires_at < $1 LIMIT $2)",
+            use(now), use(limit);
+        long removed = static_cast<long>(cleanup.execute());
+        
+        SessionCache::getInstance().purgeExpired();
+        return removed;
     }
     catch (const Poco::Exception& ex) {
-        std::cerr << "Session cleanup failed: " << ex.displayText() << std::endl;
+        DFS_LOG_ERROR << "Session cleanup failed: " << ex.displayText();
+        return -1;
     }
 }
@@ -12,12 +12,18 @@ struct UserInfo {
 
 class User {
 public:
-    static bool registerUser(const std::string& username, const std::string& password, const std::string& email = "");
-    static bool authenticateUser(const std::string& username, const std::string& password);
+    // New user's id, 0 if the username is taken, -1 on failure
+    static int registerUser(const std::string& username, const std::string& password, const std::string& email = "");
+    // User's id, or 0 if the credentials don't match
+    static int authenticateUser(const std::string& username, const std::string& password);
+    // Checks the credentials and opens a session in a single statement; empty token on failure
+    static std::string login(const std::string& username, const std::string& password, int& userId);
     static std::string createSession(int userId);
     static bool validateSession(const std::string& sessionToken, int& userId);
+    static bool destroySession(const std::string& sessionToken);
     static bool getUserInfo(int userId, UserInfo& userInfo);
-    static void cleanupExpiredSessions();
+    // Deletes up to limit expired sessions; how many went, or -1 on failure
+    static long cleanupExpiredSessions(int limit);
 };
 
 #endif
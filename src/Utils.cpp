@@ -1,4 +1,5 @@
 #include "Utils.h"
+#include "Logger.h"
 #include <Poco/Crypto/DigestEngine.h>
 #include <Poco/DigestStream.h>
 #include <Poco/UUIDGenerator.h>
@@ -6,7 +7,6 @@
 #include <Poco/File.h>
 #include <sstream>
 #include <iomanip>
-#include <iostream>
 
 std::string Utils::hashPassword(const std::string& password) {
     try {
@@ -25,7 +25,7 @@ std::string Utils::hashPassword(const std::string& password) {
         return oss.str();
     }
     catch (const std::exception& ex) {
-        std::cerr << "Password hashing failed: " << ex.what() << std::endl;
+        DFS_LOG_ERROR << "Password hashing failed: " << ex.what();
         return ""; // Return empty string on error
     }
 }
@@ -40,6 +40,11 @@ std::string Utils::generateShareToken() {
     return generator.createRandom().toString();
 }
 
+std::string Utils::generateUploadId() {
+    Poco::UUIDGenerator& generator = Poco::UUIDGenerator::defaultGenerator();
+    return generator.createRandom().toString();
+}
+
 std::string Utils::generateUniqueFilename(const std::string& originalName) {
     Poco::DateTime now;
     std::stringstream ss;
@@ -59,3 +64,36 @@ bool Utils::createDirectory(const std::string& path) {
         return false;
     }
 }
+
+std::string Utils::toPostgresArray(const std::vector<int>& values) {
+    std::string literal = "{";
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i > 0) literal += ',';
+        literal += std::to_string(values[i]);
+    }
+    return literal + "}";
+}
+
+std::string Utils::toPostgresArray(const std::vector<long>& values) {
+    std::string literal = "{";
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i > 0) literal += ',';
+        literal += std::to_string(values[i]);
+    }
+    return literal + "}";
+}
+
+std::string Utils::toPostgresArray(const std::vector<std::string>& values) {
+    // Every element is quoted so commas, braces and spaces in names survive
+    std::string literal = "{";
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (i > 0) literal += ',';
+        literal += '"';
+        for (char c : values[i]) {
+            if (c == '"' || c == '\\') literal += '\\';
+            literal += c;
+        }
+        literal += '"';
+    }
+    return literal + "}";
+}
@@ -3,14 +3,20 @@
 
 #include <string>
 #include <random>
+#include <vector>
 
 class Utils {
 public:
     static std::string hashPassword(const std::string& password);
     static std::string generateSessionToken();
     static std::string generateShareToken();
+    static std::string generateUploadId();
     static std::string generateUniqueFilename(const std::string& originalName);
     static bool createDirectory(const std::string& path);
+    // Array literals bound as a single text parameter, e.g. "= ANY($1::int[])"
+    static std::string toPostgresArray(const std::vector<int>& values);
+    static std::string toPostgresArray(const std::vector<long>& values);
+    static std::string toPostgresArray(const std::vector<std::string>& values);
 };
 
 #endif
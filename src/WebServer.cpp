@@ -2,6 +2,22 @@
 #include "User.h" 
 #include "FileManager.h"
 #include "Database.h"
+#include "Config.h"
+#include "FileTransfer.h"
+#include "UploadSession.h"
+#include "Metrics.h"
+#include "SessionCache.h"
+#include "MetadataCache.h"
+#include "TransferReactor.h"
+#include "RequestLanes.h"
+#include "Router.h"
+#include "Logger.h"
+#include "Compression.h"
+#include "JsonWriter.h"
+#include "StorageBackend.h"
+#include "ChunkStore.h"
+#include "Cluster.h"
+#include "Maintenance.h"
 #include <Poco/Net/ServerSocket.h>
 #include <Poco/Net/HTTPServerParams.h>
 #include <Poco/URI.h>
@@ -10,67 +26,226 @@
 #include <Poco/JSON/Parser.h>
 #include <Poco/StreamCopier.h>
 #include <Poco/Data/Statement.h>
+#include <Poco/DateTimeFormatter.h>
+#include <Poco/DateTimeFormat.h>
+#include <Poco/DateTimeParser.h>
+#include <Poco/DateTime.h>
+#include <Poco/StringTokenizer.h>
+#include <Poco/UUIDGenerator.h>
+#include <Poco/NumberParser.h>
+#include <Poco/String.h>
+#include <Poco/CountingStream.h>
+#include <Poco/NullStream.h>
+#include <Poco/Net/HTMLForm.h>
+#include <Poco/Net/PartHandler.h>
+#include <Poco/Net/MessageHeader.h>
+#include <Poco/Net/NameValueCollection.h>
 // Remove the problematic include: #include <Poco/Data/Keywords.h>
-#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <memory>
 #include <sstream>
 
 using namespace Poco::Net;
 using namespace Poco::JSON;
 // Remove the problematic using: using namespace Poco::Data::Keywords;
 
+namespace {
+
+// Records latency and status for one request however the handler exits
+class RequestMetricsScope {
+public:
+    explicit RequestMetricsScope(HTTPServerResponse& response) 
+        : response(response), route(Metrics::ROUTE_OTHER), started(std::chrono::steady_clock::now()) {
+        Metrics::getInstance().requestStarted();
+    }
+    
+    ~RequestMetricsScope() {
+        Metrics& metrics = Metrics::getInstance();
+        metrics.requestFinished();
+        metrics.recordRequest(route, static_cast<int>(response.getStatus()), 
+                              std::chrono::steady_clock::now() - started);
+    }
+    
+    HTTPServerResponse& response;
+    Metrics::Route route;
+    std::chrono::steady_clock::time_point started;
+};
+
+// Stages each file part of a multipart batch upload as it arrives, so no part is
+// held in memory. Parts past the batch limit are drained and only counted.
+class BatchUploadPartHandler : public PartHandler {
+public:
+    explicit BatchUploadPartHandler(size_t maxItems) : maxItems(maxItems), rejected(0) {}
+    
+    void handlePart(const MessageHeader& header, std::istream& stream) override {
+        if (filenames.size() >= maxItems) {
+            Poco::NullOutputStream discard;
+            Poco::StreamCopier::copyStream(stream, discard);
+            ++rejected;
+            return;
+        }
+        
+        std::string disposition;
+        NameValueCollection params;
+        MessageHeader::splitParameters(header.get("Content-Disposition", ""), disposition, params);
+        std::string filename = params.get("filename", "uploaded_file");
+        std::string contentType = header.get("Content-Type", "application/octet-stream");
+        
+        StagedUpload upload;
+        bool staged = FileManager::stageUpload(stream, filename, contentType, upload);
+        filenames.push_back(filename);
+        stagedIndex.push_back(staged ? static_cast<int>(uploads.size()) : -1);
+        if (staged) uploads.push_back(upload);
+    }
+    
+    size_t maxItems;
+    size_t rejected;
+    std::vector<std::string> filenames;  // Every accepted part, in request order
+    std::vector<int> stagedIndex;        // Position in uploads, or -1 if staging failed
+    std::vector<StagedUpload> uploads;
+};
+
+void writeBatchResults(JsonWriter& json, const std::vector<BatchResult>& results, 
+                       const std::vector<std::string>* filenames = nullptr) {
+    size_t failed = 0;
+    for (const BatchResult& result : results) {
+        if (!result.success) ++failed;
+    }
+    
+    // Successful when any item is; "failed" and the results tell a partial batch apart
+    json.beginObject().field("success", failed < results.size()).field("failed", failed)
+        .key("results").beginArray();
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BatchResult& result = results[i];
+        json.beginObject().field("file_id", result.fileId).field("success", result.success);
+        if (filenames) json.field("filename", (*filenames)[i]);
+        if (!result.shareToken.empty()) {
+            json.field("share_token", result.shareToken);
+            json.field("share_url", "http://localhost:8080/shared/" + result.shareToken);
+        }
+        if (!result.success) json.field("error", result.error);
+        json.endObject();
+    }
+    json.endArray().endObject();
+}
+
+// If-None-Match uses the weak comparison, so W/ prefixes are ignored
+bool etagMatches(const std::string& header, const std::string& etag) {
+    Poco::StringTokenizer tags(header, ",", Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+    for (const auto& tag : tags) {
+        if (tag == "*") return true;
+        if ((tag.compare(0, 2, "W/") == 0 ? tag.substr(2) : tag) == etag) return true;
+    }
+    return false;
+}
+
+// Each Content-Encoding is its own representation and needs its own strong tag
+std::string encodedETag(const std::string& etag, Compression::Encoding encoding) {
+    return etag.substr(0, etag.size() - 1) + "-" + Compression::encodingName(encoding) + "\"";
+}
+
+// The stored file a node-to-node request names, or "" when it could escape the store
+std::string clusterFilename(const RouteMatch& match) {
+    std::string filename;
+    for (const auto& parameter : match.uri.getQueryParameters()) {
+        if (parameter.first == "name") filename = parameter.second;
+    }
+    if (filename.empty() || filename[0] == '/' || filename.find("..") != std::string::npos) return "";
+    return filename;
+}
+
+// Reads {"file_ids": [..]}; false when the field is missing or not an array of ids
+bool parseFileIds(const Object::Ptr& object, std::vector<int>& fileIds) {
+    Array::Ptr ids = object->getArray("file_ids");
+    if (!ids) return false;
+    
+    for (size_t i = 0; i < ids->size(); ++i) {
+        fileIds.push_back(ids->getElement<int>(static_cast<unsigned>(i)));
+    }
+    return true;
+}
+
+}
+
+FileShareRequestHandler::FileShareRequestHandler(RouteMatch&& match) : match(std::move(match)) {}
+
+void FileShareRequestHandler::registerRoutes(Router& router) {
+    router.add("POST", "/register", handleRegister, Metrics::ROUTE_REGISTER, RequestLanes::LANE_AUTH);
+    router.add("POST", "/login", handleLogin, Metrics::ROUTE_LOGIN, RequestLanes::LANE_AUTH);
+    router.add("POST", "/logout", handleLogout, Metrics::ROUTE_LOGOUT, RequestLanes::LANE_AUTH);
+    
+    router.add("POST", "/upload", handleUpload, Metrics::ROUTE_UPLOAD, RequestLanes::LANE_TRANSFER);
+    router.add("POST", "/uploads", handleCreateUpload, Metrics::ROUTE_UPLOAD_SESSION, RequestLanes::LANE_TRANSFER);
+    router.add("HEAD", "/uploads/{id}", handleUploadStatus, Metrics::ROUTE_UPLOAD_SESSION, RequestLanes::LANE_TRANSFER);
+    router.add("PATCH", "/uploads/{id}", handleUploadChunk, Metrics::ROUTE_UPLOAD_SESSION, RequestLanes::LANE_TRANSFER);
+    router.add("DELETE", "/uploads/{id}", handleCancelUpload, Metrics::ROUTE_UPLOAD_SESSION, RequestLanes::LANE_TRANSFER);
+    router.add("POST", "/uploads/{id}/complete", handleCompleteUpload, Metrics::ROUTE_UPLOAD_SESSION, RequestLanes::LANE_TRANSFER);
+    router.add("GET", "/download/{id:int}", handleDownload, Metrics::ROUTE_DOWNLOAD, RequestLanes::LANE_TRANSFER);
+    router.add("GET", "/shared/{token}", handleSharedFileAccess, Metrics::ROUTE_SHARED, RequestLanes::LANE_TRANSFER);
+    router.add("POST", "/upload/batch", handleBatchUpload, Metrics::ROUTE_BATCH, RequestLanes::LANE_TRANSFER);
+    
+    router.add("POST", "/share", handleShare, Metrics::ROUTE_SHARE, RequestLanes::LANE_METADATA);
+    router.add("POST", "/share/batch", handleBatchShare, Metrics::ROUTE_BATCH, RequestLanes::LANE_METADATA);
+    router.add("POST", "/files/delete", handleBatchDelete, Metrics::ROUTE_BATCH, RequestLanes::LANE_METADATA);
+    router.add("POST", "/files/visibility", handleBatchVisibility, Metrics::ROUTE_BATCH, RequestLanes::LANE_METADATA);
+    router.add("GET", "/files", handleList, Metrics::ROUTE_FILES, RequestLanes::LANE_METADATA);
+    router.add("GET", "/shared-with-me", handleSharedWithMe, Metrics::ROUTE_SHARED_WITH_ME, RequestLanes::LANE_METADATA);
+    router.add("GET", "/metrics", handleMetrics, Metrics::ROUTE_METRICS, RequestLanes::LANE_METADATA);
+    
+    // Node to node, authenticated by the cluster secret
+    router.add("PUT", "/cluster/files", handleClusterStore, Metrics::ROUTE_CLUSTER, RequestLanes::LANE_TRANSFER);
+    router.add("DELETE", "/cluster/files", handleClusterRemove, Metrics::ROUTE_CLUSTER, RequestLanes::LANE_TRANSFER);
+}
+
 void FileShareRequestHandler::handleRequest(HTTPServerRequest& request, HTTPServerResponse& response) {
-    Poco::URI uri(request.getURI());
-    std::string path = uri.getPath();
+    RequestMetricsScope scope(response);
+    const std::string& path = match.uri.getPath();
+    
+    DFS_LOG_SAMPLED(Logger::LEVEL_INFO) << "Request: " << request.getMethod() << " " << path;
     
-    std::cout << "Request: " << request.getMethod() << " " << path << std::endl;
+    if (request.getContentLength64() > 0) {
+        Metrics::getInstance().addBytesIn(static_cast<uint64_t>(request.getContentLength64()));
+    }
 
     // ✅ CRITICAL: Set CORS headers for ALL requests
     setCORSHeaders(response);
     
     // ✅ CRITICAL: Handle OPTIONS preflight requests
     if (request.getMethod() == "OPTIONS") {
-        std::cout << "Handling OPTIONS preflight request for: " << path << std::endl;
+        DFS_LOG_SAMPLED(Logger::LEVEL_INFO) << "Handling OPTIONS preflight request for: " << path;
         response.setStatus(HTTPResponse::HTTP_OK);
         response.setContentLength(0);
         response.send();
         return;
     }
     
+    if (!match.route) {
+        sendErrorResponse(response, "Not Found", 404);
+        return;
+    }
+    scope.route = match.route->metric;
+    
     try {
-        if (path == "/register" && request.getMethod() == "POST") {
-            handleRegister(request, response);
-        }
-        else if (path == "/login" && request.getMethod() == "POST") {
-            handleLogin(request, response);
-        }
-        else if (path == "/upload" && request.getMethod() == "POST") {
-            handleUpload(request, response);
-        }
-        else if (path.find("/download/") == 0 && request.getMethod() == "GET") {
-            handleDownload(request, response);
-        }
-        else if (path == "/share" && request.getMethod() == "POST") {
-            handleShare(request, response);
-        }
-        else if (path == "/files" && request.getMethod() == "GET") {
-            handleList(request, response);
-        }
-        else if (path.find("/shared/") == 0 && request.getMethod() == "GET") { 
-            handleSharedFileAccess(request, response);                          
-        } 
-        else if (path == "/shared-with-me" && request.getMethod() == "GET") {
-            handleSharedWithMe(request, response);
-        }                                                                      // ← ADD THIS LINE
-        else {
-            sendErrorResponse(response, "Not Found", 404);
+        RequestLanes::Ticket ticket;
+        if (!RequestLanes::getInstance().admit(match.route->lane, ticket)) {
+            response.set("Retry-After", "1");
+            sendErrorResponse(response, "Server busy", 503);
+            return;
         }
+        match.route->handler(request, response, match);
     }
     catch (const std::exception& ex) {
         sendErrorResponse(response, ex.what(), 500);
     }
 }
 
-void FileShareRequestHandler::handleRegister(HTTPServerRequest& request, HTTPServerResponse& response) {
+void FileShareRequestHandler::handleRegister(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                             const RouteMatch& match) {
     std::string body;
     Poco::StreamCopier::copyToString(request.stream(), body);
     
@@ -82,46 +257,28 @@ void FileShareRequestHandler::handleRegister(HTTPServerRequest& request, HTTPSer
     std::string password = object->getValue<std::string>("password");
     std::string email = object->optValue<std::string>("email", "");
 
-    // ✅ PRE-VALIDATION: Check for existing username
-    if (isUsernameExists(username)) {
+    // Uniqueness is enforced by the INSERT itself, so there is no separate existence check
+    int userId = User::registerUser(username, password, email);
+    if (userId == 0) {
         sendErrorResponse(response, "Username already exists. Please choose a different username.", 409);
         return;
     }
     
-    if (User::registerUser(username, password, email)) {
-        // After successful registration, get the user ID
-        int userId = 0;
-        try {
-            auto session = Database::getInstance().getSession();
-            std::string user = username;
-            
-            Poco::Data::Statement select(session);
-            select << "SELECT user_id FROM users WHERE username = $1",
-                Poco::Data::Keywords::use(user), Poco::Data::Keywords::into(userId), Poco::Data::Keywords::limit(1);
-            select.execute();
-            
-            std::cout << "User '" << username << "' registered with ID: " << userId << std::endl;
-        }
-        catch (const Poco::Exception& ex) {
-            std::cerr << "Failed to retrieve user ID: " << ex.displayText() << std::endl;
-        }
-        
-        Object response_obj;
-        response_obj.set("success", true);
-        response_obj.set("message", "User registered successfully");
-        if (userId > 0) {
-            response_obj.set("user_id", userId);
-        }
-        
-        std::stringstream ss;
-        response_obj.stringify(ss);
-        sendJSONResponse(response, ss.str());
+    if (userId > 0) {
+        JsonWriter json;
+        json.beginObject()
+            .field("success", true)
+            .field("message", "User registered successfully")
+            .field("user_id", userId)
+            .endObject();
+        sendJSONResponse(response, json.str());
     } else {
         sendErrorResponse(response, "Registration failed");
     }
 }
 
-void FileShareRequestHandler::handleLogin(HTTPServerRequest& request, HTTPServerResponse& response) {
+void FileShareRequestHandler::handleLogin(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                          const RouteMatch& match) {
     std::string body;
     Poco::StreamCopier::copyToString(request.stream(), body);
     
@@ -132,33 +289,94 @@ void FileShareRequestHandler::handleLogin(HTTPServerRequest& request, HTTPServer
     std::string username = object->getValue<std::string>("username");
     std::string password = object->getValue<std::string>("password");
     
-    if (User::authenticateUser(username, password)) {
-        // Get user ID
-        auto session = Database::getInstance().getSession();
-        int userId = 0;
-        std::string user = username;
-        
-        Poco::Data::Statement select(session);
-        select << "SELECT user_id FROM users WHERE username = $1",
-            Poco::Data::Keywords::use(user), Poco::Data::Keywords::into(userId), Poco::Data::Keywords::limit(1);
-        select.execute();
-        
-        std::string sessionToken = User::createSession(userId);
-        
-        Object response_obj;
-        response_obj.set("success", true);
-        response_obj.set("session_token", sessionToken);
-        response_obj.set("user_id", userId);
-        
-        std::stringstream ss;
-        response_obj.stringify(ss);
-        sendJSONResponse(response, ss.str());
+    int userId = 0;
+    std::string sessionToken = User::login(username, password, userId);
+    if (!sessionToken.empty()) {
+        JsonWriter json;
+        json.beginObject()
+            .field("success", true)
+            .field("session_token", sessionToken)
+            .field("user_id", userId)
+            .endObject();
+        sendJSONResponse(response, json.str());
     } else {
         sendErrorResponse(response, "Authentication failed", 401);
     }
 }
 
-void FileShareRequestHandler::handleUpload(HTTPServerRequest& request, HTTPServerResponse& response) {
+void FileShareRequestHandler::handleMetrics(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                            const RouteMatch& match) {
+    std::stringstream ss;
+    Metrics::getInstance().render(ss);
+    std::string body = ss.str();
+    
+    response.setStatus(HTTPResponse::HTTP_OK);
+    response.setContentType("text/plain; version=0.0.4");
+    response.setContentLength(body.length());
+    response.send() << body;
+}
+
+void FileShareRequestHandler::handleClusterStore(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                 const RouteMatch& match) {
+    if (!Cluster::getInstance().isPeerRequest(request)) {
+        sendErrorResponse(response, "Forbidden", 403);
+        return;
+    }
+    std::string filename = clusterFilename(match);
+    if (filename.empty()) {
+        sendErrorResponse(response, "Invalid file name");
+        return;
+    }
+    if (request.getContentLength64() < 0) {
+        sendErrorResponse(response, "Content-Length required", 411);
+        return;
+    }
+    
+    if (FileManager::importStoredFile(filename, request.stream(), static_cast<long>(request.getContentLength64()))) {
+        sendJSONResponse(response, "{\"success\":true}", 201);
+    } else {
+        sendErrorResponse(response, "Failed to store file", 500);
+    }
+}
+
+void FileShareRequestHandler::handleClusterRemove(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                  const RouteMatch& match) {
+    if (!Cluster::getInstance().isPeerRequest(request)) {
+        sendErrorResponse(response, "Forbidden", 403);
+        return;
+    }
+    std::string filename = clusterFilename(match);
+    if (filename.empty()) {
+        sendErrorResponse(response, "Invalid file name");
+        return;
+    }
+    
+    // Checked here too: the same content may have been uploaded again since
+    if (FileManager::isReferenced(filename)) {
+        sendErrorResponse(response, "File is still referenced", 409);
+        return;
+    }
+    FileManager::removeFromDisk(filename);
+    sendJSONResponse(response, "{\"success\":true}");
+}
+
+void FileShareRequestHandler::handleLogout(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                           const RouteMatch& match) {
+    std::string authHeader = request.get("Authorization", "");
+    if (authHeader.find("Bearer ") != 0) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    User::destroySession(authHeader.substr(7));
+    
+    JsonWriter json;
+    json.beginObject().field("success", true).field("message", "Logged out").endObject();
+    sendJSONResponse(response, json.str());
+}
+
+void FileShareRequestHandler::handleUpload(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                           const RouteMatch& match) {
     int userId;
     if (!authenticateRequest(request, userId)) {
         sendErrorResponse(response, "Unauthorized", 401);
@@ -168,52 +386,193 @@ void FileShareRequestHandler::handleUpload(HTTPServerRequest& request, HTTPServe
     std::string contentType = request.getContentType();
     std::string filename = request.get("X-Filename", "uploaded_file");
     
-    std::string content;
-    Poco::StreamCopier::copyToString(request.stream(), content);
+    std::string contentHash = Poco::toLower(request.get("X-Content-SHA256", ""));
     
-    int fileId = FileManager::uploadFile(filename, content, contentType, userId);
+    // Body is streamed to disk in bounded chunks rather than buffered in memory
+    Poco::CountingInputStream body(request.stream());
+    int fileId = FileManager::uploadFile(filename, body, contentType, userId, 
+                                         static_cast<long>(request.getContentLength64()), contentHash);
+    if (request.getContentLength64() == HTTPMessage::UNKNOWN_CONTENT_LENGTH) {
+        // Chunked bodies weren't counted up front
+        Metrics::getInstance().addBytesIn(static_cast<uint64_t>(body.chars()));
+    }
     
     if (fileId > 0) {
-        Object response_obj;
-        response_obj.set("success", true);
-        response_obj.set("file_id", fileId);
-        response_obj.set("message", "File uploaded successfully");
-        
-        std::stringstream ss;
-        response_obj.stringify(ss);
-        sendJSONResponse(response, ss.str());
+        JsonWriter json;
+        json.beginObject()
+            .field("success", true)
+            .field("file_id", fileId)
+            .field("message", "File uploaded successfully")
+            .endObject();
+        sendJSONResponse(response, json.str());
     } else {
         sendErrorResponse(response, "Upload failed");
     }
 }
 
-void FileShareRequestHandler::handleDownload(HTTPServerRequest& request, HTTPServerResponse& response) {
-    Poco::URI uri(request.getURI());
-    std::string path = uri.getPath();
+// POST /uploads creates a session sized by Upload-Length
+void FileShareRequestHandler::handleCreateUpload(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                 const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    Poco::Int64 totalSize = -1;
+    if (!Poco::NumberParser::tryParse64(request.get("Upload-Length", ""), totalSize) || totalSize < 0) {
+        sendErrorResponse(response, "Upload-Length header is required", 400);
+        return;
+    }
+    
+    std::string filename = request.get("X-Filename", "uploaded_file");
+    std::string contentType = request.get("Upload-Content-Type", "application/octet-stream");
+    std::string uploadId = UploadSession::create(userId, filename, contentType, static_cast<long>(totalSize));
+    if (uploadId.empty()) {
+        sendErrorResponse(response, "Upload session creation failed", 500);
+        return;
+    }
+    
+    JsonWriter json;
+    json.beginObject()
+        .field("success", true)
+        .field("upload_id", uploadId)
+        .field("upload_url", "/uploads/" + uploadId)
+        .endObject();
+    response.set("Location", "/uploads/" + uploadId);
+    sendJSONResponse(response, json.str(), 201);
+}
+
+void FileShareRequestHandler::handleUploadStatus(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                 const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    UploadStatus status;
+    if (!UploadSession::getStatus(match.param("id"), userId, status)) {
+        response.setStatus(HTTPResponse::HTTP_NOT_FOUND);
+        response.setContentLength(0);
+        response.send();
+        return;
+    }
+    
+    response.set("Upload-Offset", std::to_string(status.offset));
+    response.set("Upload-Length", std::to_string(status.totalSize));
+    response.set("Upload-Received", std::to_string(status.receivedBytes));
+    response.set("Cache-Control", "no-store");
+    response.setStatus(HTTPResponse::HTTP_OK);
+    response.setContentLength(0);
+    response.send();
+}
+
+void FileShareRequestHandler::handleUploadChunk(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
     
-    // Extract file ID from path /download/{id}
-    std::string fileIdStr = path.substr(10); // Remove "/download/"
-    int fileId = std::stoi(fileIdStr);
+    // Chunks may arrive at any offset, so several can be in flight at once
+    Poco::Int64 offset = -1;
+    if (!Poco::NumberParser::tryParse64(request.get("Upload-Offset", ""), offset) || offset < 0) {
+        sendErrorResponse(response, "Upload-Offset header is required", 400);
+        return;
+    }
+    if (request.getContentLength64() == HTTPMessage::UNKNOWN_CONTENT_LENGTH) {
+        sendErrorResponse(response, "Content-Length is required for upload chunks", 411);
+        return;
+    }
+    
+    UploadStatus status;
+    UploadSession::ChunkResult result = UploadSession::writeChunk(
+        match.param("id"), userId, static_cast<long>(offset), static_cast<long>(request.getContentLength64()), 
+        request.stream(), status);
+    
+    switch (result) {
+        case UploadSession::CHUNK_OK:
+            response.set("Upload-Offset", std::to_string(status.offset));
+            response.set("Upload-Received", std::to_string(status.receivedBytes));
+            response.setStatus(HTTPResponse::HTTP_NO_CONTENT);
+            response.setContentLength(0);
+            response.send();
+            break;
+        case UploadSession::CHUNK_NOT_FOUND:
+            sendErrorResponse(response, "Upload session not found or expired", 404);
+            break;
+        case UploadSession::CHUNK_INVALID:
+            sendErrorResponse(response, "Chunk lies outside the upload", 416);
+            break;
+        case UploadSession::CHUNK_INCOMPLETE:
+            sendErrorResponse(response, "Chunk body was shorter than Content-Length", 400);
+            break;
+        default:
+            sendErrorResponse(response, "Chunk write failed", 500);
+    }
+}
+
+void FileShareRequestHandler::handleCompleteUpload(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                   const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    int fileId = UploadSession::complete(match.param("id"), userId);
+    if (fileId > 0) {
+        JsonWriter json;
+        json.beginObject()
+            .field("success", true)
+            .field("file_id", fileId)
+            .field("message", "File uploaded successfully")
+            .endObject();
+        sendJSONResponse(response, json.str());
+    } else if (fileId == 0) {
+        sendErrorResponse(response, "Upload is missing chunks", 409);
+    } else {
+        sendErrorResponse(response, "Upload completion failed", 500);
+    }
+}
+
+void FileShareRequestHandler::handleCancelUpload(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                 const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    if (UploadSession::cancel(match.param("id"), userId)) {
+        JsonWriter json;
+        json.beginObject().field("success", true).endObject();
+        sendJSONResponse(response, json.str());
+    } else {
+        sendErrorResponse(response, "Upload session not found", 404);
+    }
+}
+
+void FileShareRequestHandler::handleDownload(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                             const RouteMatch& match) {
+    int fileId = static_cast<int>(match.intParam("id"));
     
     int userId = 0;
     authenticateRequest(request, userId); // Optional for public files
     
-    std::string content;
     FileInfo info;
     
-    if (FileManager::downloadFile(fileId, userId, content, info)) {
-        response.setContentType(info.contentType);
-        response.setContentLength(content.length());
-        response.set("Content-Disposition", "attachment; filename=\"" + info.originalFilename + "\"");
-        
-        std::ostream& out = response.send();
-        out << content;
+    if (FileManager::downloadFile(fileId, userId, info)) {
+        sendFileResponse(request, response, info);
     } else {
         sendErrorResponse(response, "File not found or access denied", 404);
     }
 }
 
-void FileShareRequestHandler::handleShare(HTTPServerRequest& request, HTTPServerResponse& response) {
+void FileShareRequestHandler::handleShare(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                          const RouteMatch& match) {
     int userId;
     if (!authenticateRequest(request, userId)) {
         sendErrorResponse(response, "Unauthorized", 401);
@@ -239,44 +598,184 @@ void FileShareRequestHandler::handleShare(HTTPServerRequest& request, HTTPServer
     std::string shareToken = FileManager::shareFile(fileId, userId, sharedWithUserId, expiryHours);
     
     if (!shareToken.empty()) {
-        Object response_obj;
-        response_obj.set("success", true);
-        response_obj.set("share_token", shareToken);
-        response_obj.set("share_url", "http://localhost:8080/shared/" + shareToken);
-        
-        std::stringstream ss;
-        response_obj.stringify(ss);
-        sendJSONResponse(response, ss.str());
+        JsonWriter json;
+        json.beginObject()
+            .field("success", true)
+            .field("share_token", shareToken)
+            .field("share_url", "http://localhost:8080/shared/" + shareToken)
+            .endObject();
+        sendJSONResponse(response, json.str());
     } else {
         sendErrorResponse(response, "Share generation failed");
     }
 }
 
-void FileShareRequestHandler::handleSharedFileAccess(HTTPServerRequest& request, HTTPServerResponse& response) {
-    Poco::URI uri(request.getURI());
-    std::string path = uri.getPath();
+// POST /upload/batch: multipart/form-data, one file part per upload, recorded in one transaction
+void FileShareRequestHandler::handleBatchUpload(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    size_t maxItems = FileManager::getMaxBatchItems();
+    BatchUploadPartHandler parts(maxItems);
+    try {
+        // One part past the limit reaches the handler and marks the batch rejected;
+        // the form stops reading at the part after that
+        HTMLForm form;
+        form.setFieldLimit(static_cast<int>(maxItems) + 1);
+        form.load(request, request.stream(), parts);
+    }
+    catch (const Poco::Exception& ex) {
+        if (parts.rejected == 0) {
+            FileManager::discardStagedUploads(parts.uploads);
+            sendErrorResponse(response, "Invalid multipart body: " + ex.displayText());
+            return;
+        }
+    }
+    
+    if (parts.rejected > 0) {
+        // The rest of the body was never read, so the connection can't be reused
+        FileManager::discardStagedUploads(parts.uploads);
+        response.setKeepAlive(false);
+        sendErrorResponse(response, "Too many files in batch (max " + std::to_string(maxItems) + ")", 413);
+        return;
+    }
+    if (parts.filenames.empty()) {
+        sendErrorResponse(response, "No files in request");
+        return;
+    }
+    
+    std::vector<BatchResult> committed = FileManager::commitUploads(parts.uploads, userId);
+    
+    std::vector<BatchResult> results;
+    for (int index : parts.stagedIndex) {
+        results.push_back(index >= 0 ? committed[index] : BatchResult{0, false, "", "Upload failed"});
+    }
+    JsonWriter json;
+    writeBatchResults(json, results, &parts.filenames);
+    sendJSONResponse(response, json.str());
+}
+
+// POST /files/delete: {"file_ids": [..]}
+void FileShareRequestHandler::handleBatchDelete(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    std::string body;
+    Poco::StreamCopier::copyToString(request.stream(), body);
+    
+    Parser parser;
+    Object::Ptr object = parser.parse(body).extract<Object::Ptr>();
+    
+    std::vector<int> fileIds;
+    if (!parseFileIds(object, fileIds) || fileIds.empty()) {
+        sendErrorResponse(response, "file_ids must be a non-empty array");
+        return;
+    }
+    if (fileIds.size() > FileManager::getMaxBatchItems()) {
+        sendErrorResponse(response, "Too many files in batch (max " + 
+                          std::to_string(FileManager::getMaxBatchItems()) + ")", 413);
+        return;
+    }
+    
+    JsonWriter json;
+    writeBatchResults(json, FileManager::deleteFiles(fileIds, userId));
+    sendJSONResponse(response, json.str());
+}
+
+// POST /files/visibility: {"file_ids": [..], "is_public": true}
+void FileShareRequestHandler::handleBatchVisibility(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                    const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    std::string body;
+    Poco::StreamCopier::copyToString(request.stream(), body);
+    
+    Parser parser;
+    Object::Ptr object = parser.parse(body).extract<Object::Ptr>();
+    
+    std::vector<int> fileIds;
+    if (!parseFileIds(object, fileIds) || fileIds.empty() || !object->has("is_public")) {
+        sendErrorResponse(response, "file_ids and is_public are required");
+        return;
+    }
+    if (fileIds.size() > FileManager::getMaxBatchItems()) {
+        sendErrorResponse(response, "Too many files in batch (max " + 
+                          std::to_string(FileManager::getMaxBatchItems()) + ")", 413);
+        return;
+    }
+    
+    bool isPublic = object->getValue<bool>("is_public");
+    JsonWriter json;
+    writeBatchResults(json, FileManager::setFilesPublic(fileIds, userId, isPublic));
+    sendJSONResponse(response, json.str());
+}
+
+// POST /share/batch: {"shares": [{"file_id": 1, "shared_with_user_id": 2, "expiry_hours": 24}, ..]}
+void FileShareRequestHandler::handleBatchShare(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                               const RouteMatch& match) {
+    int userId;
+    if (!authenticateRequest(request, userId)) {
+        sendErrorResponse(response, "Unauthorized", 401);
+        return;
+    }
+    
+    std::string body;
+    Poco::StreamCopier::copyToString(request.stream(), body);
     
-    // Extract share token from path /shared/{token}
-    std::string shareToken = path.substr(8); // Remove "/shared/"
+    Parser parser;
+    Object::Ptr object = parser.parse(body).extract<Object::Ptr>();
     
-    if (shareToken.empty()) {
-        sendErrorResponse(response, "Share token is required", 400);
+    Array::Ptr items = object->getArray("shares");
+    if (!items || items->size() == 0) {
+        sendErrorResponse(response, "shares must be a non-empty array");
+        return;
+    }
+    if (items->size() > FileManager::getMaxBatchItems()) {
+        sendErrorResponse(response, "Too many shares in batch (max " + 
+                          std::to_string(FileManager::getMaxBatchItems()) + ")", 413);
         return;
     }
+    
+    std::vector<ShareSpec> shares;
+    for (size_t i = 0; i < items->size(); ++i) {
+        Object::Ptr item = items->getObject(static_cast<unsigned>(i));
+        if (!item) {
+            sendErrorResponse(response, "Each share must be an object");
+            return;
+        }
+        shares.push_back(ShareSpec{item->getValue<int>("file_id"), 
+                                   item->optValue<int>("shared_with_user_id", 0), 
+                                   item->optValue<int>("expiry_hours", 24)});
+    }
+    
+    JsonWriter json;
+    writeBatchResults(json, FileManager::shareFiles(shares, userId));
+    sendJSONResponse(response, json.str());
+}
+
+void FileShareRequestHandler::handleSharedFileAccess(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                     const RouteMatch& match) {
+    const std::string& shareToken = match.param("token");
 
     int userId = 0;  // 0 means anonymous access
     authenticateRequest(request, userId);  // This sets userId if auth succeeds, otherwise stays 0
     
-    std::string content;
     FileInfo info;
     
-    if (FileManager::accessSharedFile(shareToken, userId, content, info)) {
-        response.setContentType(info.contentType);
-        response.setContentLength(content.length());
-        response.set("Content-Disposition", "attachment; filename=\"" + info.originalFilename + "\"");
-        
-        std::ostream& out = response.send();
-        out << content;
+    if (FileManager::accessSharedFile(shareToken, userId, info)) {
+        sendFileResponse(request, response, info);
     } else {
         if (userId == 0) {
             // Might be a private share requiring authentication
@@ -287,34 +786,337 @@ void FileShareRequestHandler::handleSharedFileAccess(HTTPServerRequest& request,
     }
 }
 
-void FileShareRequestHandler::handleList(HTTPServerRequest& request, HTTPServerResponse& response) {
+void FileShareRequestHandler::handleList(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                         const RouteMatch& match) {
     int userId;
     if (!authenticateRequest(request, userId)) {
         sendErrorResponse(response, "Unauthorized", 401);
         return;
     }
     
-    auto files = FileManager::getUserFiles(userId);
+    // The version is read before the query, so a concurrent write can only make the tag stale, never wrong
+    MetadataCache& cache = MetadataCache::getInstance();
+    std::string etag;
+    if (cache.hasListingVersions()) {
+        etag = "\"l" + std::to_string(cache.getListingVersion(MetadataCache::LISTING_FILES, userId)) + "\"";
+    }
+    response.set("Cache-Control", "private, no-cache");
+    if (!etag.empty() && etagMatches(request.get("If-None-Match", ""), etag)) {
+        sendNotModified(response, etag);
+        return;
+    }
     
-    Array filesArray;
-    for (const auto& file : files) {
-        Object fileObj;
-        fileObj.set("file_id", file.fileId);
-        fileObj.set("filename", file.originalFilename);
-        fileObj.set("size", file.fileSize);
-        fileObj.set("content_type", file.contentType);
-        fileObj.set("upload_date", file.uploadDate);
-        fileObj.set("is_public", file.isPublic);
-        filesArray.add(fileObj);
+    // GET /files?limit=N&cursor=C: newest first, next_cursor continues where this page ended
+    FileListCursor cursor;
+    bool hasCursor = false;
+    long requestedLimit = 0;
+    for (const auto& parameter : match.uri.getQueryParameters()) {
+        if (parameter.first == "cursor" && !parameter.second.empty()) {
+            if (!FileManager::parseListCursor(parameter.second, cursor)) {
+                sendErrorResponse(response, "Invalid cursor");
+                return;
+            }
+            hasCursor = true;
+        }
+        else if (parameter.first == "limit") {
+            int value = 0;
+            if (!Poco::NumberParser::tryParse(parameter.second, value) || value <= 0) {
+                sendErrorResponse(response, "limit must be a positive integer");
+                return;
+            }
+            requestedLimit = value;
+        }
     }
+    size_t limit = FileManager::getListPageSize(requestedLimit);
     
-    Object response_obj;
-    response_obj.set("success", true);
-    response_obj.set("files", filesArray);
+    // Rows are encoded as they are fetched and go out in chunks of about LIST_FLUSH_BYTES;
+    // headers go out with the first row, so a failing query can still be reported as an error
+    const size_t LIST_FLUSH_BYTES = 16 * 1024;
+    JsonWriter json;
+    std::unique_ptr<Poco::CountingOutputStream> out;
+    auto begin = [&]() {
+        if (out) return;
+        if (!etag.empty()) response.set("ETag", etag);
+        response.setContentType("application/json");
+        response.setChunkedTransferEncoding(true);
+        out.reset(new Poco::CountingOutputStream(response.send()));
+        json.beginObject().field("success", true).key("files").beginArray();
+    };
     
-    std::stringstream ss;
-    response_obj.stringify(ss);
-    sendJSONResponse(response, ss.str());
+    std::string nextCursor;
+    bool ok = FileManager::listUserFiles(userId, hasCursor ? &cursor : nullptr, limit, [&](const FileInfo& file) {
+        begin();
+        json.beginObject()
+            .field("file_id", file.fileId)
+            .field("filename", file.originalFilename)
+            .field("size", file.fileSize)
+            .field("content_type", file.contentType)
+            .field("upload_date", file.uploadDate)
+            .field("is_public", file.isPublic)
+            .endObject();
+        if (json.size() >= LIST_FLUSH_BYTES) json.flushTo(*out);
+    }, nextCursor);
+    
+    if (!ok) {
+        if (!out) {
+            sendErrorResponse(response, "Failed to load files", 500);
+        } else {
+            // Too late for a status code; the truncated body tells the client the listing is incomplete
+            json.flushTo(*out);
+            out->flush();
+            Metrics::getInstance().addBytesOut(static_cast<uint64_t>(out->chars()));
+        }
+        return;
+    }
+    
+    begin();
+    json.endArray().key("next_cursor");
+    if (nextCursor.empty()) json.null();
+    else json.value(nextCursor);
+    json.endObject().flushTo(*out);
+    out->flush();
+    Metrics::getInstance().addBytesOut(static_cast<uint64_t>(out->chars()));
+}
+
+void FileShareRequestHandler::sendFileResponse(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                               const FileInfo& info) {
+    Compression& compression = Compression::getInstance();
+    bool compressible = compression.isCompressible(info.contentType, static_cast<Poco::UInt64>(info.fileSize));
+    
+    // Ranges address the identity bytes, so ranged requests are never encoded
+    std::vector<Compression::Encoding> encodings;
+    if (compressible && !request.has("Range")) {
+        encodings = compression.negotiate(request.get("Accept-Encoding", ""));
+    }
+    
+    std::string etag = FileManager::getETag(info);
+    response.set("Cache-Control", "private, no-cache");
+    if (compressible) response.set("Vary", "Accept-Encoding");
+    
+    // Revalidation is answered from metadata alone; the file is not even opened
+    if (request.has("If-None-Match")) {
+        const std::string& ifNoneMatch = request.get("If-None-Match");
+        if (etagMatches(ifNoneMatch, etag)) {
+            sendNotModified(response, etag);
+            return;
+        }
+        for (Compression::Encoding encoding : encodings) {
+            std::string encodedTag = encodedETag(etag, encoding);
+            if (etagMatches(ifNoneMatch, encodedTag)) {
+                sendNotModified(response, encodedTag);
+                return;
+            }
+        }
+    }
+    
+    // Held by another node: its bytes come from there. A forwarded request is always
+    // answered here, so a stale location cannot bounce it around the cluster.
+    Cluster& cluster = Cluster::getInstance();
+    ClusterNode holder;
+    if (!request.has(Cluster::FORWARDED_HEADER) && cluster.findRemoteHolder(info.filename, holder)) {
+        if (!cluster.forward(request, response, holder)) {
+            sendErrorResponse(response, "The node holding this file is unavailable", 502);
+        }
+        return;
+    }
+    
+    // Memory use is bounded: the body goes from disk to socket, or through a few chunk
+    // buffers, without being loaded
+    std::string path = FileManager::getFilePath(info);
+    FileTransfer transfer;
+    if (!transfer.open(path) && !transfer.openChunked(info.filename)) {
+        sendErrorResponse(response, "File content is missing", 404);
+        return;
+    }
+    
+    Poco::UInt64 size = transfer.size();
+    std::string lastModified = Poco::DateTimeFormatter::format(transfer.lastModified(), 
+                                                               Poco::DateTimeFormat::HTTP_FORMAT);
+    response.set("Last-Modified", lastModified);
+    
+    // If-Modified-Since only counts when the client sent no entity tags
+    if (!request.has("If-None-Match") && request.has("If-Modified-Since")) {
+        Poco::DateTime since;
+        int timeZone = 0;
+        if (Poco::DateTimeParser::tryParse(request.get("If-Modified-Since"), since, timeZone) &&
+            transfer.lastModified().epochTime() <= since.timestamp().epochTime()) {
+            sendNotModified(response, etag);
+            return;
+        }
+    }
+    
+    response.set("Content-Disposition", "attachment; filename=\"" + info.originalFilename + "\"");
+    
+    if (!encodings.empty() && sendCompressedResponse(request, response, info, path, size, encodings, etag)) return;
+    
+    response.set("ETag", etag);
+    response.set("Accept-Ranges", "bytes");
+    
+    std::vector<ByteRange> ranges;
+    FileTransfer::RangeResult rangeResult = FileTransfer::RANGE_NONE;
+    if (request.has("Range")) {
+        // A stale If-Range validator means the client's partial copy is outdated: send everything
+        std::string ifRange = request.get("If-Range", "");
+        if (ifRange.empty() || ifRange == lastModified || ifRange == etag) {
+            rangeResult = FileTransfer::parseRange(request.get("Range"), size, ranges);
+        }
+    }
+    
+    if (rangeResult == FileTransfer::RANGE_UNSATISFIABLE) {
+        response.set("Content-Range", "bytes */" + std::to_string(size));
+        sendErrorResponse(response, "Requested range not satisfiable", 416);
+        return;
+    }
+    
+    // The body as literal prefixes (multipart part headers) each followed by a span of the file
+    std::vector<TransferSegment> segments;
+    Poco::UInt64 bodyLength = 0;
+    if (rangeResult == FileTransfer::RANGE_NONE) {
+        response.setContentType(info.contentType);
+        response.setContentLength64(size);
+        segments.push_back(TransferSegment{"", 0, size});
+        bodyLength = size;
+    }
+    else if (ranges.size() == 1) {
+        const ByteRange& range = ranges.front();
+        response.setStatus(HTTPResponse::HTTP_PARTIAL_CONTENT);
+        response.setContentType(info.contentType);
+        response.setContentLength64(range.length());
+        response.set("Content-Range", "bytes " + std::to_string(range.first) + "-" + 
+                     std::to_string(range.last) + "/" + std::to_string(size));
+        segments.push_back(TransferSegment{"", range.first, range.length()});
+        bodyLength = range.length();
+    }
+    else {
+        // multipart/byteranges: part headers are small strings, part bodies come straight from disk
+        std::string boundary = Poco::UUIDGenerator::defaultGenerator().createRandom().toString();
+        
+        for (const auto& range : ranges) {
+            std::string partHeader = "\r\n--" + boundary + "\r\n"
+                                     "Content-Type: " + info.contentType + "\r\n"
+                                     "Content-Range: bytes " + std::to_string(range.first) + "-" + 
+                                     std::to_string(range.last) + "/" + std::to_string(size) + "\r\n\r\n";
+            bodyLength += partHeader.size() + range.length();
+            segments.push_back(TransferSegment{partHeader, range.first, range.length()});
+        }
+        std::string trailer = "\r\n--" + boundary + "--\r\n";
+        bodyLength += trailer.size();
+        segments.push_back(TransferSegment{trailer, 0, 0});
+        
+        response.setStatus(HTTPResponse::HTTP_PARTIAL_CONTENT);
+        response.setContentType("multipart/byteranges; boundary=" + boundary);
+        response.setContentLength64(bodyLength);
+    }
+    
+    if (handOffTransfer(request, response, transfer, segments, bodyLength)) return;
+    
+    bool ok = true;
+    std::ostream& out = response.send();
+    for (size_t i = 0; i < segments.size() && ok; ++i) {
+        out << segments[i].prefix;
+        if (segments[i].fileLength > 0) {
+            ok = transfer.send(request, out, segments[i].fileOffset, segments[i].fileLength);
+        }
+    }
+    if (ok) {
+        out.flush();
+        ok = static_cast<bool>(out);
+    }
+    
+    if (!ok) {
+        DFS_LOG_WARN << "Transfer of file " << info.fileId << " aborted";
+    }
+}
+
+bool FileShareRequestHandler::sendCompressedResponse(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                     const FileInfo& info, const std::string& path, Poco::UInt64 size, 
+                                                     const std::vector<Compression::Encoding>& accepted, 
+                                                     const std::string& etag) {
+    Compression& compression = Compression::getInstance();
+    
+    // A precompressed sidecar is just another stored file: sendfile, and the reactor for large ones
+    for (Compression::Encoding encoding : accepted) {
+        std::string sidecarPath = StorageBackend::getInstance().locate(Compression::getSidecarPath(info.filename, encoding));
+        FileTransfer sidecar;
+        if (sidecarPath.empty() || !sidecar.open(sidecarPath)) continue;
+        
+        response.setContentType(info.contentType);
+        response.set("Content-Encoding", Compression::encodingName(encoding));
+        response.set("ETag", encodedETag(etag, encoding));
+        response.setContentLength64(sidecar.size());
+        compression.recordResponse(encoding, true);
+        
+        std::vector<TransferSegment> segments(1, TransferSegment{"", 0, sidecar.size()});
+        if (handOffTransfer(request, response, sidecar, segments, sidecar.size())) return true;
+        
+        std::ostream& out = response.send();
+        bool ok = sidecar.send(request, out, 0, sidecar.size());
+        if (ok) {
+            out.flush();
+            ok = static_cast<bool>(out);
+        }
+        if (!ok) {
+            DFS_LOG_WARN << "Transfer of file " << info.fileId << " aborted";
+        }
+        return true;
+    }
+    
+    if (size > compression.getStreamLimit()) return false;
+    
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    
+    // No sidecar (yet): compress on the fly, length unknown up front
+    Compression::Encoding encoding = accepted.front();
+    response.setContentType(info.contentType);
+    response.set("Content-Encoding", Compression::encodingName(encoding));
+    response.set("ETag", encodedETag(etag, encoding));
+    response.setChunkedTransferEncoding(true);
+    compression.recordResponse(encoding, false);
+    
+    std::ostream& out = response.send();
+    Poco::CountingOutputStream counted(out);
+    bool ok = compression.compress(file, counted, encoding, Compression::MODE_STREAM);
+    counted.flush();
+    Metrics::getInstance().addBytesOut(static_cast<uint64_t>(counted.chars()));
+    
+    if (!ok) {
+        DFS_LOG_WARN << "Compressed transfer of file " << info.fileId << " aborted";
+    }
+    return true;
+}
+
+bool FileShareRequestHandler::handOffTransfer(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                               FileTransfer& transfer, std::vector<TransferSegment>& segments, 
+                                               Poco::UInt64 bodyLength) {
+    TransferReactor& reactor = TransferReactor::getInstance();
+    if (!reactor.isRunning() || bodyLength < reactor.getMinimumTransferSize()) return false;
+    if (transfer.descriptor() < 0) return false;  // Chunked: sent from this thread
+    
+    int socketFd = FileTransfer::socketDescriptor(request);
+    if (socketFd < 0) return false;
+    
+    // Poco closes its descriptor once we return, so the reactor works on duplicates. The
+    // connection cannot go back to Poco afterwards, hence no keep-alive.
+    bool keepAlive = response.getKeepAlive();
+    response.setKeepAlive(false);
+    std::ostringstream head;
+    response.write(head);
+    
+    int socketCopy = ::fcntl(socketFd, F_DUPFD_CLOEXEC, 0);
+    int fileCopy = ::fcntl(transfer.descriptor(), F_DUPFD_CLOEXEC, 0);
+    std::string headers = head.str();
+    segments.front().prefix.insert(0, headers);
+    
+    if (socketCopy >= 0 && fileCopy >= 0 && reactor.submit(socketCopy, fileCopy, std::move(segments))) {
+        return true;
+    }
+    
+    if (socketCopy >= 0) ::close(socketCopy);
+    if (fileCopy >= 0) ::close(fileCopy);
+    segments.front().prefix.erase(0, headers.size());
+    response.setKeepAlive(keepAlive);
+    return false;
 }
 
 bool FileShareRequestHandler::authenticateRequest(HTTPServerRequest& request, int& userId) {
@@ -326,58 +1128,62 @@ bool FileShareRequestHandler::authenticateRequest(HTTPServerRequest& request, in
     return false;
 }
 
-bool FileShareRequestHandler::isUsernameExists(const std::string& username) {
-    try {
-        auto session = Database::getInstance().getSession();
-        int count = 0;
-        std::string user = username;
-        
-        Poco::Data::Statement check(session);
-        check << "SELECT COUNT(*) FROM users WHERE username = $1",
-            Poco::Data::Keywords::use(user), Poco::Data::Keywords::into(count);
-        check.execute();
-        
-        return count > 0;
-    } catch (const Poco::Exception& ex) {
-        std::cerr << "Username check failed: " << ex.displayText() << std::endl;
-        return false; // Assume not exists on error to allow registration attempt
-    }
-}
-
 void FileShareRequestHandler::sendJSONResponse(HTTPServerResponse& response, const std::string& json, int status) {
     response.setStatus(static_cast<HTTPResponse::HTTPStatus>(status));
     response.setContentType("application/json");
     response.setContentLength(json.length());
     
     std::ostream& out = response.send();
-    out << json;
+    out.write(json.data(), static_cast<std::streamsize>(json.length()));
+    Metrics::getInstance().addBytesOut(json.length());
 }
 
 void FileShareRequestHandler::sendErrorResponse(HTTPServerResponse& response, const std::string& error, int status) {
-    Object errorObj;
-    errorObj.set("success", false);
-    errorObj.set("error", error);
-    
-    std::stringstream ss;
-    errorObj.stringify(ss);
-    sendJSONResponse(response, ss.str(), status);
+    JsonWriter json;
+    json.beginObject().field("success", false).field("error", error).endObject();
+    sendJSONResponse(response, json.str(), status);
+}
+
+void FileShareRequestHandler::sendNotModified(HTTPServerResponse& response, const std::string& etag) {
+    // Poco writes no body for 304
+    response.setStatus(HTTPResponse::HTTP_NOT_MODIFIED);
+    response.set("ETag", etag);
+    response.send();
 }
 
 void FileShareRequestHandler::setCORSHeaders(HTTPServerResponse& response) {
     response.set("Access-Control-Allow-Origin", "http://localhost:3000");
-    response.set("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
-    response.set("Access-Control-Allow-Headers", "Content-Type, Authorization, X-Filename");
+    response.set("Access-Control-Allow-Methods", "GET, HEAD, POST, PUT, PATCH, DELETE, OPTIONS");
+    response.set("Access-Control-Allow-Headers", "Content-Type, Authorization, X-Filename, X-Content-SHA256, Range, If-Range, "
+                 "If-None-Match, If-Modified-Since, "
+                 "Upload-Length, Upload-Offset, Upload-Content-Type");
+    response.set("Access-Control-Expose-Headers", "Accept-Ranges, Content-Range, Content-Length, Location, ETag, Last-Modified, "
+                 "Upload-Offset, Upload-Length, Upload-Received");
     response.set("Access-Control-Allow-Credentials", "true");
     response.set("Access-Control-Max-Age", "86400");
 }
 
-void FileShareRequestHandler::handleSharedWithMe(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response) {
+void FileShareRequestHandler::handleSharedWithMe(HTTPServerRequest& request, HTTPServerResponse& response, 
+                                                 const RouteMatch& match) {
     int userId;
     if (!authenticateRequest(request, userId)) {
         sendErrorResponse(response, "Unauthorized", 401);
         return;
     }
     
+    MetadataCache& cache = MetadataCache::getInstance();
+    uint64_t version = 0;
+    std::string etag;
+    if (cache.hasListingVersions()) {
+        version = cache.getListingVersion(MetadataCache::LISTING_SHARED_WITH_ME, userId);
+        etag = "\"l" + std::to_string(version) + "\"";
+    }
+    response.set("Cache-Control", "private, no-cache");
+    if (!etag.empty() && etagMatches(request.get("If-None-Match", ""), etag)) {
+        sendNotModified(response, etag);
+        return;
+    }
+    
     try {
         auto session = Database::getInstance().getSession();
         
@@ -392,10 +1198,12 @@ void FileShareRequestHandler::handleSharedWithMe(Poco::Net::HTTPServerRequest& r
         std::vector<std::string> shareTokens;
         std::vector<std::string> sharedByUsers;
         std::vector<std::string> expiryDates;
+        std::vector<Poco::Int64> expiryEpochs;
         
         Poco::Data::Statement select(session);
         select << "SELECT f.file_id, f.filename, f.original_filename, f.file_size, f.content_type, "
-                  "f.owner_id, f.upload_date, fs.share_token, u.username, fs.expires_at "
+                  "f.owner_id, f.upload_date, fs.share_token, u.username, fs.expires_at, "
+                  "COALESCE(EXTRACT(EPOCH FROM fs.expires_at), 0)::bigint "
                   "FROM files f "
                   "JOIN file_shares fs ON f.file_id = fs.file_id "
                   "JOIN users u ON fs.shared_by = u.user_id "
@@ -406,62 +1214,222 @@ void FileShareRequestHandler::handleSharedWithMe(Poco::Net::HTTPServerRequest& r
             Poco::Data::Keywords::into(originalFilenames), Poco::Data::Keywords::into(fileSizes),
             Poco::Data::Keywords::into(contentTypes), Poco::Data::Keywords::into(ownerIds), 
             Poco::Data::Keywords::into(uploadDates), Poco::Data::Keywords::into(shareTokens),
-            Poco::Data::Keywords::into(sharedByUsers), Poco::Data::Keywords::into(expiryDates);
+            Poco::Data::Keywords::into(sharedByUsers), Poco::Data::Keywords::into(expiryDates),
+            Poco::Data::Keywords::into(expiryEpochs);
         select.execute();
         
-        Array filesArray;
-        for (size_t i = 0; i < fileIds.size(); ++i) {
-            Object fileObj;
-            fileObj.set("file_id", fileIds[i]);
-            fileObj.set("filename", originalFilenames[i]);
-            fileObj.set("size", fileSizes[i]);
-            fileObj.set("content_type", contentTypes[i]);
-            fileObj.set("upload_date", uploadDates[i]);
-            fileObj.set("share_token", shareTokens[i]);
-            fileObj.set("shared_by", sharedByUsers[i]);
-            fileObj.set("expires_at", expiryDates[i]);
-            fileObj.set("owner_id", ownerIds[i]);
-            filesArray.add(fileObj);
+        // The listing shrinks by itself when its first share expires
+        Poco::Int64 firstExpiry = 0;
+        for (Poco::Int64 expiry : expiryEpochs) {
+            if (expiry > 0 && (firstExpiry == 0 || expiry < firstExpiry)) firstExpiry = expiry;
+        }
+        if (firstExpiry > 0 && !etag.empty()) {
+            cache.expireListingVersion(MetadataCache::LISTING_SHARED_WITH_ME, userId, version, 
+                                       Poco::Timestamp::fromEpochTime(static_cast<std::time_t>(firstExpiry)));
         }
         
-        Object response_obj;
-        response_obj.set("success", true);
-        response_obj.set("shared_files", filesArray);
+        JsonWriter json;
+        json.beginObject().field("success", true).key("shared_files").beginArray();
+        for (size_t i = 0; i < fileIds.size(); ++i) {
+            json.beginObject()
+                .field("file_id", fileIds[i])
+                .field("filename", originalFilenames[i])
+                .field("size", fileSizes[i])
+                .field("content_type", contentTypes[i])
+                .field("upload_date", uploadDates[i])
+                .field("share_token", shareTokens[i])
+                .field("shared_by", sharedByUsers[i])
+                .field("expires_at", expiryDates[i])
+                .field("owner_id", ownerIds[i])
+                .endObject();
+        }
+        json.endArray().endObject();
         
-        std::stringstream ss;
-        response_obj.stringify(ss);
-        sendJSONResponse(response, ss.str());
+        if (!etag.empty()) response.set("ETag", etag);
+        sendJSONResponse(response, json.str());
         
     } catch (const Poco::Exception& ex) {
         sendErrorResponse(response, "Failed to load shared files: " + ex.displayText(), 500);
     }
 }
 
+FileShareRequestHandlerFactory::FileShareRequestHandlerFactory() {
+    FileShareRequestHandler::registerRoutes(router);
+}
+
 HTTPRequestHandler* FileShareRequestHandlerFactory::createRequestHandler(const HTTPServerRequest& request) {
-    return new FileShareRequestHandler();
+    // Routing happens here, once; an unmatched request carries a null route and gets a 404
+    RouteMatch match;
+    router.match(request.getMethod(), request.getURI(), match);
+    return new FileShareRequestHandler(std::move(match));
 }
 
-WebServer::WebServer(int port) : serverPort(port), httpServer(nullptr) {}
+WebServer::WebServer(int port) 
+    : serverPort(port), threadPool(nullptr), httpServer(nullptr), collectorsRegistered(false) {}
 
 WebServer::~WebServer() {
     stop();
 }
 
 void WebServer::start() {
-    ServerSocket serverSocket(serverPort);
+    // Connections parked on long downloads live in the transfer reactor, not in the thread pool,
+    // so the accept queue is sized for bursts rather than for the number of workers
+    ServerSocket serverSocket(serverPort, static_cast<int>(Config::getInt("DFS_HTTP_BACKLOG", 1024)));
+    // Queued requests hold a worker while they wait for their lane, so every lane's active and
+    // queued requests need a thread of their own or one lane could starve the others
+    int threads = RequestLanes::getInstance().totalThreads();
     HTTPServerParams* params = new HTTPServerParams();
-    params->setMaxThreads(16);
+    params->setMaxThreads(threads);
+    params->setMaxQueued(static_cast<int>(Config::getInt("DFS_HTTP_MAX_QUEUED", 1024)));
+    
+    TransferReactor::getInstance().start();
+    Compression::getInstance().start();
+    StorageBackend::getInstance().start();
+    ChunkStore::getInstance().start();
     
-    httpServer = new HTTPServer(new FileShareRequestHandlerFactory(), serverSocket, params);
+    threadPool = new Poco::ThreadPool(std::min(threads, 4), threads);
+    httpServer = new HTTPServer(new FileShareRequestHandlerFactory(), *threadPool, serverSocket, params);
     httpServer->start();
+    // Joins once it can answer its peers
+    Cluster::getInstance().start();
+    Maintenance::getInstance().start();
+    
+    registerMetricCollectors();
+    
+    DFS_LOG_INFO << "File sharing server started on port " << serverPort;
+}
+
+void WebServer::registerMetricCollectors() {
+    if (collectorsRegistered) return;
+    collectorsRegistered = true;
+    
+    // Read through the current server at scrape time; nothing is sampled on the request path
+    Metrics::getInstance().addCollector([this](std::ostream& out) {
+        HTTPServer* server = httpServer;
+        if (!server) return;
+        out << "# TYPE dfs_http_connections_active gauge\n";
+        out << "dfs_http_connections_active " << server->currentConnections() << "\n";
+        out << "# TYPE dfs_http_connections_queued gauge\n";
+        out << "dfs_http_connections_queued " << server->queuedConnections() << "\n";
+        out << "# TYPE dfs_http_connections_total counter\n";
+        out << "dfs_http_connections_total " << server->totalConnections() << "\n";
+        out << "# TYPE dfs_http_connections_refused_total counter\n";
+        out << "dfs_http_connections_refused_total " << server->refusedConnections() << "\n";
+        out << "# TYPE dfs_http_threads_busy gauge\n";
+        out << "dfs_http_threads_busy " << server->currentThreads() << "\n";
+        out << "# TYPE dfs_http_threads_max gauge\n";
+        out << "dfs_http_threads_max " << server->maxThreads() << "\n";
+        out << "# TYPE dfs_http_thread_pool_saturation gauge\n";
+        out << "dfs_http_thread_pool_saturation " 
+            << (server->maxThreads() > 0 ? static_cast<double>(server->currentThreads()) / server->maxThreads() : 0.0) 
+            << "\n";
+    });
+    
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        RequestLanes::getInstance().render(out);
+    });
     
-    std::cout << "File sharing server started on port " << serverPort << std::endl;
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        Logger& logger = Logger::getInstance();
+        out << "# TYPE dfs_log_records_dropped_total counter\n";
+        out << "dfs_log_records_dropped_total " << logger.getDropped() << "\n";
+        out << "# TYPE dfs_log_records_sampled_out_total counter\n";
+        out << "dfs_log_records_sampled_out_total " << logger.getSampledOut() << "\n";
+    });
+    
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        Compression::getInstance().render(out);
+    });
+    
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        StorageBackend::getInstance().render(out);
+    });
+    
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        ChunkStore::getInstance().render(out);
+    });
+    
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        Cluster::getInstance().render(out);
+    });
+    
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        Maintenance::getInstance().render(out);
+    });
+    
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        TransferReactorStats transfers = TransferReactor::getInstance().getStats();
+        out << "# TYPE dfs_transfer_reactor_connections gauge\n";
+        out << "dfs_transfer_reactor_connections " << transfers.active << "\n";
+        out << "# TYPE dfs_transfer_reactor_transfers_total counter\n";
+        out << "dfs_transfer_reactor_transfers_total{result=\"completed\"} " << transfers.completed << "\n";
+        out << "dfs_transfer_reactor_transfers_total{result=\"aborted\"} " << transfers.aborted << "\n";
+        out << "# TYPE dfs_transfer_reactor_handoffs_total counter\n";
+        out << "dfs_transfer_reactor_handoffs_total{result=\"accepted\"} " << transfers.accepted << "\n";
+        out << "dfs_transfer_reactor_handoffs_total{result=\"rejected\"} " << transfers.rejected << "\n";
+        out << "# TYPE dfs_transfer_reactor_idle_timeouts_total counter\n";
+        out << "dfs_transfer_reactor_idle_timeouts_total " << transfers.timedOut << "\n";
+    });
+    
+    Metrics::getInstance().addCollector([](std::ostream& out) {
+        PoolStats pool = Database::getInstance().getPoolStats();
+        out << "# TYPE dfs_db_pool_connections gauge\n";
+        out << "dfs_db_pool_connections{state=\"in_use\"} " << pool.inUse << "\n";
+        out << "dfs_db_pool_connections{state=\"idle\"} " << pool.idle << "\n";
+        out << "dfs_db_pool_connections{state=\"max\"} " << pool.maxSize << "\n";
+        out << "# TYPE dfs_db_pool_acquisitions_total counter\n";
+        out << "dfs_db_pool_acquisitions_total " << pool.acquisitions << "\n";
+        out << "# TYPE dfs_db_pool_waits_total counter\n";
+        out << "dfs_db_pool_waits_total " << pool.waits << "\n";
+        out << "# TYPE dfs_db_pool_wait_timeouts_total counter\n";
+        out << "dfs_db_pool_wait_timeouts_total " << pool.waitTimeouts << "\n";
+        out << "# TYPE dfs_db_pool_wait_seconds_total counter\n";
+        out << "dfs_db_pool_wait_seconds_total " << pool.waitMicros / 1e6 << "\n";
+        out << "# TYPE dfs_db_pool_connections_created_total counter\n";
+        out << "dfs_db_pool_connections_created_total " << pool.connectionsCreated << "\n";
+        out << "# TYPE dfs_db_pool_health_check_failures_total counter\n";
+        out << "dfs_db_pool_health_check_failures_total " << pool.healthCheckFailures << "\n";
+        
+        SessionCacheStats sessions = SessionCache::getInstance().getStats();
+        out << "# TYPE dfs_session_cache_lookups_total counter\n";
+        out << "dfs_session_cache_lookups_total{result=\"hit\"} " << sessions.hits << "\n";
+        out << "dfs_session_cache_lookups_total{result=\"negative_hit\"} " << sessions.negativeHits << "\n";
+        out << "dfs_session_cache_lookups_total{result=\"miss\"} " << sessions.misses << "\n";
+        out << "# TYPE dfs_session_cache_entries gauge\n";
+        out << "dfs_session_cache_entries " << sessions.entries << "\n";
+        
+        MetadataCacheStats metadata = MetadataCache::getInstance().getStats();
+        out << "# TYPE dfs_metadata_cache_lookups_total counter\n";
+        out << "dfs_metadata_cache_lookups_total{cache=\"file\",result=\"hit\"} " << metadata.fileHits << "\n";
+        out << "dfs_metadata_cache_lookups_total{cache=\"file\",result=\"miss\"} " << metadata.fileMisses << "\n";
+        out << "dfs_metadata_cache_lookups_total{cache=\"share_token\",result=\"hit\"} " << metadata.shareTokenHits << "\n";
+        out << "dfs_metadata_cache_lookups_total{cache=\"share_token\",result=\"miss\"} " << metadata.shareTokenMisses << "\n";
+        out << "dfs_metadata_cache_lookups_total{cache=\"share_grant\",result=\"hit\"} " << metadata.shareGrantHits << "\n";
+        out << "dfs_metadata_cache_lookups_total{cache=\"share_grant\",result=\"miss\"} " << metadata.shareGrantMisses << "\n";
+    });
 }
 
 void WebServer::stop() {
+    // Stops pushing and reconciling files before the stores they read from go away
+    Cluster::getInstance().stop();
+    Maintenance::getInstance().stop();
+    // The connection gauges read httpServer, so no scrape may still be running when it goes
+    if (collectorsRegistered) {
+        Metrics::getInstance().removeCollectors();
+        collectorsRegistered = false;
+    }
     if (httpServer) {
         httpServer->stop();
         delete httpServer;
         httpServer = nullptr;
     }
+    if (threadPool) {
+        threadPool->joinAll();
+        delete threadPool;
+        threadPool = nullptr;
+    }
+    TransferReactor::getInstance().stop();
+    Compression::getInstance().stop();
+    ChunkStore::getInstance().stop();
+    StorageBackend::getInstance().stop();
 }
@@ -6,44 +6,102 @@
 #include <Poco/Net/HTTPRequestHandlerFactory.h>
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/ThreadPool.h>
+#include "FileManager.h"
+#include "FileTransfer.h"
+#include "TransferReactor.h"
+#include "Compression.h"
+#include "Router.h"
+#include <vector>
 
+// One request, already routed by the factory. The route handlers are static and
+// hold no state, so the only per-request allocation is this small dispatcher.
 class FileShareRequestHandler : public Poco::Net::HTTPRequestHandler {
 public:
+    explicit FileShareRequestHandler(RouteMatch&& match);
+    
     void handleRequest(Poco::Net::HTTPServerRequest& request, 
                       Poco::Net::HTTPServerResponse& response) override;
+    
+    static void registerRoutes(Router& router);
 
 private:
-    void setCORSHeaders(Poco::Net::HTTPServerResponse& response); 
-
-    void handleRegister(Poco::Net::HTTPServerRequest& request, 
-                       Poco::Net::HTTPServerResponse& response);
-    void handleLogin(Poco::Net::HTTPServerRequest& request, 
-                    Poco::Net::HTTPServerResponse& response);
-    void handleUpload(Poco::Net::HTTPServerRequest& request, 
-                     Poco::Net::HTTPServerResponse& response);
-    void handleDownload(Poco::Net::HTTPServerRequest& request, 
-                       Poco::Net::HTTPServerResponse& response);
-    void handleShare(Poco::Net::HTTPServerRequest& request, 
-                    Poco::Net::HTTPServerResponse& response);
-    void handleList(Poco::Net::HTTPServerRequest& request, 
-                   Poco::Net::HTTPServerResponse& response);
-    void handleSharedFileAccess(Poco::Net::HTTPServerRequest& request,  
-                    Poco::Net::HTTPServerResponse& response); // ← ADD THIS LINE
-    void handleSharedWithMe(Poco::Net::HTTPServerRequest& request, 
-                           Poco::Net::HTTPServerResponse& response);    // ← ADD THIS LINE
+    static void setCORSHeaders(Poco::Net::HTTPServerResponse& response); 
+
+    static void handleRegister(Poco::Net::HTTPServerRequest& request, 
+                              Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleLogin(Poco::Net::HTTPServerRequest& request, 
+                           Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleLogout(Poco::Net::HTTPServerRequest& request, 
+                            Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleUpload(Poco::Net::HTTPServerRequest& request, 
+                            Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleCreateUpload(Poco::Net::HTTPServerRequest& request, 
+                                  Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleUploadStatus(Poco::Net::HTTPServerRequest& request, 
+                                  Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleUploadChunk(Poco::Net::HTTPServerRequest& request, 
+                                 Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleCompleteUpload(Poco::Net::HTTPServerRequest& request, 
+                                    Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleCancelUpload(Poco::Net::HTTPServerRequest& request, 
+                                  Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleDownload(Poco::Net::HTTPServerRequest& request, 
+                              Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleShare(Poco::Net::HTTPServerRequest& request, 
+                           Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleBatchUpload(Poco::Net::HTTPServerRequest& request, 
+                                 Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleBatchDelete(Poco::Net::HTTPServerRequest& request, 
+                                 Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleBatchVisibility(Poco::Net::HTTPServerRequest& request, 
+                                     Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleBatchShare(Poco::Net::HTTPServerRequest& request, 
+                                Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleList(Poco::Net::HTTPServerRequest& request, 
+                          Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleSharedFileAccess(Poco::Net::HTTPServerRequest& request,  
+                                      Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleSharedWithMe(Poco::Net::HTTPServerRequest& request, 
+                                  Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleMetrics(Poco::Net::HTTPServerRequest& request, 
+                             Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleClusterStore(Poco::Net::HTTPServerRequest& request, 
+                                  Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    static void handleClusterRemove(Poco::Net::HTTPServerRequest& request, 
+                                   Poco::Net::HTTPServerResponse& response, const RouteMatch& match);
+    
+    static void sendFileResponse(Poco::Net::HTTPServerRequest& request, 
+                                Poco::Net::HTTPServerResponse& response, const FileInfo& info);
+    // False when the client accepts no encoding we can offer cheaply; nothing has been sent then
+    static bool sendCompressedResponse(Poco::Net::HTTPServerRequest& request, 
+                                       Poco::Net::HTTPServerResponse& response, const FileInfo& info, 
+                                       const std::string& path, Poco::UInt64 size, 
+                                       const std::vector<Compression::Encoding>& accepted, 
+                                       const std::string& etag);
+    static bool handOffTransfer(Poco::Net::HTTPServerRequest& request, Poco::Net::HTTPServerResponse& response, 
+                                FileTransfer& transfer, std::vector<TransferSegment>& segments, 
+                                Poco::UInt64 bodyLength);
+    
+    static bool authenticateRequest(Poco::Net::HTTPServerRequest& request, int& userId);
+    static void sendJSONResponse(Poco::Net::HTTPServerResponse& response, 
+                                const std::string& json, int status = 200);
+    static void sendErrorResponse(Poco::Net::HTTPServerResponse& response, 
+                                 const std::string& error, int status = 400);
+    static void sendNotModified(Poco::Net::HTTPServerResponse& response, const std::string& etag);
     
-    bool isUsernameExists(const std::string& username);
-    bool authenticateRequest(Poco::Net::HTTPServerRequest& request, int& userId);
-    void sendJSONResponse(Poco::Net::HTTPServerResponse& response, 
-                         const std::string& json, int status = 200);
-    void sendErrorResponse(Poco::Net::HTTPServerResponse& response, 
-                          const std::string& error, int status = 400);
+    RouteMatch match;
 };
 
 class FileShareRequestHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
 public:
+    FileShareRequestHandlerFactory();
+    
     Poco::Net::HTTPRequestHandler* createRequestHandler(
         const Poco::Net::HTTPServerRequest& request) override;
+
+private:
+    Router router;
 };
 
 class WebServer {
@@ -54,8 +112,13 @@ public:
     void stop();
 
 private:
+    void registerMetricCollectors();
+    
     int serverPort;
+    // Sized for the request lanes; the shared default pool holds only 16 threads
+    Poco::ThreadPool* threadPool;
     Poco::Net::HTTPServer* httpServer;
+    bool collectorsRegistered;
 };
 
 #endif
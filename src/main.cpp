@@ -5,13 +5,17 @@
 #include "FileManager.h"
 #include "WebServer.h"
 #include "Utils.h"
+#include "StorageMigrator.h"
+#include "StorageBackend.h"
+#include "Config.h"
 
 void printMenu() {
     std::cout << "\n=== Distributed File Sharing System ===\n";
     std::cout << "1. Start Web Server\n";
     std::cout << "2. Register User (CLI)\n";
     std::cout << "3. Login User (CLI)\n";
-    std::cout << "4. Exit\n";
+    std::cout << "4. Migrate uploads to fan-out layout\n";
+    std::cout << "5. Exit\n";
     std::cout << "Choose option: ";
 }
 
@@ -24,8 +28,8 @@ int main() {
         return 1;
     }
     
-    // Create uploads directory
-    Utils::createDirectory("./uploads/");
+    // Creates the storage directories
+    StorageBackend::getInstance();
     
     std::cout << "System initialized successfully!\n";
     
@@ -40,9 +44,11 @@ int main() {
         switch (choice) {
             case 1: {
                 if (!server) {
-                    server = new WebServer(8080);
+                    // Several nodes of a cluster can share one host on different ports
+                    int port = static_cast<int>(Config::getInt("DFS_HTTP_PORT", 8080));
+                    server = new WebServer(port);
                     server->start();
-                    std::cout << "Web server started. Access at http://localhost:8080\n";
+                    std::cout << "Web server started. Access at http://localhost:" << port << "\n";
                     std::cout << "Press Enter to continue...\n";
                     std::cin.get();
                 } else {
@@ -71,7 +77,7 @@ int main() {
                 std::cout << "Enter password: ";
                 std::getline(std::cin, password);
                 
-                if (User::authenticateUser(username, password)) {
+                if (User::authenticateUser(username, password) > 0) {
                     std::cout << "Login successful!\n";
                 } else {
                     std::cout << "Login failed!\n";
@@ -80,6 +86,12 @@ int main() {
             }
             
             case 4: {
+                // Runs in the foreground; a started server keeps serving meanwhile
+                StorageMigrator::migrateAll();
+                break;
+            }
+            
+            case 5: {
                 if (server) {
                     server->stop();
                     delete server;